@@ -0,0 +1,232 @@
+#ifndef BENCH_HARNESS_HPP
+#define BENCH_HARNESS_HPP
+
+// Minimal benchmark harness used by benchmark.cpp:
+// warmup, repeated runs, ns/op with a 95% confidence interval,
+// do-not-optimize barriers, optional hardware counters and JSON output.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perf_counters.hpp"
+
+// Forces `value` to be materialized, so the computation producing it cannot
+// be optimized away. Replaces the old `volatile int sink` trick.
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static const T* volatile sink;
+    sink = &value;
+#endif
+}
+
+// Prevents the compiler from caching memory values across this point.
+inline void clobber_memory() {
+#if defined(__GNUC__)
+    asm volatile("" : : : "memory");
+#endif
+}
+
+// Deterministic splitmix64 generator: same stream on every platform and
+// standard library for a given seed (unlike std::uniform_int_distribution).
+class BenchRng {
+public:
+    explicit BenchRng(std::uint64_t seed) : state_(seed) {}
+
+    std::uint64_t next() {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform integer in [0, bound).
+    std::uint64_t below(std::uint64_t bound) { return next() % bound; }
+
+    // Uniform double in [0, 1).
+    double uniform() { return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+    std::uint64_t state_;
+};
+
+struct BenchConfig {
+    int warmup_runs = 2;       // Runs executed and discarded before measuring.
+    int runs = 10;             // Measured runs.
+    double min_run_ms = 20.0;  // Each run is sized to last at least this long.
+    std::uint64_t seed = 42;   // Seed for every generated workload.
+    bool perf_counters = true; // Collect hardware counters where available.
+};
+
+struct BenchResult {
+    std::vector<std::pair<std::string, std::string>> labels; // e.g. strategy, cases
+    std::vector<std::pair<std::string, double>> metrics;     // Extra per-op numbers, e.g. allocations
+    long long ops_per_run = 0;
+    int runs = 0;
+    double ns_per_op = 0;  // Mean over measured runs.
+    double stddev = 0;     // Standard deviation of ns/op between runs.
+    double ci95_low = 0;
+    double ci95_high = 0;
+    // Hardware counters per op, or negative if unavailable.
+    double cycles_per_op = -1;
+    double instructions_per_op = -1;
+    double branch_misses_per_op = -1;
+    double l1i_misses_per_op = -1;
+    double itlb_misses_per_op = -1;
+};
+
+// Two-sided 95% Student t critical value for `df` degrees of freedom.
+inline double bench_t95(int df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < 1) return 0.0;
+    if (df <= 30) return table[df - 1];
+    return 1.960;
+}
+
+// Fills mean, standard deviation and 95% confidence interval of `r` from
+// per-run ns/op samples.
+inline void summarize_samples(BenchResult& r, const std::vector<double>& samples) {
+    r.runs = static_cast<int>(samples.size());
+    double sum = 0;
+    for (double s : samples) sum += s;
+    r.ns_per_op = samples.empty() ? 0 : sum / static_cast<double>(samples.size());
+    double var = 0;
+    for (double s : samples) var += (s - r.ns_per_op) * (s - r.ns_per_op);
+    if (samples.size() > 1) var /= static_cast<double>(samples.size() - 1);
+    r.stddev = std::sqrt(var);
+    double half = samples.size() > 1
+        ? bench_t95(static_cast<int>(samples.size()) - 1) * r.stddev / std::sqrt(static_cast<double>(samples.size()))
+        : 0.0;
+    r.ci95_low = r.ns_per_op - half;
+    r.ci95_high = r.ns_per_op + half;
+}
+
+// Runs `body(ops)` (which must execute `ops` operations) with warmup and
+// repeats. The op count is calibrated so one run lasts at least min_run_ms.
+template <typename Body>
+BenchResult run_benchmark(const BenchConfig& config,
+                          std::vector<std::pair<std::string, std::string>> labels,
+                          Body&& body) {
+    using clock = std::chrono::steady_clock;
+    auto time_ns = [&](long long ops) {
+        auto start = clock::now();
+        body(ops);
+        clobber_memory();
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+    };
+
+    // Calibrate: grow the op count until a run is long enough.
+    long long ops = 1;
+    double min_ns = config.min_run_ms * 1e6;
+    for (;;) {
+        double ns = time_ns(ops);
+        if (ns >= min_ns || ops >= (1ll << 40)) break;
+        if (ns < min_ns / 100) {
+            ops *= 16;
+        } else {
+            ops = static_cast<long long>(static_cast<double>(ops) * (min_ns / ns) * 1.1) + 1;
+        }
+    }
+
+    for (int i = 0; i < config.warmup_runs; ++i) time_ns(ops);
+
+    std::vector<double> samples;
+    samples.reserve(static_cast<std::size_t>(config.runs));
+    PerfCounters* counters = nullptr;
+    PerfCounters counter_storage;
+    if (config.perf_counters && counter_storage.any_available()) counters = &counter_storage;
+    std::uint64_t totals[PerfCounters::EventCount] = {};
+    for (int i = 0; i < config.runs; ++i) {
+        if (counters) counters->start();
+        double ns = time_ns(ops);
+        if (counters) {
+            counters->stop();
+            for (int e = 0; e < PerfCounters::EventCount; ++e)
+                totals[e] += counters->value(static_cast<PerfCounters::Event>(e));
+        }
+        samples.push_back(ns / static_cast<double>(ops));
+    }
+
+    BenchResult r;
+    r.labels = std::move(labels);
+    r.ops_per_run = ops;
+    summarize_samples(r, samples);
+    if (counters) {
+        double total_ops = static_cast<double>(ops) * config.runs;
+        auto per_op = [&](PerfCounters::Event e) {
+            return counters->available(e) ? static_cast<double>(totals[e]) / total_ops : -1.0;
+        };
+        r.cycles_per_op = per_op(PerfCounters::Cycles);
+        r.instructions_per_op = per_op(PerfCounters::Instructions);
+        r.branch_misses_per_op = per_op(PerfCounters::BranchMisses);
+        r.l1i_misses_per_op = per_op(PerfCounters::L1iMisses);
+        r.itlb_misses_per_op = per_op(PerfCounters::ITlbMisses);
+    }
+    return r;
+}
+
+// Escapes a string for a JSON string literal.
+inline std::string bench_json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out += hex[(c >> 4) & 0xF];
+                    out += hex[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+// Writes `results` as a JSON array of flat objects.
+inline void write_json(std::ostream& out, const std::vector<BenchResult>& results) {
+    out << "[\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "  {";
+        for (const auto& label : r.labels) {
+            out << '"' << bench_json_escape(label.first) << "\": \"" << bench_json_escape(label.second) << "\", ";
+        }
+        out << "\"ns_per_op\": " << r.ns_per_op
+            << ", \"stddev\": " << r.stddev
+            << ", \"ci95_low\": " << r.ci95_low
+            << ", \"ci95_high\": " << r.ci95_high
+            << ", \"runs\": " << r.runs
+            << ", \"ops_per_run\": " << r.ops_per_run;
+        for (const auto& metric : r.metrics) {
+            out << ", \"" << bench_json_escape(metric.first) << "\": " << metric.second;
+        }
+        auto counter = [&](const char* name, double v) {
+            if (v >= 0) out << ", \"" << name << "\": " << v;
+        };
+        counter("cycles_per_op", r.cycles_per_op);
+        counter("instructions_per_op", r.instructions_per_op);
+        counter("branch_misses_per_op", r.branch_misses_per_op);
+        counter("l1i_misses_per_op", r.l1i_misses_per_op);
+        counter("itlb_misses_per_op", r.itlb_misses_per_op);
+        out << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    out << "]\n";
+}
+
+#endif // BENCH_HARNESS_HPP
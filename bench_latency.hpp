@@ -0,0 +1,159 @@
+#ifndef BENCH_LATENCY_HPP
+#define BENCH_LATENCY_HPP
+
+// Per-call latency measurement for benchmark.cpp: serialized rdtsc/rdtscp
+// timing with calibrated overhead, cache eviction between calls, and exact
+// percentiles over the recorded samples.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#include "bench_harness.hpp"
+#include "switch_timing.hpp"
+
+// Cost in cycles of an empty switch_cycles_begin()/switch_cycles_end() pair.
+// The minimum over many trials is used: it is the overhead that remains in
+// every measurement, while larger values are interrupts and noise.
+inline std::uint64_t calibrate_timer_overhead(int trials = 10000) {
+    std::uint64_t best = ~std::uint64_t{0};
+    for (int i = 0; i < trials; ++i) {
+        std::uint64_t start = switch_cycles_begin();
+        std::uint64_t end = switch_cycles_end();
+        best = std::min(best, end - start);
+    }
+    return best;
+}
+
+// Timer ticks per nanosecond, measured against steady_clock.
+inline double calibrate_ticks_per_ns() {
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+    std::uint64_t c0 = switch_cycles_begin();
+    while (clock::now() - t0 < std::chrono::milliseconds(50)) {
+    }
+    std::uint64_t c1 = switch_cycles_end();
+    double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count());
+    return ns > 0 ? static_cast<double>(c1 - c0) / ns : 1.0;
+}
+
+// Size of the last-level cache in bytes, or a conservative default.
+inline std::size_t last_level_cache_bytes() {
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l3 > 0) return static_cast<std::size_t>(l3);
+#endif
+    return std::size_t{32} << 20;
+}
+
+// Evicts the caches between timed calls by streaming through a buffer.
+// `cold` uses 8 MiB, enough to flush L1/L2 and much of the LLC, like unrelated
+// request work would. `flushed` reads twice the LLC (capped at 512 MiB) and
+// then clflushes the buffer, so nothing touched by the previous call is left
+// in any cache level. A flushed eviction can take a second on large LLCs.
+// Both modes also touch one line in each page of a 32 MiB region (8192 pages,
+// more than current STLBs hold) and run a burst of random branches, so TLB
+// entries and branch history of the previous call are gone too.
+class CacheEvictor {
+public:
+    enum Mode { None, Cold, Flushed };
+
+    explicit CacheEvictor(Mode mode) : mode_(mode), rng_(0x5EED) {
+        std::size_t bytes = mode == Flushed ? std::min(2 * last_level_cache_bytes(), std::size_t{512} << 20)
+                          : mode == Cold ? (std::size_t{8} << 20) : 0;
+        buffer_.assign(bytes / sizeof(std::uint64_t), 1);
+        if (mode != None) pages_.assign(std::size_t{32} << 20, 1);
+    }
+
+    void evict() {
+        if (mode_ == None) return;
+        scrub_tlb_and_branches();
+        std::uint64_t sum = 0;
+        for (std::size_t i = 0; i < buffer_.size(); i += 64 / sizeof(std::uint64_t)) {
+            sum += buffer_[i];
+            if (mode_ == Cold) buffer_[i] = sum; // Dirty lines, as real work would.
+        }
+#if SWITCH_HAS_RDTSC
+        if (mode_ == Flushed) {
+            for (std::size_t i = 0; i < buffer_.size(); i += 64 / sizeof(std::uint64_t)) {
+                _mm_clflush(&buffer_[i]);
+            }
+            _mm_mfence();
+        }
+#endif
+        do_not_optimize(sum);
+    }
+
+    static const char* name(Mode mode) {
+        return mode == None ? "warm" : mode == Cold ? "cold" : "flushed";
+    }
+
+private:
+    void scrub_tlb_and_branches() {
+        unsigned sum = 0;
+        for (std::size_t i = 0; i < pages_.size(); i += 4096) sum += static_cast<unsigned char>(pages_[i]);
+        for (int i = 0; i < 4096; ++i) {
+            std::uint64_t bits = rng_.next();
+            if (bits & 1) sum += 3;
+            if (bits & 2) sum ^= 5;
+            if (bits & 4) sum *= 7;
+            clobber_memory();
+        }
+        do_not_optimize(sum);
+    }
+
+    Mode mode_;
+    BenchRng rng_;
+    std::vector<std::uint64_t> buffer_;
+    std::vector<char> pages_;
+};
+
+// Fills `r` with the latency distribution of `cycles` (per-call samples,
+// overhead already subtracted): mean as ns_per_op and percentiles as metrics.
+inline void summarize_latency(BenchResult& r, std::vector<std::uint64_t> cycles, double ticks_per_ns) {
+    if (cycles.empty()) return;
+    std::sort(cycles.begin(), cycles.end());
+    auto ns = [&](std::uint64_t c) { return static_cast<double>(c) / ticks_per_ns; };
+    auto at = [&](double q) {
+        std::size_t index = static_cast<std::size_t>(q * static_cast<double>(cycles.size() - 1));
+        return ns(cycles[index]);
+    };
+    std::vector<double> samples;
+    samples.reserve(cycles.size());
+    for (std::uint64_t c : cycles) samples.push_back(ns(c));
+    summarize_samples(r, samples);
+    r.runs = 1;
+    r.ops_per_run = static_cast<long long>(cycles.size());
+    r.metrics = {{"min_ns", ns(cycles.front())}, {"p50_ns", at(0.50)}, {"p90_ns", at(0.90)},
+                 {"p99_ns", at(0.99)}, {"p999_ns", at(0.999)}, {"p9999_ns", at(0.9999)},
+                 {"max_ns", ns(cycles.back())}};
+}
+
+// Times `calls` invocations of `body(i)` per sample, `samples` times, with
+// `evictor` run (untimed) before each sample. Returns per-call cycles with the
+// timer overhead subtracted.
+template <typename Body>
+std::vector<std::uint64_t> measure_latency(int samples, int calls, std::uint64_t overhead,
+                                           CacheEvictor& evictor, Body&& body) {
+    std::vector<std::uint64_t> cycles;
+    cycles.reserve(static_cast<std::size_t>(samples));
+    std::size_t index = 0;
+    for (int s = 0; s < samples; ++s) {
+        evictor.evict();
+        std::uint64_t start = switch_cycles_begin();
+        for (int c = 0; c < calls; ++c) body(index++);
+        std::uint64_t end = switch_cycles_end();
+        std::uint64_t elapsed = end - start;
+        elapsed = elapsed > overhead ? elapsed - overhead : 0;
+        cycles.push_back(elapsed / static_cast<std::uint64_t>(calls));
+    }
+    return cycles;
+}
+
+#endif // BENCH_LATENCY_HPP
@@ -0,0 +1,62 @@
+#ifndef BENCH_RULES_HPP
+#define BENCH_RULES_HPP
+
+// Synthetic rule sets for the rule-engine benchmarks: records with two
+// integer fields and a string field, and seeded rule files over them that mix
+// key-only rules (indexable) with multi-condition rules (scanned).
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bench_harness.hpp"
+#include "switch_rules.hpp"
+
+struct BenchRecord {
+    std::int64_t key;
+    std::int64_t amount;
+    std::string tag;
+};
+
+constexpr const char* kBenchTags[] = {"alpha", "beta", "gamma", "delta"};
+
+inline RuleSchema<BenchRecord> bench_rule_schema() {
+    RuleSchema<BenchRecord> schema;
+    schema.int_field("key", [](const BenchRecord& r) { return r.key; })
+          .int_field("amount", [](const BenchRecord& r) { return r.amount; })
+          .string_field("tag", [](const BenchRecord& r) { return std::string_view(r.tag); });
+    return schema;
+}
+
+// `rules` rules over keys in [0, rules * 10). Every fourth rule tests the key
+// alone; the others also test amount and tag.
+inline std::string bench_rule_text(int rules, std::uint64_t seed) {
+    BenchRng rng(seed);
+    std::string text;
+    for (int i = 0; i < rules; ++i) {
+        std::int64_t lo = i * 10 + static_cast<std::int64_t>(rng.below(5));
+        text += "rule r" + std::to_string(i) + ": key in " + std::to_string(lo) + ".." + std::to_string(lo + 4);
+        if (i % 4 != 0) {
+            text += " and amount >= " + std::to_string(rng.below(100));
+            text += " and tag prefix \"" + std::string(kBenchTags[rng.below(4)]).substr(0, 2) + "\"";
+        }
+        text += " -> act" + std::to_string(i % 4) + "\n";
+    }
+    return text + "default -> none\n";
+}
+
+// Records hitting the rules above (and the gaps between them) uniformly.
+inline std::vector<BenchRecord> bench_rule_values(int rules, std::uint64_t seed) {
+    BenchRng rng(seed ^ 0x9e3779b97f4a7c15ull);
+    std::vector<BenchRecord> values(4096);
+    for (auto& v : values) {
+        v.key = static_cast<std::int64_t>(rng.below(static_cast<std::uint64_t>(rules) * 10));
+        v.amount = static_cast<std::int64_t>(rng.below(200));
+        v.tag = kBenchTags[rng.below(4)];
+    }
+    return values;
+}
+
+#endif // BENCH_RULES_HPP
@@ -0,0 +1,177 @@
+#ifndef BENCH_STRATEGIES_HPP
+#define BENCH_STRATEGIES_HPP
+
+// Dispatch strategies compared by benchmark.cpp. Every strategy maps a value
+// in [0, K) to case `value` (first match) and anything else to the default,
+// and returns bench_work() of the case that ran (-1 for the default).
+
+#include <array>
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+
+#include "custom_switch.hpp"
+
+// Work done by every case: cheap and case-specific, so dispatch dominates the
+// cost and the result still depends on which case ran.
+constexpr int bench_work(int id) {
+    return static_cast<int>((static_cast<unsigned>(id) * 2654435761u) >> 16);
+}
+
+// Body of case I. Kept out of line and opaque to the optimizer, so that every
+// strategy really branches to distinct code instead of being folded into a
+// table of constants.
+template <int I>
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+int bench_case() {
+    int r = bench_work(I);
+#if defined(__GNUC__)
+    asm volatile("" : "+r"(r));
+#endif
+    return r;
+}
+
+// Case counts benchmarked for every strategy.
+constexpr int kBenchCaseCounts[] = {2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+
+// Calls f(std::integral_constant<int, K>{}) for every K in kBenchCaseCounts up to max_cases.
+template <typename F>
+void for_each_case_count(int max_cases, F&& f) {
+    if (2 <= max_cases) f(std::integral_constant<int, 2>{});
+    if (4 <= max_cases) f(std::integral_constant<int, 4>{});
+    if (8 <= max_cases) f(std::integral_constant<int, 8>{});
+    if (16 <= max_cases) f(std::integral_constant<int, 16>{});
+    if (32 <= max_cases) f(std::integral_constant<int, 32>{});
+    if (64 <= max_cases) f(std::integral_constant<int, 64>{});
+    if (128 <= max_cases) f(std::integral_constant<int, 128>{});
+    if (256 <= max_cases) f(std::integral_constant<int, 256>{});
+    if (512 <= max_cases) f(std::integral_constant<int, 512>{});
+    if (1024 <= max_cases) f(std::integral_constant<int, 1024>{});
+}
+
+// --- Case generators for the native switch and the if/else chain ---
+#define BENCH_SWITCH_CASE_1(n) case (n): return bench_case<(n)>();
+#define BENCH_SWITCH_CASE_2(n) BENCH_SWITCH_CASE_1(n) BENCH_SWITCH_CASE_1((n) + 1)
+#define BENCH_SWITCH_CASE_4(n) BENCH_SWITCH_CASE_2(n) BENCH_SWITCH_CASE_2((n) + 2)
+#define BENCH_SWITCH_CASE_8(n) BENCH_SWITCH_CASE_4(n) BENCH_SWITCH_CASE_4((n) + 4)
+#define BENCH_SWITCH_CASE_16(n) BENCH_SWITCH_CASE_8(n) BENCH_SWITCH_CASE_8((n) + 8)
+#define BENCH_SWITCH_CASE_32(n) BENCH_SWITCH_CASE_16(n) BENCH_SWITCH_CASE_16((n) + 16)
+#define BENCH_SWITCH_CASE_64(n) BENCH_SWITCH_CASE_32(n) BENCH_SWITCH_CASE_32((n) + 32)
+#define BENCH_SWITCH_CASE_128(n) BENCH_SWITCH_CASE_64(n) BENCH_SWITCH_CASE_64((n) + 64)
+#define BENCH_SWITCH_CASE_256(n) BENCH_SWITCH_CASE_128(n) BENCH_SWITCH_CASE_128((n) + 128)
+#define BENCH_SWITCH_CASE_512(n) BENCH_SWITCH_CASE_256(n) BENCH_SWITCH_CASE_256((n) + 256)
+#define BENCH_SWITCH_CASE_1024(n) BENCH_SWITCH_CASE_512(n) BENCH_SWITCH_CASE_512((n) + 512)
+
+#define BENCH_IF_CASE_1(n) if (v == (n)) return bench_case<(n)>();
+#define BENCH_IF_CASE_2(n) BENCH_IF_CASE_1(n) BENCH_IF_CASE_1((n) + 1)
+#define BENCH_IF_CASE_4(n) BENCH_IF_CASE_2(n) BENCH_IF_CASE_2((n) + 2)
+#define BENCH_IF_CASE_8(n) BENCH_IF_CASE_4(n) BENCH_IF_CASE_4((n) + 4)
+#define BENCH_IF_CASE_16(n) BENCH_IF_CASE_8(n) BENCH_IF_CASE_8((n) + 8)
+#define BENCH_IF_CASE_32(n) BENCH_IF_CASE_16(n) BENCH_IF_CASE_16((n) + 16)
+#define BENCH_IF_CASE_64(n) BENCH_IF_CASE_32(n) BENCH_IF_CASE_32((n) + 32)
+#define BENCH_IF_CASE_128(n) BENCH_IF_CASE_64(n) BENCH_IF_CASE_64((n) + 64)
+#define BENCH_IF_CASE_256(n) BENCH_IF_CASE_128(n) BENCH_IF_CASE_128((n) + 128)
+#define BENCH_IF_CASE_512(n) BENCH_IF_CASE_256(n) BENCH_IF_CASE_256((n) + 256)
+#define BENCH_IF_CASE_1024(n) BENCH_IF_CASE_512(n) BENCH_IF_CASE_512((n) + 512)
+
+// Built-in `switch` with K equality cases.
+template <int K> int native_switch(int v);
+
+// if / else if chain with K equality tests.
+template <int K> int if_else_chain(int v);
+
+#define BENCH_DEFINE_NATIVE(K) \
+    template <> inline int native_switch<K>(int v) { \
+        switch (v) { \
+            BENCH_SWITCH_CASE_##K(0) \
+            default: return -1; \
+        } \
+    } \
+    template <> inline int if_else_chain<K>(int v) { \
+        BENCH_IF_CASE_##K(0) \
+        return -1; \
+    }
+
+BENCH_DEFINE_NATIVE(2)
+BENCH_DEFINE_NATIVE(4)
+BENCH_DEFINE_NATIVE(8)
+BENCH_DEFINE_NATIVE(16)
+BENCH_DEFINE_NATIVE(32)
+BENCH_DEFINE_NATIVE(64)
+BENCH_DEFINE_NATIVE(128)
+BENCH_DEFINE_NATIVE(256)
+BENCH_DEFINE_NATIVE(512)
+BENCH_DEFINE_NATIVE(1024)
+
+// Table of function pointers indexed by the value, with a bounds check.
+template <int K>
+class FunctionTable {
+public:
+    using Entry = int (*)();
+
+    int operator()(int v) const {
+        return static_cast<unsigned>(v) < static_cast<unsigned>(K) ? table_[static_cast<std::size_t>(v)]() : -1;
+    }
+
+    static constexpr const std::array<Entry, K>& entries() { return table_; }
+
+private:
+    template <int... I>
+    static constexpr std::array<Entry, K> make(std::integer_sequence<int, I...>) {
+        return {{&bench_case<I>...}};
+    }
+
+    static constexpr std::array<Entry, K> table_ = make(std::make_integer_sequence<int, K>{});
+};
+
+// std::unordered_map from value to function pointer.
+template <int K>
+class HashDispatch {
+public:
+    HashDispatch() { fill(std::make_integer_sequence<int, K>{}); }
+
+    int operator()(int v) const {
+        auto it = map_.find(v);
+        return it != map_.end() ? it->second() : -1;
+    }
+
+private:
+    template <int... I>
+    void fill(std::integer_sequence<int, I...>) {
+        (map_.emplace(I, &bench_case<I>), ...);
+    }
+
+    std::unordered_map<int, int (*)()> map_;
+};
+
+// Custom Switch used the way SWITCH/CASE/BREAK expand: the Switch object and
+// all of its cases are built for every evaluated value.
+template <int K>
+int custom_switch_dispatch(int v) {
+    int result = -1;
+    Switch<int> sw(v);
+    for (int i = 0; i < K; ++i) {
+        sw.add_case([i](const int& val) { return val == i; },
+                    [&result, entry = FunctionTable<K>::entries()[static_cast<std::size_t>(i)]]() { result = entry(); });
+    }
+    sw.add_default([&result]() { result = -1; });
+    sw.evaluate();
+    return result;
+}
+
+// Calls f(name, dispatch) for every strategy with K cases, where dispatch is a
+// callable int(int). Tables and maps are built once per K and reused.
+template <int K, typename F>
+void for_each_strategy(F&& f) {
+    static const FunctionTable<K> table;
+    static const HashDispatch<K> hash;
+    f("switch_macro", [](int v) { return custom_switch_dispatch<K>(v); });
+    f("native_switch", [](int v) { return native_switch<K>(v); });
+    f("if_else", [](int v) { return if_else_chain<K>(v); });
+    f("function_table", [](int v) { return table(v); });
+    f("unordered_map", [](int v) { return hash(v); });
+}
+
+#endif // BENCH_STRATEGIES_HPP
@@ -0,0 +1,89 @@
+#ifndef BENCH_THREADS_HPP
+#define BENCH_THREADS_HPP
+
+// Multi-threaded throughput runs for benchmark.cpp: pinned worker threads
+// that start together, run for a fixed time and report their op counts.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Number of CPUs available to this process.
+inline unsigned bench_cpu_count() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// Pins the calling thread to `cpu` (modulo the CPU count). Returns false where
+// pinning is not supported or not allowed; the run then continues unpinned.
+inline bool pin_current_thread(unsigned cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % bench_cpu_count(), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Result of one multi-threaded run.
+struct ThreadRunResult {
+    double seconds = 0;              // Wall time between start and stop.
+    std::uint64_t total_ops = 0;     // Sum over all threads.
+    bool pinned = true;              // False if any thread could not be pinned.
+};
+
+// Runs `body(thread_index, stop)` on `threads` threads, each pinned to its own
+// CPU. All threads start at once; after `duration` the stop flag is raised.
+// `body` must poll `stop` (relaxed loads, e.g. every few hundred ops) and
+// return the number of ops it completed.
+template <typename Body>
+ThreadRunResult run_threads(unsigned threads, std::chrono::nanoseconds duration, Body&& body) {
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> pinned{true};
+    std::vector<std::uint64_t> ops(threads, 0);
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            if (!pin_current_thread(t)) pinned.store(false, std::memory_order_relaxed);
+            ready.fetch_add(1, std::memory_order_acq_rel);
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            ops[t] = body(t, stop);
+        });
+    }
+    while (ready.load(std::memory_order_acquire) != threads) std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& w : workers) w.join();
+    auto end = std::chrono::steady_clock::now();
+
+    ThreadRunResult r;
+    r.seconds = std::chrono::duration<double>(end - start).count();
+    for (std::uint64_t n : ops) r.total_ops += n;
+    r.pinned = pinned.load(std::memory_order_relaxed);
+    return r;
+}
+
+// Thread counts to measure: 1, 2, 4, ... up to and including `max_threads`.
+inline std::vector<unsigned> thread_counts(unsigned max_threads) {
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < max_threads; n *= 2) counts.push_back(n);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+#endif // BENCH_THREADS_HPP
@@ -0,0 +1,142 @@
+#ifndef BENCH_WORKLOADS_HPP
+#define BENCH_WORKLOADS_HPP
+
+// Value streams fed to the dispatch benchmarks. Every generator is seeded,
+// so a given (distribution, case count, seed) always yields the same stream.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bench_harness.hpp"
+
+// Length of every generated stream. A power of two so the benchmark loop can
+// wrap with a mask; 64K ints (256 KiB) stay in L2 on current machines.
+constexpr std::size_t kBenchStreamLength = std::size_t{1} << 16;
+
+// Uniformly random case values in [0, cases).
+inline std::vector<int> uniform_values(int cases, std::uint64_t seed) {
+    BenchRng rng(seed);
+    std::vector<int> values(kBenchStreamLength);
+    for (auto& v : values) v = static_cast<int>(rng.below(static_cast<std::uint64_t>(cases)));
+    return values;
+}
+
+// Zipf-distributed values (exponent `s`): rank r is drawn with probability
+// proportional to 1 / r^s. Ranks are mapped to case values through a random
+// permutation, so the hottest case is not always case 0.
+inline std::vector<int> zipf_values(int cases, std::uint64_t seed, double s = 1.0) {
+    BenchRng rng(seed);
+    std::vector<double> cdf(static_cast<std::size_t>(cases));
+    double total = 0;
+    for (int r = 0; r < cases; ++r) {
+        total += 1.0 / std::pow(static_cast<double>(r + 1), s);
+        cdf[static_cast<std::size_t>(r)] = total;
+    }
+    std::vector<int> rank_to_value(static_cast<std::size_t>(cases));
+    for (int i = 0; i < cases; ++i) rank_to_value[static_cast<std::size_t>(i)] = i;
+    for (std::size_t i = rank_to_value.size(); i > 1; --i) {
+        std::swap(rank_to_value[i - 1], rank_to_value[static_cast<std::size_t>(rng.below(i))]);
+    }
+    std::vector<int> values(kBenchStreamLength);
+    for (auto& v : values) {
+        double u = rng.uniform() * total;
+        auto rank = static_cast<std::size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        v = rank_to_value[std::min(rank, rank_to_value.size() - 1)];
+    }
+    return values;
+}
+
+// Uniform values sorted ascending: long runs, trivially predictable.
+inline std::vector<int> sorted_values(int cases, std::uint64_t seed) {
+    std::vector<int> values = uniform_values(cases, seed);
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+// Runs of a repeated random value; run lengths are uniform in [1, 2 * mean_run).
+inline std::vector<int> run_length_values(int cases, std::uint64_t seed, int mean_run = 8) {
+    BenchRng rng(seed);
+    std::vector<int> values(kBenchStreamLength);
+    std::size_t i = 0;
+    while (i < values.size()) {
+        int v = static_cast<int>(rng.below(static_cast<std::uint64_t>(cases)));
+        std::size_t run = 1 + rng.below(static_cast<std::uint64_t>(2 * mean_run - 1));
+        for (std::size_t j = 0; j < run && i < values.size(); ++j) values[i++] = v;
+    }
+    return values;
+}
+
+// A short random pattern of length `period` repeated over the whole stream.
+// Modern predictors learn short periods; long ones look random.
+inline std::vector<int> periodic_values(int cases, std::uint64_t seed, int period = 8) {
+    BenchRng rng(seed);
+    std::vector<int> pattern(static_cast<std::size_t>(period));
+    for (auto& v : pattern) v = static_cast<int>(rng.below(static_cast<std::uint64_t>(cases)));
+    std::vector<int> values(kBenchStreamLength);
+    for (std::size_t i = 0; i < values.size(); ++i) values[i] = pattern[i % pattern.size()];
+    return values;
+}
+
+// Misprediction-maximizing values for first-match compare chains: case i is
+// drawn with probability 2^-(i+1) (the last case takes the remainder), so every
+// test `val == i` that is reached is true exactly half of the time and its
+// outcome is independent of history.
+inline std::vector<int> adversarial_values(int cases, std::uint64_t seed) {
+    BenchRng rng(seed);
+    std::vector<int> values(kBenchStreamLength);
+    for (auto& v : values) {
+        int i = 0;
+        while (i + 1 < cases && (rng.next() & 1) == 0) ++i;
+        v = i;
+    }
+    return values;
+}
+
+// Value distributions available to the benchmarks.
+enum class Distribution { Uniform, Zipf, Sorted, RunLength, Periodic, Adversarial };
+
+constexpr Distribution kAllDistributions[] = {
+    Distribution::Uniform, Distribution::Zipf, Distribution::Sorted,
+    Distribution::RunLength, Distribution::Periodic, Distribution::Adversarial};
+
+inline const char* distribution_name(Distribution d) {
+    switch (d) {
+        case Distribution::Uniform: return "uniform";
+        case Distribution::Zipf: return "zipf";
+        case Distribution::Sorted: return "sorted";
+        case Distribution::RunLength: return "run_length";
+        case Distribution::Periodic: return "periodic";
+        case Distribution::Adversarial: return "adversarial";
+    }
+    return "unknown";
+}
+
+// Parses a distribution name; returns false if it is unknown.
+inline bool parse_distribution(const std::string& name, Distribution& out) {
+    for (Distribution d : kAllDistributions) {
+        if (name == distribution_name(d)) {
+            out = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Generates the stream for `d` over `cases` case values.
+inline std::vector<int> make_values(Distribution d, int cases, std::uint64_t seed) {
+    switch (d) {
+        case Distribution::Uniform: return uniform_values(cases, seed);
+        case Distribution::Zipf: return zipf_values(cases, seed);
+        case Distribution::Sorted: return sorted_values(cases, seed);
+        case Distribution::RunLength: return run_length_values(cases, seed);
+        case Distribution::Periodic: return periodic_values(cases, seed);
+        case Distribution::Adversarial: return adversarial_values(cases, seed);
+    }
+    return uniform_values(cases, seed);
+}
+
+#endif // BENCH_WORKLOADS_HPP
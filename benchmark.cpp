@@ -0,0 +1,655 @@
+// Benchmark suite for the custom switch (replaces the single-run time_test.cpp).
+// Compares Switch, native switch, if/else, function-pointer tables and
+// std::unordered_map dispatch for 2..1024 cases, over uniform, Zipf, sorted,
+// run-length, periodic and adversarial value streams. The construction mode
+// times Switch construction, add_case, add_default and evaluate separately and
+// counts heap allocations per phase. The latency mode times single calls with
+// serialized rdtscp and reports the full distribution, warm, cold and flushed.
+// The coldstart mode measures the first call after a cache/TLB/branch flush,
+// including a prebuilt Switch with and without prefetch()/warm(). The threads
+// mode measures scaling over 1..N pinned threads with shared and per-thread
+// state and flags false sharing and contention. The rules mode compares the
+// engines for rule files: CompiledSwitch, bytecode VM, binary image, JIT,
+// tiered switch and the planner's pick, labelled planned:<strategy>.
+//
+// Build: g++ -std=c++17 -O2 -pthread -o benchmark benchmark.cpp
+// Usage: ./benchmark [--mode dispatch|construction|latency|coldstart|threads|rules|all]
+//                    [--json FILE] [--runs N] [--warmup N] [--min-time-ms X]
+//                    [--seed S] [--max-cases K] [--distribution NAME]
+//                    [--filter TEXT] [--no-perf] [--latency-samples N]
+//                    [--latency-group G] [--flush] [--threads N]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bench_harness.hpp"
+#include "bench_latency.hpp"
+#include "bench_rules.hpp"
+#include "bench_strategies.hpp"
+#include "bench_threads.hpp"
+#include "bench_workloads.hpp"
+#include "compiled_switch.hpp"
+#include "switch_bytecode.hpp"
+#include "switch_image.hpp"
+#include "switch_jit.hpp"
+#include "switch_planner.hpp"
+#include "switch_tiered.hpp"
+#include "switch_timing.hpp"
+
+using namespace std;
+
+// --- Allocation counting ---
+// Global operator new/delete are replaced for this program so every phase can
+// report allocations and bytes. Counters are thread-local: no atomic cost.
+// The operators are kept out of line so GCC does not pair the inlined free()
+// with the standard operator new (-Wmismatched-new-delete false positive).
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+static thread_local uint64_t t_alloc_count = 0;
+static thread_local uint64_t t_alloc_bytes = 0;
+
+BENCH_NOINLINE void* operator new(size_t size) {
+    ++t_alloc_count;
+    t_alloc_bytes += size;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+BENCH_NOINLINE void operator delete(void* p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+
+struct AllocSnapshot {
+    uint64_t count = t_alloc_count;
+    uint64_t bytes = t_alloc_bytes;
+};
+
+struct Options {
+    string mode = "dispatch"; // dispatch, construction, latency, coldstart, threads, rules or all.
+    BenchConfig config;
+    int latency_samples = 100000; // Warm samples per latency benchmark (cold: 1/50 of that).
+    int latency_group = 1;        // Calls timed together per latency sample.
+    bool latency_flush = false;   // Also measure with all caches flushed between calls.
+    unsigned max_threads = bench_cpu_count(); // Largest thread count of the threads mode.
+    string json_path;   // Empty: no JSON output.
+    int max_cases = 1024;
+    vector<Distribution> distributions{begin(kAllDistributions), end(kAllDistributions)};
+    string filter;      // Only run benchmarks whose name contains this text.
+};
+
+static void print_usage() {
+    cout << "Usage: benchmark [--mode dispatch|construction|latency|coldstart|threads|rules|all]\n"
+            "                 [--json FILE] [--runs N] [--warmup N] [--min-time-ms X]\n"
+            "                 [--seed S] [--max-cases K] [--distribution NAME]\n"
+            "                 [--filter TEXT] [--no-perf] [--latency-samples N]\n"
+            "                 [--latency-group G] [--flush] [--threads N]\n"
+            "Distributions: uniform, zipf, sorted, run_length, periodic, adversarial (default: all)" << endl;
+}
+
+static bool parse_options(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* value = nullptr;
+        if (arg == "--no-perf") {
+            opts.config.perf_counters = false;
+        } else if (arg == "--flush") {
+            opts.latency_flush = true;
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else if ((value = next()) == nullptr) {
+            cerr << "Missing value for " << arg << endl;
+            return false;
+        } else if (arg == "--mode") {
+            opts.mode = value;
+            if (opts.mode != "dispatch" && opts.mode != "construction" && opts.mode != "latency"
+                && opts.mode != "coldstart" && opts.mode != "threads" && opts.mode != "rules"
+                && opts.mode != "all") {
+                cerr << "Unknown mode " << value << endl;
+                return false;
+            }
+        } else if (arg == "--latency-samples") {
+            opts.latency_samples = atoi(value);
+        } else if (arg == "--latency-group") {
+            opts.latency_group = atoi(value);
+        } else if (arg == "--threads") {
+            opts.max_threads = static_cast<unsigned>(max(1, atoi(value)));
+        } else if (arg == "--json") {
+            opts.json_path = value;
+        } else if (arg == "--runs") {
+            opts.config.runs = atoi(value);
+        } else if (arg == "--warmup") {
+            opts.config.warmup_runs = atoi(value);
+        } else if (arg == "--min-time-ms") {
+            opts.config.min_run_ms = atof(value);
+        } else if (arg == "--seed") {
+            opts.config.seed = strtoull(value, nullptr, 10);
+        } else if (arg == "--max-cases") {
+            opts.max_cases = atoi(value);
+        } else if (arg == "--distribution") {
+            Distribution d;
+            if (!parse_distribution(value, d)) {
+                cerr << "Unknown distribution " << value << endl;
+                return false;
+            }
+            opts.distributions.assign(1, d);
+        } else if (arg == "--filter") {
+            opts.filter = value;
+        } else {
+            cerr << "Unknown option " << arg << endl;
+            return false;
+        }
+    }
+    return opts.config.runs > 0 && opts.latency_samples > 0 && opts.latency_group > 0;
+}
+
+// Prints one result line and keeps it for the JSON report.
+static void record(vector<BenchResult>& results, BenchResult r) {
+    for (const auto& label : r.labels) cout << setw(15) << left << label.second << " ";
+    cout << fixed << setprecision(2) << setw(10) << right << r.ns_per_op << " ns/op"
+         << "  [" << r.ci95_low << ", " << r.ci95_high << "]";
+    if (r.cycles_per_op >= 0) cout << "  cycles=" << r.cycles_per_op;
+    if (r.branch_misses_per_op >= 0) cout << "  br-miss=" << r.branch_misses_per_op;
+    for (const auto& metric : r.metrics) cout << "  " << metric.first << "=" << metric.second;
+    cout << endl;
+    results.push_back(move(r));
+}
+
+// Measures `dispatch` over `values`, one op per value.
+template <typename Dispatch>
+static void bench_dispatch(const Options& opts, vector<BenchResult>& results,
+                           const string& strategy, int cases, Distribution dist,
+                           const vector<int>& values, Dispatch&& dispatch) {
+    string name = strategy + "/" + to_string(cases) + "/" + distribution_name(dist);
+    if (!opts.filter.empty() && name.find(opts.filter) == string::npos) return;
+    const size_t mask = values.size() - 1;
+    record(results, run_benchmark(opts.config,
+        {{"strategy", strategy}, {"cases", to_string(cases)}, {"distribution", distribution_name(dist)}},
+        [&](long long ops) {
+            for (long long i = 0; i < ops; ++i) {
+                int r = dispatch(values[static_cast<size_t>(i) & mask]);
+                do_not_optimize(r);
+            }
+        }));
+}
+
+// Throughput of every strategy for every case count and value distribution.
+// Grouped by distribution, so crossover points between strategies line up.
+static void run_dispatch_suite(const Options& opts, vector<BenchResult>& results) {
+    for (Distribution dist : opts.distributions) {
+        for_each_case_count(opts.max_cases, [&](auto k) {
+            constexpr int K = decltype(k)::value;
+            vector<int> values = make_values(dist, K, opts.config.seed);
+            for_each_strategy<K>([&](const char* strategy, auto dispatch) {
+                bench_dispatch(opts, results, strategy, K, dist, values, dispatch);
+            });
+        });
+    }
+}
+
+// Value switched on by the construction benchmarks: an int, and a string long
+// enough to defeat the small-string buffer so the value copy allocates.
+template <typename T> T construction_value(int i);
+template <> int construction_value<int>(int i) { return i; }
+template <> string construction_value<string>(int i) { return string(40, 'a') + to_string(i); }
+
+template <typename T> const char* value_type_name();
+template <> const char* value_type_name<int>() { return "int"; }
+template <> const char* value_type_name<string>() { return "string"; }
+
+// Times the life cycle of Switch<T> with `cases` cases phase by phase:
+// construction (including the value copy), add_case, add_default, evaluate
+// and destruction. Work is done in batches so each phase is timed over many
+// objects at once; allocations are counted per phase.
+template <typename T>
+static void bench_construction(const Options& opts, vector<BenchResult>& results, int cases) {
+    enum { Construct, AddCase, AddDefault, Evaluate, Destroy, PhaseCount };
+    static const char* const phase_names[PhaseCount] = {
+        "construct", "add_case", "add_default", "evaluate", "destroy"};
+    string prefix = string("construction/") + value_type_name<T>() + "/" + to_string(cases) + "/";
+    bool any = false;
+    for (const char* phase : phase_names) {
+        if (opts.filter.empty() || (prefix + phase).find(opts.filter) != string::npos) any = true;
+    }
+    if (!any) return;
+
+    using clock = chrono::steady_clock;
+    constexpr size_t kBatch = 64;
+    vector<optional<Switch<T>>> batch(kBatch);
+    vector<T> values;
+    for (size_t i = 0; i < kBatch; ++i) values.push_back(construction_value<T>(static_cast<int>(i) % cases));
+    vector<T> keys;
+    for (int c = 0; c < cases; ++c) keys.push_back(construction_value<T>(c));
+    int sink = 0;
+
+    vector<double> samples[PhaseCount];
+    double allocs[PhaseCount] = {};
+    double bytes[PhaseCount] = {};
+    long long total_ops = 0;
+    long long ops_per_run = 0;
+    for (int run = -opts.config.warmup_runs; run < opts.config.runs; ++run) {
+        double ns[PhaseCount] = {};
+        uint64_t run_allocs[PhaseCount] = {};
+        uint64_t run_bytes[PhaseCount] = {};
+        long long ops = 0;
+        auto timed = [&](int phase, auto&& body) {
+            AllocSnapshot before;
+            auto start = clock::now();
+            for (size_t i = 0; i < kBatch; ++i) body(i);
+            clobber_memory();
+            ns[phase] += static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count());
+            AllocSnapshot after;
+            run_allocs[phase] += after.count - before.count;
+            run_bytes[phase] += after.bytes - before.bytes;
+        };
+        auto run_start = clock::now();
+        while (chrono::duration<double, milli>(clock::now() - run_start).count() < opts.config.min_run_ms) {
+            timed(Construct, [&](size_t i) { batch[i].emplace(values[i]); });
+            timed(AddCase, [&](size_t i) {
+                for (int c = 0; c < cases; ++c) {
+                    batch[i]->add_case([&keys, c](const T& val) { return keys[static_cast<size_t>(c)] == val; },
+                                       [&sink, c]() { sink += c; });
+                }
+            });
+            timed(AddDefault, [&](size_t i) { batch[i]->add_default([&sink]() { sink -= 1; }); });
+            timed(Evaluate, [&](size_t i) { batch[i]->evaluate(); });
+            timed(Destroy, [&](size_t i) { batch[i].reset(); });
+            ops += static_cast<long long>(kBatch);
+        }
+        if (run < 0) continue;
+        ops_per_run = ops;
+        total_ops += ops;
+        for (int p = 0; p < PhaseCount; ++p) {
+            samples[p].push_back(ns[p] / static_cast<double>(ops));
+            allocs[p] += static_cast<double>(run_allocs[p]);
+            bytes[p] += static_cast<double>(run_bytes[p]);
+        }
+    }
+    do_not_optimize(sink);
+
+    for (int p = 0; p < PhaseCount; ++p) {
+        if (!opts.filter.empty() && (prefix + phase_names[p]).find(opts.filter) == string::npos) continue;
+        BenchResult r;
+        r.labels = {{"benchmark", "construction"}, {"value_type", value_type_name<T>()},
+                    {"cases", to_string(cases)}, {"phase", phase_names[p]}};
+        r.ops_per_run = ops_per_run;
+        summarize_samples(r, samples[p]);
+        double n = total_ops > 0 ? static_cast<double>(total_ops) : 1.0;
+        r.metrics = {{"allocs_per_op", allocs[p] / n}, {"bytes_per_op", bytes[p] / n}};
+        record(results, move(r));
+    }
+}
+
+// Construction- versus dispatch-cost breakdown of Switch for every case count.
+static void run_construction_suite(const Options& opts, vector<BenchResult>& results) {
+    for (int cases : kBenchCaseCounts) {
+        if (cases > opts.max_cases) break;
+        bench_construction<int>(opts, results, cases);
+        bench_construction<string>(opts, results, cases);
+    }
+}
+
+// Latency distribution of single dispatches (or groups of --latency-group
+// calls) for every strategy, with warm caches, cold caches and optionally all
+// caches flushed between samples. Uses the first selected distribution.
+static void run_latency_suite(const Options& opts, vector<BenchResult>& results) {
+    const uint64_t overhead = calibrate_timer_overhead();
+    const double ticks_per_ns = calibrate_ticks_per_ns();
+    cout << "Timer overhead: " << overhead << " ticks, " << ticks_per_ns << " ticks/ns" << endl;
+
+    vector<CacheEvictor::Mode> modes = {CacheEvictor::None, CacheEvictor::Cold};
+    if (opts.latency_flush) modes.push_back(CacheEvictor::Flushed);
+    Distribution dist = opts.distributions.front();
+
+    for (CacheEvictor::Mode mode : modes) {
+        CacheEvictor evictor(mode);
+        int samples = mode == CacheEvictor::None ? opts.latency_samples : max(1, opts.latency_samples / 50);
+        for_each_case_count(opts.max_cases, [&](auto k) {
+            constexpr int K = decltype(k)::value;
+            vector<int> values = make_values(dist, K, opts.config.seed);
+            const size_t mask = values.size() - 1;
+            for_each_strategy<K>([&](const char* strategy, auto dispatch) {
+                string name = string("latency/") + strategy + "/" + to_string(K) + "/" + CacheEvictor::name(mode);
+                if (!opts.filter.empty() && name.find(opts.filter) == string::npos) return;
+                auto body = [&](size_t i) {
+                    int r = dispatch(values[i & mask]);
+                    do_not_optimize(r);
+                };
+                CacheEvictor none(CacheEvictor::None);
+                measure_latency(samples / 10 + 1, opts.latency_group, overhead, none, body); // warmup
+                BenchResult r;
+                r.labels = {{"benchmark", "latency"}, {"strategy", strategy}, {"cases", to_string(K)},
+                            {"distribution", distribution_name(dist)}, {"cache", CacheEvictor::name(mode)}};
+                summarize_latency(r, measure_latency(samples, opts.latency_group, overhead, evictor, body),
+                                  ticks_per_ns);
+                record(results, move(r));
+            });
+        });
+    }
+}
+
+// First-call latency: before every sample, caches, TLB and branch history are
+// flushed (--flush: the whole cache hierarchy), then one dispatch is timed.
+// Besides the usual strategies, a Switch built ahead of time is evaluated
+// as-is, after prefetch(), and after warm(); the preparation is not timed,
+// as it would run off the latency-critical path.
+static void run_coldstart_suite(const Options& opts, vector<BenchResult>& results) {
+    const uint64_t overhead = calibrate_timer_overhead();
+    const double ticks_per_ns = calibrate_ticks_per_ns();
+    CacheEvictor evictor(opts.latency_flush ? CacheEvictor::Flushed : CacheEvictor::Cold);
+    const char* cache = opts.latency_flush ? "flushed" : "cold";
+    const int samples = opts.latency_flush ? max(10, opts.latency_samples / 10000)
+                                           : max(20, opts.latency_samples / 500);
+    Distribution dist = opts.distributions.front();
+
+    for_each_case_count(opts.max_cases, [&](auto k) {
+        constexpr int K = decltype(k)::value;
+        vector<int> values = make_values(dist, K, opts.config.seed);
+        const size_t mask = values.size() - 1;
+        auto emit = [&](const string& strategy, vector<uint64_t> cycles) {
+            BenchResult r;
+            r.labels = {{"benchmark", "coldstart"}, {"strategy", strategy}, {"cases", to_string(K)},
+                        {"distribution", distribution_name(dist)}, {"cache", cache}};
+            summarize_latency(r, move(cycles), ticks_per_ns);
+            record(results, move(r));
+        };
+        auto selected = [&](const string& strategy) {
+            string name = "coldstart/" + strategy + "/" + to_string(K);
+            return opts.filter.empty() || name.find(opts.filter) != string::npos;
+        };
+
+        for_each_strategy<K>([&](const char* strategy, auto dispatch) {
+            if (!selected(strategy)) return;
+            emit(strategy, measure_latency(samples, 1, overhead, evictor, [&](size_t i) {
+                int r = dispatch(values[i & mask]);
+                do_not_optimize(r);
+            }));
+        });
+
+        // Prebuilt Switch: constructed before the flush, evaluated after it.
+        for (const char* prep : {"none", "prefetch", "warm"}) {
+            string strategy = string("switch_prebuilt/") + prep;
+            if (!selected(strategy)) continue;
+            vector<uint64_t> cycles;
+            int result = -1;
+            for (int s = 0; s < samples; ++s) {
+                Switch<int> sw(values[static_cast<size_t>(s) & mask]);
+                for (int i = 0; i < K; ++i) {
+                    sw.add_case([i](const int& val) { return val == i; },
+                                [&result, entry = FunctionTable<K>::entries()[static_cast<size_t>(i)]]() { result = entry(); });
+                }
+                sw.add_default([&result]() { result = -1; });
+                evictor.evict();
+                if (prep[0] == 'p') sw.prefetch();
+                if (prep[0] == 'w') sw.warm();
+                uint64_t start = switch_cycles_begin();
+                sw.evaluate();
+                uint64_t elapsed = switch_cycles_end() - start;
+                cycles.push_back(elapsed > overhead ? elapsed - overhead : 0);
+                do_not_optimize(result);
+            }
+            emit(strategy, move(cycles));
+        }
+    });
+}
+
+// --- Multi-threaded scaling ---
+constexpr int kThreadBenchCases = 16;
+static thread_local int t_case_result = -1;
+
+// A prebuilt CompiledSwitch. Actions write to a thread-local, so the switch
+// can be shared between threads.
+static CompiledSwitch<int> make_compiled_switch() {
+    CompiledSwitch<int> sw;
+    for (int i = 0; i < kThreadBenchCases; ++i) {
+        sw.add_case([i](const int& val) { return val == i; },
+                    [entry = FunctionTable<kThreadBenchCases>::entries()[static_cast<size_t>(i)]](const int&) {
+                        t_case_result = entry();
+                    });
+    }
+    sw.add_default([](const int&) { t_case_result = -1; });
+    return sw;
+}
+
+static int evaluate_compiled(const CompiledSwitch<int>& sw, int v) {
+    sw.evaluate(v);
+    return t_case_result;
+}
+
+// Per-thread counter, packed (8 bytes apart: neighbours share a cache line)
+// or padded to its own cache line.
+struct PackedCounter { uint64_t value = 0; };
+struct alignas(64) PaddedCounter { uint64_t value = 0; };
+
+// Throughput on 1..N pinned threads for:
+//  - switch_macro:  a Switch built per evaluation (no shared state),
+//  - compiled:      one CompiledSwitch shared by all threads vs. a copy per thread,
+//  - timed_profile: SWITCH_TIMED-style Switch recording into one shared
+//                   SwitchProfile vs. one profile per thread,
+//  - counter:       compiled plus a per-thread counter, packed vs. padded.
+// Reports scaling efficiency (throughput(n) / (n * throughput(1))) and flags
+// false sharing and shared-state contention.
+static void run_threads_suite(const Options& opts, vector<BenchResult>& results) {
+    constexpr int K = kThreadBenchCases;
+    const vector<int> values = make_values(opts.distributions.front(), K, opts.config.seed);
+    const size_t mask = values.size() - 1;
+    const auto duration = chrono::duration_cast<chrono::nanoseconds>(
+        chrono::duration<double, milli>(max(100.0, opts.config.min_run_ms * 5)));
+    const CompiledSwitch<int> shared_switch = make_compiled_switch();
+    SwitchProfile shared_profile(K, "shared");
+    PackedCounter packed[256];
+    PaddedCounter padded[256];
+
+    // Ops completed by thread `t` running `op(i)` until `stop`.
+    auto loop = [&](unsigned t, const atomic<bool>& stop, auto&& op) {
+        uint64_t ops = 0;
+        size_t i = static_cast<size_t>(t) * 7919;
+        while (!stop.load(memory_order_relaxed)) {
+            for (int n = 0; n < 256; ++n) {
+                int r = op(values[i++ & mask]);
+                do_not_optimize(r);
+            }
+            ops += 256;
+        }
+        return ops;
+    };
+
+    struct Variant {
+        const char* name;
+        const char* sharing;
+        function<uint64_t(unsigned, const atomic<bool>&)> body;
+    };
+    vector<Variant> variants = {
+        {"switch_macro", "none", [&](unsigned t, const atomic<bool>& stop) {
+            return loop(t, stop, [](int v) { return custom_switch_dispatch<K>(v); });
+        }},
+        {"compiled", "shared", [&](unsigned t, const atomic<bool>& stop) {
+            return loop(t, stop, [&](int v) { return evaluate_compiled(shared_switch, v); });
+        }},
+        {"compiled", "per_thread", [&](unsigned t, const atomic<bool>& stop) {
+            const CompiledSwitch<int> own = make_compiled_switch();
+            return loop(t, stop, [&](int v) { return evaluate_compiled(own, v); });
+        }},
+        {"timed_profile", "shared", [&](unsigned t, const atomic<bool>& stop) {
+            return loop(t, stop, [&](int v) {
+                int result = -1;
+                Switch<int, CycleTiming> sw(v, CycleTiming(shared_profile));
+                for (int i = 0; i < K; ++i) {
+                    sw.add_case([i](const int& val) { return val == i; }, [&result, i]() { result = i; });
+                }
+                sw.evaluate();
+                return result;
+            });
+        }},
+        {"timed_profile", "per_thread", [&](unsigned t, const atomic<bool>& stop) {
+            SwitchProfile profile(K, "per_thread");
+            return loop(t, stop, [&](int v) {
+                int result = -1;
+                Switch<int, CycleTiming> sw(v, CycleTiming(profile));
+                for (int i = 0; i < K; ++i) {
+                    sw.add_case([i](const int& val) { return val == i; }, [&result, i]() { result = i; });
+                }
+                sw.evaluate();
+                return result;
+            });
+        }},
+        {"counter", "packed", [&](unsigned t, const atomic<bool>& stop) {
+            return loop(t, stop, [&, t](int v) {
+                ++packed[t % 256].value;
+                clobber_memory();
+                return evaluate_compiled(shared_switch, v);
+            });
+        }},
+        {"counter", "padded", [&](unsigned t, const atomic<bool>& stop) {
+            return loop(t, stop, [&, t](int v) {
+                ++padded[t % 256].value;
+                clobber_memory();
+                return evaluate_compiled(shared_switch, v);
+            });
+        }},
+    };
+
+    // Throughput (ops/s) per variant and thread count, for the verdicts below.
+    map<string, map<unsigned, double>> throughput;
+    for (const Variant& variant : variants) {
+        string key = string(variant.name) + "/" + variant.sharing;
+        for (unsigned threads : thread_counts(opts.max_threads)) {
+            string name = "threads/" + key + "/" + to_string(threads);
+            if (!opts.filter.empty() && name.find(opts.filter) == string::npos) continue;
+            for (int w = 0; w < opts.config.warmup_runs; ++w) run_threads(threads, duration / 4, variant.body);
+            vector<double> samples;
+            bool pinned = true;
+            double ops_per_sec = 0;
+            for (int run = 0; run < opts.config.runs; ++run) {
+                ThreadRunResult tr = run_threads(threads, duration, variant.body);
+                pinned = pinned && tr.pinned;
+                samples.push_back(tr.seconds * 1e9 / static_cast<double>(max<uint64_t>(tr.total_ops, 1)));
+                ops_per_sec += static_cast<double>(tr.total_ops) / tr.seconds / opts.config.runs;
+            }
+            throughput[key][threads] = ops_per_sec;
+            BenchResult r;
+            r.labels = {{"benchmark", "threads"}, {"variant", variant.name}, {"sharing", variant.sharing},
+                        {"threads", to_string(threads)}, {"pinned", pinned ? "yes" : "no"}};
+            summarize_samples(r, samples); // Aggregate ns per op across all threads.
+            double base = throughput[key].count(1) ? throughput[key][1] : 0;
+            r.metrics = {{"ops_per_sec", ops_per_sec},
+                         {"ops_per_sec_per_thread", ops_per_sec / threads}};
+            if (base > 0) r.metrics.push_back({"scaling_efficiency", ops_per_sec / (threads * base)});
+            record(results, move(r));
+        }
+    }
+
+    // Verdicts: padded vs packed counters expose false sharing; per-thread vs
+    // shared state exposes contention. Below 80% of the isolated variant is flagged.
+    auto compare = [&](const string& isolated, const string& shared, const char* problem) {
+        if (!throughput.count(isolated) || !throughput.count(shared)) return;
+        for (const auto& entry : throughput[shared]) {
+            unsigned threads = entry.first;
+            if (threads < 2 || !throughput[isolated].count(threads)) continue;
+            double ratio = entry.second / throughput[isolated][threads];
+            if (ratio < 0.8) {
+                cout << problem << ": " << shared << " reaches " << setprecision(0) << ratio * 100
+                     << "% of " << isolated << " on " << threads << " threads" << endl;
+            }
+        }
+    };
+    compare("counter/padded", "counter/packed", "False sharing detected");
+    compare("compiled/per_thread", "compiled/shared", "Contention on shared state");
+    compare("timed_profile/per_thread", "timed_profile/shared", "Contention on shared state");
+}
+
+// --- Rule engines ---
+// The same synthetic rule file (see bench_rules.hpp) evaluated by every
+// engine: CompiledSwitch built by compile_rules(), the bytecode VM, a binary
+// image indexed on the key field, the x86-64 JIT (where available), a
+// TieredSwitch promoted before timing, and PlannedSwitch, whose row is
+// labelled planned:<strategy> with the strategy the planner picked.
+static void run_rules_suite(const Options& opts, vector<BenchResult>& results) {
+    RuleSchema<BenchRecord> schema = bench_rule_schema();
+    RuleActions<BenchRecord> actions;
+    static thread_local int sink = 0;
+    for (const char* name : {"act0", "act1", "act2", "act3", "none"}) {
+        actions.bind(name, [name](const BenchRecord&) { sink += name[3]; });
+    }
+
+    for (int rule_count : {16, 256, 4096}) {
+        RuleSet rules = parse_rules(bench_rule_text(rule_count, opts.config.seed));
+        vector<BenchRecord> values = bench_rule_values(rule_count, opts.config.seed);
+        const size_t mask = values.size() - 1;
+
+        CompiledSwitch<BenchRecord> compiled = compile_rules(rules, schema, actions);
+        BytecodeSwitch<BenchRecord> bytecode(compile_bytecode(rules, schema), schema, actions);
+        JitSwitch<BenchRecord> jit(compile_bytecode(rules, schema), schema, actions);
+        // Promoted up front: a switch changing tier during the runs would
+        // mix interpreter and native timings in one result.
+        TieredSwitch<BenchRecord> tiered(rules, schema, actions);
+        tiered.promote();
+        tiered.wait();
+        PlannedSwitch<BenchRecord> planned(rules, schema, actions, "key");
+        vector<unsigned char> image_bytes = build_switch_image(rules, "key");
+        SwitchImage image = SwitchImage::from_memory(image_bytes.data(), image_bytes.size());
+        ImageSwitch<BenchRecord> mapped(image, schema, actions);
+
+        auto bench = [&](const string& engine, auto&& evaluate) {
+            string name = "rules/" + engine + "/" + to_string(rule_count);
+            if (!opts.filter.empty() && name.find(opts.filter) == string::npos) return;
+            record(results, run_benchmark(opts.config,
+                {{"benchmark", "rules"}, {"engine", engine}, {"rules", to_string(rule_count)}},
+                [&](long long ops) {
+                    for (long long i = 0; i < ops; ++i) evaluate(values[static_cast<size_t>(i) & mask]);
+                    do_not_optimize(sink);
+                }));
+        };
+        bench("compiled", [&](const BenchRecord& v) { compiled.evaluate(v); });
+        bench("bytecode", [&](const BenchRecord& v) { bytecode.evaluate(v); });
+        bench("image", [&](const BenchRecord& v) { mapped.evaluate(v); });
+        if (jit.jitted()) bench("jit", [&](const BenchRecord& v) { jit.evaluate(v); });
+        bench(tiered.tier() == TieredSwitch<BenchRecord>::Tier::Optimized ? "tiered:optimized" : "tiered:interpreted",
+              [&](const BenchRecord& v) { tiered.evaluate(v); });
+        bench(string("planned:") + strategy_name(planned.plan().strategy), [&](const BenchRecord& v) { planned.evaluate(v); });
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage();
+        return 1;
+    }
+
+    PerfCounters probe;
+    cout << "Hardware counters: " << (opts.config.perf_counters && probe.any_available() ? "on" : "off")
+         << ", runs: " << opts.config.runs << ", warmup: " << opts.config.warmup_runs
+         << ", seed: " << opts.config.seed << endl;
+
+    vector<BenchResult> results;
+    if (opts.mode == "dispatch" || opts.mode == "all") run_dispatch_suite(opts, results);
+    if (opts.mode == "construction" || opts.mode == "all") run_construction_suite(opts, results);
+    if (opts.mode == "latency" || opts.mode == "all") run_latency_suite(opts, results);
+    if (opts.mode == "coldstart" || opts.mode == "all") run_coldstart_suite(opts, results);
+    if (opts.mode == "threads" || opts.mode == "all") run_threads_suite(opts, results);
+    if (opts.mode == "rules" || opts.mode == "all") run_rules_suite(opts, results);
+
+    if (!opts.json_path.empty()) {
+        ofstream out(opts.json_path);
+        if (!out) {
+            cerr << "Cannot write " << opts.json_path << endl;
+            return 1;
+        }
+        write_json(out, results);
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+#ifndef COMPILED_SWITCH_HPP
+#define COMPILED_SWITCH_HPP
+
+// A switch that is built once and then evaluated on many values.
+// Unlike Switch, it does not own a value: evaluate(const T&) is const, so one
+// CompiledSwitch can be shared by any number of threads without locks.
+// Usage:
+//   CompiledSwitch<int> sw;
+//   sw.add_case([](const int& v) { return v < 0; }, [](const int&) { ... });
+//   sw.add_default([](const int&) { ... });
+//   sw.evaluate(42); // from any thread
+//
+// Cases given as SwitchMatch::equals/one_of/between are indexed (hash table
+// for equality, interval map for ranges of integral types), and cases can be
+// inserted or removed at a priority without rebuilding the rest.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "custom_switch.hpp"
+#include "switch_match.hpp"
+
+namespace compiled_switch_detail {
+
+template <typename T, typename = void>
+struct is_hashable : std::false_type {};
+
+template <typename T>
+struct is_hashable<T, std::void_t<decltype(std::hash<T>{}(std::declval<const T&>()))>> : std::true_type {};
+
+// Hash table from value to ranks; an empty stand-in for types without std::hash.
+template <typename T, typename Ranks, bool = is_hashable<T>::value>
+struct EqualIndex {
+    using type = std::unordered_map<T, Ranks>;
+};
+
+template <typename T, typename Ranks>
+struct EqualIndex<T, Ranks, false> {
+    using type = std::map<int, Ranks>;
+};
+
+} // namespace compiled_switch_detail
+
+template <typename T>
+class CompiledSwitch {
+public:
+    using Predicate = std::function<bool(const T&)>;
+    using Action = std::function<void(const T&)>; // Receives the evaluated value.
+    using Match = SwitchMatch<T>;
+    using CaseId = std::size_t; // Stable for the lifetime of the case.
+
+    static constexpr CaseId npos = static_cast<CaseId>(-1);
+
+    // --- Building ---
+    // Not synchronized: finish building before the switch is shared, or
+    // publish modified copies through a SwitchHandle.
+
+    // Appends a case at priority 0; cases of equal priority are tried in the
+    // order they were added.
+    CompiledSwitch& add_case(Match match, Action action) {
+        insert_case(0, std::move(match), std::move(action));
+        return *this;
+    }
+
+    // Sets the action executed when no case matches.
+    CompiledSwitch& add_default(Action action) {
+        default_action_ = std::move(action);
+        return *this;
+    }
+
+    // Inserts a case that is tried before every case with a higher priority
+    // value and after every existing case with the same or a lower one.
+    // O(log n), plus for ranges the number of existing range boundaries the
+    // new range spans (none for disjoint ranges).
+    CaseId insert_case(int priority, Match match, Action action) {
+        CaseId id;
+        if (!free_ids_.empty()) {
+            id = free_ids_.back();
+            free_ids_.pop_back();
+        } else {
+            id = entries_.size();
+            entries_.emplace_back();
+        }
+        Entry& e = entries_[id];
+        e.rank = Rank{priority, next_seq_++, id};
+        e.match = std::move(match);
+        e.action = std::move(action);
+        e.live = true;
+        index(e, true);
+        ++size_;
+        return id;
+    }
+
+    // Removes a case; returns false if `id` is not a live case. Same cost as
+    // insert_case.
+    bool remove_case(CaseId id) {
+        if (id >= entries_.size() || !entries_[id].live) return false;
+        Entry& e = entries_[id];
+        index(e, false);
+        e.live = false;
+        e.match = Match([](const T&) { return false; });
+        e.action = nullptr;
+        free_ids_.push_back(id);
+        --size_;
+        return true;
+    }
+
+    // --- Evaluation ---
+    // const and free of shared mutable state: safe to call concurrently from
+    // any number of threads, as long as the predicates and actions are.
+
+    // Returns the id of the first case (by priority, then insertion order)
+    // whose condition matches `value`, or npos. No action is run. Cases added
+    // only with add_case get ids 0, 1, 2, ... in order.
+    CaseId find(const T& value) const {
+        const Rank* best = nullptr;
+        if constexpr (kHashable) {
+            if (!equal_index_.empty()) {
+                auto it = equal_index_.find(value);
+                if (it != equal_index_.end()) best = &*it->second.begin();
+            }
+        }
+        if constexpr (kRanged) {
+            if (!range_index_.empty()) {
+                auto it = range_index_.upper_bound(value);
+                if (it != range_index_.begin() && !(--it)->second.empty()) {
+                    const Rank* r = &*it->second.begin();
+                    if (!best || *r < *best) best = r;
+                }
+            }
+        }
+        // Opaque conditions have to be called, but only those ranked before
+        // the best indexed match.
+        for (const Rank& r : opaque_) {
+            if (best && !(r < *best)) break;
+            if (entries_[r.id].match(value)) return r.id;
+        }
+        return best ? best->id : npos;
+    }
+
+    // Runs the action of the first matching case, or the default action if
+    // none matches. Returns true if a case (not the default) matched.
+    bool evaluate(const T& value) const {
+        CaseId id = find(value);
+        if (id != npos) {
+            entries_[id].action(value);
+            return true;
+        }
+        if (default_action_) (*default_action_)(value);
+        return false;
+    }
+
+    std::size_t size() const { return size_; }
+    bool has_default() const { return default_action_.has_value(); }
+
+    // Which cases are indexed and which are scanned, index sizes and the
+    // estimated cost of evaluate() (defined in switch_explain.hpp).
+    SwitchExplanation explain() const;
+
+private:
+    static constexpr bool kHashable = compiled_switch_detail::is_hashable<T>::value;
+    // Inclusive ranges [lo, hi] are stored as half-open segments, which needs
+    // hi + 1; only integral types have it.
+    static constexpr bool kRanged = std::is_integral_v<T>;
+
+    // Position of a case in first-match order.
+    struct Rank {
+        int priority;
+        std::uint64_t seq;
+        CaseId id;
+        bool operator<(const Rank& o) const {
+            return priority != o.priority ? priority < o.priority : seq < o.seq;
+        }
+        bool operator==(const Rank& o) const { return seq == o.seq; }
+    };
+
+    struct Entry {
+        Rank rank{};
+        Match match = Match([](const T&) { return false; });
+        Action action;
+        bool live = false;
+    };
+
+    // Adds (`add` = true) or removes the case in whichever index its condition
+    // belongs to.
+    void index(const Entry& e, bool add) {
+        using Kind = typename Match::Kind;
+        Kind kind = e.match.kind();
+        if constexpr (kHashable) {
+            if (kind == Kind::Equals || kind == Kind::OneOf) {
+                for (const T& v : e.match.values()) {
+                    if (add) {
+                        equal_index_[v].insert(e.rank);
+                    } else {
+                        auto it = equal_index_.find(v);
+                        if (it == equal_index_.end()) continue; // Duplicate in one_of.
+                        it->second.erase(e.rank);
+                        if (it->second.empty()) equal_index_.erase(it);
+                    }
+                }
+                return;
+            }
+        }
+        if constexpr (kRanged) {
+            if (kind == Kind::Between) {
+                if (!(e.match.high() < e.match.low())) update_range(e.match.low(), e.match.high(), e.rank, add);
+                return;
+            }
+        }
+        if (add) {
+            opaque_.insert(e.rank);
+        } else {
+            opaque_.erase(e.rank);
+        }
+    }
+
+    // range_index_ maps the start of each segment to the ranks of the ranges
+    // covering it; a segment ends where the next one starts. Values below the
+    // first key are covered by nothing.
+    using Segments = std::map<T, std::set<Rank>>;
+
+    // Makes `at` a segment start and returns its segment.
+    typename Segments::iterator split(const T& at) {
+        auto it = range_index_.upper_bound(at);
+        if (it != range_index_.begin()) {
+            auto prev = std::prev(it);
+            if (prev->first == at) return prev;
+            return range_index_.emplace_hint(it, at, prev->second);
+        }
+        return range_index_.emplace_hint(it, at, std::set<Rank>{});
+    }
+
+    // Drops the segment start `it` if it covers the same ranks as the segment
+    // before it (or nothing, at the front).
+    void coalesce(typename Segments::iterator it) {
+        if (it == range_index_.end()) return;
+        if (it == range_index_.begin() ? it->second.empty() : std::prev(it)->second == it->second) {
+            range_index_.erase(it);
+        }
+    }
+
+    void update_range(const T& lo, const T& hi, const Rank& rank, bool add) {
+        bool to_end = hi == std::numeric_limits<T>::max();
+        auto last = to_end ? range_index_.end() : split(static_cast<T>(hi + 1));
+        auto first = split(lo);
+        for (auto it = first; it != last; ++it) {
+            if (add) {
+                it->second.insert(rank);
+            } else {
+                it->second.erase(rank);
+            }
+        }
+        if (!add) {
+            if (!to_end) coalesce(range_index_.find(static_cast<T>(hi + 1)));
+            coalesce(range_index_.find(lo));
+        }
+    }
+
+    std::vector<Entry> entries_; // Indexed by CaseId; dead slots are reused.
+    std::vector<CaseId> free_ids_;
+    std::uint64_t next_seq_ = 0;
+    std::size_t size_ = 0;
+    std::set<Rank> opaque_;
+    typename compiled_switch_detail::EqualIndex<T, std::set<Rank>>::type equal_index_;
+    Segments range_index_;
+    std::optional<Action> default_action_;
+};
+
+// Defined here rather than in custom_switch.hpp so that plain SWITCH users do
+// not pay for this header. Actions of a Switch take no arguments; they are
+// wrapped to ignore the value passed by CompiledSwitch.
+template <typename T, typename Timing>
+CompiledSwitch<T> Switch<T, Timing>::compile() const {
+    if (!state_.empty()) throw std::logic_error("Switch::compile(): cases use SWITCH_KEY keys or bindings tied to this Switch");
+    CompiledSwitch<T> compiled;
+    for (const auto& c : cases_) {
+        compiled.add_case(c.predicate(), [action = c.action()](const T&) { action(); });
+    }
+    if (default_action_) {
+        compiled.add_default([action = *default_action_](const T&) { action(); });
+    }
+    return compiled;
+}
+
+#endif // COMPILED_SWITCH_HPP
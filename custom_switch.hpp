@@ -2,9 +2,24 @@
 #define CUSTOM_SWITCH_HPP
 
 #include <functional>
+#include <memory>
 #include <vector>
 #include <optional>   // requires C++ 17
 #include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+// Hint the CPU to pull the cache line at `addr` into the cache (no-op elsewhere).
+#if defined(__GNUC__)
+#define SWITCH_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define SWITCH_PREFETCH(addr) ((void)(addr))
+#endif
+
+template <typename T> class CompiledSwitch; // compiled_switch.hpp
+struct SwitchExplanation;                   // switch_explain.hpp
 
 // Represents a single 'case' branch within the custom switch.
 // Holds a `predicate` (condition) and an action to execute if the predicate is true.
@@ -18,7 +33,7 @@ public:
     // Evaluates the predicate against the given value.
     // If the predicate returns true, executes the action and returns true.
     // Else, returns false.
-    bool evaluate(const T& value) {
+    bool evaluate(const T& value) const {
         if (predicate_(value)) {
             action_();
             return true;
@@ -26,18 +41,84 @@ public:
         return false;
     }
 
+    // Evaluates only the predicate, without running the action.
+    bool matches(const T& value) const { return predicate_(value); }
+
+    // Runs only the action.
+    void run() const { action_(); }
+
+    const std::function<bool(const T&)>& predicate() const { return predicate_; }
+    const std::function<void()>& action() const { return action_; }
+
 private:
     std::function<bool(const T&)> predicate_; // The condition function (lambda).
     std::function<void()> action_;             // The action function (lambda).
 };
 
+// A value derived from the switched value (see SWITCH_KEY). It is computed
+// the first time it is read during an evaluation and reused by every later
+// predicate and action of that evaluation.
+template <typename T, typename F>
+class SwitchKey {
+public:
+    using result_type = std::decay_t<std::invoke_result_t<F&, const T&>>;
+
+    SwitchKey(const T& value, const std::uint64_t& evaluation, F compute)
+        : value_(&value), evaluation_(&evaluation), compute_(std::move(compute)) {}
+
+    const result_type& operator()() const {
+        if (!cached_ || seen_ != *evaluation_) {
+            cached_.emplace(compute_(*value_));
+            seen_ = *evaluation_;
+        }
+        return *cached_;
+    }
+
+private:
+    const T* value_;
+    const std::uint64_t* evaluation_; // Switch's evaluation counter.
+    F compute_;
+    mutable std::optional<result_type> cached_;
+    mutable std::uint64_t seen_ = 0;
+};
+
+// std::nullopt for npos, else the position, so that a find() result can be
+// bound: CASE_BIND(pos, switch_found(val.find(name))).
+inline std::optional<std::size_t> switch_found(std::size_t pos) {
+    if (pos == static_cast<std::size_t>(-1)) return std::nullopt;
+    return pos;
+}
+
+// Default timing policy for Switch: measures nothing and compiles away.
+// A timing policy (see CycleTiming in switch_timing.hpp) provides `enabled`,
+// sample() to decide whether the current evaluation is measured, and the
+// record_* hooks that Switch::evaluate() calls with cycle counts.
+struct NoTiming {
+    static constexpr bool enabled = false;
+
+    bool sample() { return false; }
+    static std::uint64_t now_begin() { return 0; }
+    static std::uint64_t now_end() { return 0; }
+    void record_predicate(std::size_t, std::uint64_t) {}
+    void record_action(std::size_t, std::uint64_t) {}
+    void record_default(std::uint64_t) {}
+};
+
 // Represents the main 'switch' construct.
 // Holds the value being switched on and manages a collection of Case objects.
-template <typename T>
+// `Timing` is the timing policy; the default NoTiming adds no overhead.
+template <typename T, typename Timing = NoTiming>
 class Switch {
 public:
     // Constructor: Takes the value to be switched on (moved or copied).
-    Switch(T value) : value_(std::move(value)) {} // Use std::move
+    Switch(T value, Timing timing = Timing())
+        : value_(std::move(value)), timing_(std::move(timing)) {} // Use std::move
+
+    // Not copyable or movable: keys from derive() and the cases they are
+    // used in point at this object's value and evaluation counter, so a copy
+    // would read the original (or a destroyed) Switch.
+    Switch(const Switch&) = delete;
+    Switch& operator=(const Switch&) = delete;
 
     // Adds a case branch to this switch instance.
     Switch& add_case(std::function<bool(const T&)> predicate, std::function<void()> action) {
@@ -54,6 +135,13 @@ public:
     // Iterates through all added cases, executes the action of the first matching case,
     // and then stops (mimicking 'break'). If no cases match, executes the default action, if set.
     void evaluate() {
+        ++evaluation_; // Invalidates SWITCH_KEY values of the previous evaluation.
+        if constexpr (Timing::enabled) {
+            if (timing_.sample()) {
+                evaluate_timed();
+                return;
+            }
+        }
         bool executed = false;
         for (auto& c : cases_) {
             if (c.evaluate(value_)) {
@@ -66,10 +154,98 @@ public:
         }
     }
 
+    // Copies the cases and the default action into a CompiledSwitch (defined in
+    // compiled_switch.hpp), which evaluates any value and can be shared between
+    // threads. Cases created with CASE capture locals by reference ([&]), so
+    // the result must not outlive the SWITCH block that built it.
+    // Throws std::logic_error if cases use SWITCH_KEY keys or bindings: keys
+    // read this Switch's value, not the value passed to
+    // CompiledSwitch::evaluate(), and a binding is state shared between a
+    // predicate and its action, which concurrent evaluations would race on.
+    CompiledSwitch<T> compile() const;
+
+    // Returns a key computing `compute(value)` at most once per evaluate().
+    // The key is owned by this Switch, so SWITCH_KEY can declare it inside
+    // the block whose cases are evaluated after the block has closed.
+    template <typename F>
+    SwitchKey<T, F>& derive(F compute) {
+        auto key = std::make_shared<SwitchKey<T, F>>(value_, evaluation_, std::move(compute));
+        SwitchKey<T, F>& ref = *key;
+        state_.push_back(std::move(key));
+        return ref;
+    }
+
+    // Adds a case whose `match` returns a binding: a std::optional (or
+    // anything testable as bool and dereferenceable, such as a pointer). The
+    // case matches if the binding is engaged, and `action` receives the bound
+    // value, so the work done to decide the match is not repeated.
+    template <typename Match, typename Action>
+    Switch& add_bound_case(Match match, Action action) {
+        using Binding = std::decay_t<std::invoke_result_t<Match&, const T&>>;
+        auto slot = std::make_shared<std::optional<Binding>>();
+        state_.push_back(slot);
+        return add_case(
+            [slot, match = std::move(match)](const T& value) {
+                slot->emplace(match(value));
+                return static_cast<bool>(**slot);
+            },
+            [slot, action = std::move(action)]() { action(***slot); });
+    }
+
+    // Describes how evaluate() works on the current cases: always a linear
+    // scan of predicates (defined in switch_explain.hpp).
+    SwitchExplanation explain() const;
+
+    // Pulls the case table, the value and the default action into the cache
+    // ahead of evaluate(), without running any predicate or action.
+    void prefetch() const {
+        const char* p = reinterpret_cast<const char*>(cases_.data());
+        const char* end = p + cases_.size() * sizeof(Case<T>);
+        for (; p < end; p += 64) SWITCH_PREFETCH(p);
+        SWITCH_PREFETCH(&value_);
+        SWITCH_PREFETCH(&default_action_);
+    }
+
+    // Prefetches, then runs every predicate once on the value and discards the
+    // result, so predicate code, its data and its branches are warm before a
+    // latency-critical evaluate(). Actions are not run; predicates must be
+    // free of side effects.
+    void warm() const {
+        prefetch();
+        for (const auto& c : cases_) {
+            bool matched = c.matches(value_);
+            (void)matched;
+        }
+    }
+
 private:
+    // Same first-match logic as evaluate(), but reports the cycles spent in
+    // every predicate and in the executed action to the timing policy.
+    void evaluate_timed() {
+        for (std::size_t i = 0; i < cases_.size(); ++i) {
+            std::uint64_t start = Timing::now_begin();
+            bool matched = cases_[i].matches(value_);
+            timing_.record_predicate(i, Timing::now_end() - start);
+            if (matched) {
+                start = Timing::now_begin();
+                cases_[i].run();
+                timing_.record_action(i, Timing::now_end() - start);
+                return;
+            }
+        }
+        if (default_action_) {
+            std::uint64_t start = Timing::now_begin();
+            (*default_action_)();
+            timing_.record_default(Timing::now_end() - start);
+        }
+    }
+
     T value_; // The value being switched on.
     std::vector<Case<T>> cases_; // Stores all the defined case branches.
     std::optional<std::function<void()>> default_action_; // Stores the optional default action.
+    Timing timing_; // Timing policy (NoTiming unless instrumented).
+    std::uint64_t evaluation_ = 0; // Number of evaluate() calls; versions SWITCH_KEY values.
+    std::vector<std::shared_ptr<void>> state_; // Keys from derive(), bindings of add_bound_case().
 };
 
 // --- Helper Macros for unique variable name generation ---
@@ -91,6 +267,14 @@ private:
         ; /* Semicolon to terminate declarations */ \
         /* User code block {...} follows here */
 
+// Declares a value derived from 'val' once per switch, e.g. a length, a
+// search result or a parsed field. Read it as 'name()' in any following
+// CASE condition or action: it is computed on first use and then reused for
+// the rest of the evaluation.
+// Usage: SWITCH_KEY(len, val.size()) CASE(len() > 10) ... BREAK
+#define SWITCH_KEY(name, expr) \
+    auto& name = _sw_obj_.derive([&](const _sw_value_type_& val) { return (expr); });
+
 // Defines a case branch within the SWITCH block.
 // 'condition' is a boolean expression, typically using 'val' which represents the switched value.
 // Must be followed by the action code block and terminated by BREAK.
@@ -98,11 +282,37 @@ private:
 #define CASE(condition) \
     _sw_obj_.add_case( \
         /* Predicate lambda: evaluates the condition. 'val' is the parameter name. */ \
-        [&](const _sw_value_type_& val) -> bool { return (condition); }, \
+        [&]([[maybe_unused]] const _sw_value_type_& val) -> bool { return (condition); }, \
         /* Action lambda: contains the user's code for this case. Captures by reference. */ \
         [&]() -> void { \
             /* User's action code starts here... */
 
+// Defines a case that binds the result of its match. 'expr' uses 'val' and
+// yields a std::optional (or a pointer); the case matches if it is engaged,
+// and the action reads the bound value as 'binding'. Terminated by BREAK.
+// Usage: CASE_BIND(n, parse_int(val)) total += n; BREAK
+#define CASE_BIND(binding, expr) \
+    _sw_obj_.add_bound_case( \
+        [&]([[maybe_unused]] const _sw_value_type_& val) { return (expr); }, \
+        [&]([[maybe_unused]] auto& binding) -> void { \
+            /* User's action code starts here... */
+
+// Same as CASE_BIND, with a guard: the case matches only if the binding is
+// engaged and 'guard' (which can use 'binding') holds.
+// Usage: CASE_BIND_WHEN(n, parse_int(val), n > 0) ... BREAK
+#define CASE_BIND_WHEN(binding, expr, guard) \
+    _sw_obj_.add_bound_case( \
+        [&]([[maybe_unused]] const _sw_value_type_& val) { \
+            auto _sw_bound_ = (expr); \
+            if (_sw_bound_) { \
+                auto& binding = *_sw_bound_; \
+                if (!(guard)) _sw_bound_ = decltype(_sw_bound_){}; \
+            } \
+            return _sw_bound_; \
+        }, \
+        [&]([[maybe_unused]] auto& binding) -> void { \
+            /* User's action code starts here... */
+
 // Terminates a CASE block definition. Must follow the action code inside a CASE.
 #define BREAK \
         } /* End of action lambda */ \
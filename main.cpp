@@ -93,6 +93,50 @@ int main() {
         // No DEFAULT case is provided here
      } END_SWITCH // Evaluation happens; if no case matches, nothing executes
 
+    cout << "---" << endl;
+
+    // --- Example 4: Sharing a derived key between cases ---
+    string greeting = "Well, hello Gerard";
+    cout << "Testing string value = \"" << greeting << "\" with SWITCH_KEY" << endl;
+
+    SWITCH(greeting) {
+        // Computed once, on first use, and shared by every case and action
+        SWITCH_KEY(pos, val.find(name))
+
+        CASE(pos() == 0)
+            cout << "Starts with the name" << endl;
+        BREAK
+
+        CASE(pos() != string::npos)
+            cout << "Found the name at position " << pos() << endl; // No second find()
+        BREAK
+
+        DEFAULT
+            cout << "No name" << endl;
+        END_DEFAULT
+    } END_SWITCH
+
+    cout << "---" << endl;
+
+    // --- Example 5: Binding the match result in the action ---
+    string sentence = "Gerard says hi";
+    cout << "Testing string value = \"" << sentence << "\" with CASE_BIND" << endl;
+
+    SWITCH(sentence) {
+        CASE_BIND_WHEN(pos, switch_found(val.find(name)), pos == 0)
+            cout << "Starts with the name" << endl;
+        BREAK
+
+        // pos is the size_t found by the condition, not an optional
+        CASE_BIND(pos, switch_found(val.find(name)))
+            cout << "Found the name at position " << pos << endl;
+        BREAK
+
+        DEFAULT
+            cout << "No name" << endl;
+        END_DEFAULT
+    } END_SWITCH
+
 
     return 0;
 }
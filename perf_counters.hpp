@@ -0,0 +1,173 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+// Hardware performance counters for the switch benchmarks (Linux perf_event_open).
+// Usage:
+//   PerfCounters counters;
+//   counters.start();
+//   /* measured loop */
+//   counters.stop();
+//   counters.report(std::cout, iterations); // per-evaluation values
+// Counters the kernel refuses (containers, VMs, perf_event_paranoid, non-Linux)
+// are reported as "n/a" instead of failing the benchmark.
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define SWITCH_HAS_PERF_EVENTS 1
+#else
+#define SWITCH_HAS_PERF_EVENTS 0
+#endif
+
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, BranchMisses, L1iMisses, ITlbMisses, EventCount };
+
+    PerfCounters() {
+        for (int i = 0; i < EventCount; ++i) {
+            fds_[i] = open_event(static_cast<Event>(i));
+            values_[i] = 0;
+        }
+    }
+
+    ~PerfCounters() {
+#if SWITCH_HAS_PERF_EVENTS
+        for (int fd : fds_) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // True if at least one counter could be opened.
+    bool any_available() const {
+        for (int fd : fds_) {
+            if (fd >= 0) return true;
+        }
+        return false;
+    }
+
+    bool available(Event e) const { return fds_[e] >= 0; }
+
+    // Resets and enables all open counters.
+    void start() {
+#if SWITCH_HAS_PERF_EVENTS
+        for (int fd : fds_) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Disables all open counters and reads their values.
+    // Values are scaled up when the kernel multiplexed the counter.
+    void stop() {
+#if SWITCH_HAS_PERF_EVENTS
+        for (int i = 0; i < EventCount; ++i) {
+            if (fds_[i] < 0) continue;
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            std::uint64_t data[3] = {0, 0, 0}; // value, time enabled, time running
+            if (read(fds_[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) {
+                values_[i] = 0;
+                continue;
+            }
+            values_[i] = (data[2] != 0 && data[2] < data[1])
+                ? static_cast<std::uint64_t>(static_cast<double>(data[0]) * data[1] / data[2])
+                : data[0];
+        }
+#endif
+    }
+
+    // Raw value of `e` from the last start()/stop() pair.
+    std::uint64_t value(Event e) const { return values_[e]; }
+
+    static const char* name(Event e) {
+        static const char* const names[EventCount] = {
+            "cycles", "instructions", "branch-misses", "L1i-misses", "iTLB-misses"};
+        return names[e];
+    }
+
+    // Writes every counter divided by `evaluations`, plus IPC when possible.
+    void report(std::ostream& out, long long evaluations) const {
+        if (!any_available()) {
+            out << "  perf counters: unavailable" << std::endl;
+            return;
+        }
+        out << "  per evaluation:";
+        for (int i = 0; i < EventCount; ++i) {
+            out << ' ' << name(static_cast<Event>(i)) << '=';
+            if (fds_[i] < 0) {
+                out << "n/a";
+            } else {
+                out << static_cast<double>(values_[i]) / static_cast<double>(evaluations);
+            }
+        }
+        if (fds_[Cycles] >= 0 && fds_[Instructions] >= 0 && values_[Cycles] != 0) {
+            out << " IPC=" << static_cast<double>(values_[Instructions]) / static_cast<double>(values_[Cycles]);
+        }
+        out << std::endl;
+    }
+
+private:
+    // Opens one counter for the calling thread (user space only).
+    // Returns -1 if the counter is not supported or not permitted.
+    static int open_event(Event e) {
+#if SWITCH_HAS_PERF_EVENTS
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        switch (e) {
+            case Cycles:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case Instructions:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case BranchMisses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case L1iMisses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1I
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            case ITlbMisses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_ITLB
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            default:
+                return -1;
+        }
+        long fd = syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1 /* any cpu */, -1, 0);
+        return fd < 0 ? -1 : static_cast<int>(fd);
+#else
+        (void)e;
+        return -1;
+#endif
+    }
+
+    int fds_[EventCount];
+    std::uint64_t values_[EventCount];
+};
+
+#endif // PERF_COUNTERS_HPP
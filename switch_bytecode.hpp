@@ -0,0 +1,474 @@
+#ifndef SWITCH_BYTECODE_HPP
+#define SWITCH_BYTECODE_HPP
+
+// Bytecode compilation of rule sets (see switch_rules.hpp).
+// A RuleSet compiles into one register-based program: each rule is a run of
+// test instructions that fall through on success and jump to the next rule
+// on failure, followed by a Match. Fields tested by several rules are loaded
+// into registers once at entry; a field tested once is loaded and tested by a
+// single fused superinstruction. The interpreter uses computed-goto threaded
+// dispatch where the compiler supports it (GCC, Clang) and a switch loop
+// elsewhere.
+// Usage:
+//   SwitchProgram program = compile_bytecode(parse_rule_file("rules.txt"), schema);
+//   BytecodeSwitch<Order> sw(std::move(program), schema, actions);
+//   sw.evaluate(order);
+//   sw.program().disassemble(std::cout);
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "switch_rules.hpp"
+
+// Define SWITCH_VM_THREADED=0 to force the portable switch loop.
+#ifndef SWITCH_VM_THREADED
+#if defined(__GNUC__) || defined(__clang__)
+#define SWITCH_VM_THREADED 1
+#else
+#define SWITCH_VM_THREADED 0
+#endif
+#endif
+
+// X-macro of all opcodes; the order is the encoding.
+// Register tests (reg = register) and fused field tests (field = slot) jump
+// to `target` when the test fails. Int tests compare with `a` (and `b` for
+// ranges); In tests search ints/strings[a, a + b). String tests use
+// strings[a] (and strings[b] for ranges).
+#define SWITCH_VM_OPCODES(X) \
+    X(LoadInt) X(LoadStr) \
+    X(IntEq) X(IntNe) X(IntLt) X(IntLe) X(IntGt) X(IntGe) X(IntRange) X(IntIn) \
+    X(StrEq) X(StrNe) X(StrLt) X(StrLe) X(StrGt) X(StrGe) X(StrRange) X(StrIn) X(StrPrefix) X(StrContains) \
+    X(FieldEq) X(FieldNe) X(FieldLt) X(FieldLe) X(FieldGt) X(FieldGe) X(FieldRange) X(FieldIn) \
+    X(FieldStrEq) X(FieldStrPrefix) X(FieldStrContains) \
+    X(Match) X(Halt)
+
+namespace switch_vm {
+
+enum class Op : std::uint8_t {
+#define SWITCH_VM_ENUM(name) name,
+    SWITCH_VM_OPCODES(SWITCH_VM_ENUM)
+#undef SWITCH_VM_ENUM
+};
+
+inline const char* op_name(Op op) {
+    static const char* const names[] = {
+#define SWITCH_VM_NAME(name) #name,
+        SWITCH_VM_OPCODES(SWITCH_VM_NAME)
+#undef SWITCH_VM_NAME
+    };
+    return names[static_cast<std::size_t>(op)];
+}
+
+// 24 bytes; a typical condition is one instruction.
+struct Instr {
+    Op op;
+    std::uint8_t reg;      // Register operand (Load*: destination).
+    std::uint16_t field;   // Field slot (Load*, Field*).
+    std::uint32_t target;  // Jump target on failure; Match: rule index.
+    std::int64_t a;
+    std::int64_t b;
+};
+
+constexpr std::uint32_t kNone = 0xFFFFFFFFu;
+constexpr std::size_t kRegisters = 16; // Per type (int and string).
+
+} // namespace switch_vm
+
+// A compiled rule program plus the names it refers to. Independent of the
+// value type; bind it with BytecodeSwitch.
+struct SwitchProgram {
+    std::vector<switch_vm::Instr> code;
+    std::vector<std::int64_t> ints;     // In operands, sorted per set.
+    std::vector<std::string> strings;   // String operands; In sets sorted.
+    std::vector<std::string> fields;    // Field slot names.
+    std::vector<bool> field_is_string;
+    std::vector<std::string> actions;   // Action slot names.
+    std::vector<std::uint32_t> rule_actions; // Action slot of each rule (file order).
+    std::vector<std::string> rule_names;
+    std::uint32_t default_action = switch_vm::kNone;
+
+    // One instruction per line: pc, opcode, operands.
+    void disassemble(std::ostream& out) const {
+        for (std::size_t pc = 0; pc < code.size(); ++pc) {
+            out << pc << '\t';
+            disassemble(out, pc);
+            out << '\n';
+        }
+    }
+
+    // The opcode and operands of the instruction at `pc`.
+    void disassemble(std::ostream& out, std::size_t pc) const {
+        using switch_vm::Op;
+        const switch_vm::Instr& in = code[pc];
+        out << switch_vm::op_name(in.op);
+        switch (in.op) {
+            case Op::LoadInt: out << " i" << int(in.reg) << ", " << fields[in.field]; break;
+            case Op::LoadStr: out << " s" << int(in.reg) << ", " << fields[in.field]; break;
+            case Op::Match: out << ' ' << rule_names[in.target]; break;
+            case Op::Halt: break;
+            default: {
+                bool fused = in.op >= Op::FieldEq;
+                bool is_string = (in.op >= Op::StrEq && in.op <= Op::StrContains) || in.op >= Op::FieldStrEq;
+                out << ' ' << (fused ? fields[in.field] : (is_string ? "s" : "i") + std::to_string(in.reg));
+                if (in.op == Op::IntIn || in.op == Op::FieldIn || in.op == Op::StrIn) {
+                    out << ", {";
+                    for (std::int64_t i = 0; i < in.b; ++i) {
+                        if (i) out << ", ";
+                        if (is_string) out << '"' << strings[static_cast<std::size_t>(in.a + i)] << '"';
+                        else out << ints[static_cast<std::size_t>(in.a + i)];
+                    }
+                    out << '}';
+                } else if (is_string) {
+                    out << ", \"" << strings[static_cast<std::size_t>(in.a)] << '"';
+                    if (in.op == Op::StrRange) out << "..\"" << strings[static_cast<std::size_t>(in.b)] << '"';
+                } else {
+                    out << ", " << in.a;
+                    if (in.op == Op::IntRange || in.op == Op::FieldRange) out << ".." << in.b;
+                }
+                out << " else " << in.target;
+            }
+        }
+    }
+};
+
+// Compiles `rules` against the field types of `schema`. Throws RuleError for
+// unknown fields and mistyped operands, like compile_rules(). Rules that can
+// never match (see check_reachability) get no code. If the rules are
+// exhaustive (see check_coverage), the last one matches without tests and
+// the program has no default. `reach` is check_reachability(rules).
+template <typename T>
+SwitchProgram compile_bytecode(const RuleSet& rules, const RuleSchema<T>& schema, const RuleReachability& reach) {
+    using switch_vm::Instr;
+    using switch_vm::Op;
+    using Type = typename RuleSchema<T>::Type;
+    SwitchProgram p;
+
+    std::map<std::string, std::uint32_t> field_slots, action_slots;
+    auto field_slot = [&](const RuleCondition& c, std::size_t line) {
+        auto it = field_slots.find(c.field);
+        if (it != field_slots.end()) return it->second;
+        const auto* f = schema.find(c.field);
+        if (!f) throw RuleError(line, "unknown field '" + c.field + "'");
+        p.fields.push_back(c.field);
+        p.field_is_string.push_back(f->type == Type::String);
+        return field_slots[c.field] = static_cast<std::uint32_t>(p.fields.size() - 1);
+    };
+    auto action_slot = [&](const std::string& name) {
+        auto it = action_slots.find(name);
+        if (it != action_slots.end()) return it->second;
+        p.actions.push_back(name);
+        return action_slots[name] = static_cast<std::uint32_t>(p.actions.size() - 1);
+    };
+
+    // Type-check every condition and count the rules that test each field.
+    RuleCoverage coverage = check_coverage(rules, reach, schema);
+    std::vector<std::size_t> uses;
+    for (std::size_t index = 0; index < rules.rules.size(); ++index) {
+        const Rule& rule = rules.rules[index];
+        std::vector<std::uint32_t> tested;
+        for (const RuleCondition& c : rule.conditions) {
+            std::uint32_t slot = field_slot(c, rule.line);
+            bool want_string = p.field_is_string[slot];
+            for (const RuleLiteral& lit : c.operands) {
+                if (lit.is_string != want_string) {
+                    throw RuleError(rule.line, "field '" + c.field + "' is " + (want_string ? "a string" : "an integer"));
+                }
+            }
+            if (!want_string && (c.op == RuleOp::Prefix || c.op == RuleOp::Contains)) {
+                throw RuleError(rule.line, "prefix/contains need a string field");
+            }
+            tested.push_back(slot);
+        }
+        std::sort(tested.begin(), tested.end());
+        tested.erase(std::unique(tested.begin(), tested.end()), tested.end());
+        uses.resize(p.fields.size(), 0);
+        if (!reach.dead(index)) {
+            for (std::uint32_t slot : tested) ++uses[slot];
+        }
+        p.rule_names.push_back(rule.name);
+        p.rule_actions.push_back(action_slot(rule.action));
+    }
+    if (!rules.default_action.empty() && !coverage.exhaustive) p.default_action = action_slot(rules.default_action);
+
+    // Fields tested by several rules are hoisted into registers at entry.
+    std::vector<int> hoisted(p.fields.size(), -1);
+    std::size_t next_int = 0, next_str = 0;
+    for (std::uint32_t f = 0; f < p.fields.size(); ++f) {
+        if (uses[f] < 2) continue;
+        std::size_t& next = p.field_is_string[f] ? next_str : next_int;
+        if (next >= switch_vm::kRegisters / 2) continue; // Keep half for scratch use.
+        hoisted[f] = static_cast<int>(next++);
+        p.code.push_back(Instr{p.field_is_string[f] ? Op::LoadStr : Op::LoadInt,
+                               static_cast<std::uint8_t>(hoisted[f]), static_cast<std::uint16_t>(f), 0, 0, 0});
+    }
+
+    std::vector<std::uint32_t> order(rules.rules.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return rules.rules[a].priority < rules.rules[b].priority;
+    });
+
+    std::vector<std::size_t> pending; // Instructions whose target is the next rule.
+    for (std::uint32_t index : order) {
+        if (reach.dead(index)) continue; // Never matches: no code.
+        const Rule& rule = rules.rules[index];
+        std::uint32_t start = static_cast<std::uint32_t>(p.code.size());
+        for (std::size_t i : pending) p.code[i].target = start;
+        pending.clear();
+        if (index == coverage.last_rule) {
+            // Reached only when no other rule matched, so it matches.
+            p.code.push_back(Instr{Op::Match, 0, 0, index, 0, 0});
+            continue;
+        }
+
+        // Fields tested more than once in this rule but not hoisted get a
+        // scratch register; the rest are tested with fused instructions.
+        std::map<std::uint32_t, int> count, scratch;
+        for (const RuleCondition& c : rule.conditions) ++count[field_slots[c.field]];
+        std::size_t scratch_int = next_int, scratch_str = next_str;
+
+        for (const RuleCondition& c : rule.conditions) {
+            std::uint32_t f = field_slots[c.field];
+            bool is_string = p.field_is_string[f];
+            int reg = hoisted[f];
+            if (reg < 0 && count[f] > 1) {
+                auto it = scratch.find(f);
+                std::size_t& next = is_string ? scratch_str : scratch_int;
+                if (it != scratch.end()) {
+                    reg = it->second;
+                } else if (next < switch_vm::kRegisters - 1) { // The last one is for unfused tests.
+                    reg = static_cast<int>(next++);
+                    scratch[f] = reg;
+                    p.code.push_back(Instr{is_string ? Op::LoadStr : Op::LoadInt, static_cast<std::uint8_t>(reg),
+                                           static_cast<std::uint16_t>(f), 0, 0, 0});
+                }
+            }
+            bool fused = reg < 0;
+
+            Instr in{Op::Halt, static_cast<std::uint8_t>(fused ? 0 : reg), static_cast<std::uint16_t>(f),
+                     switch_vm::kNone, 0, 0};
+            if (is_string) {
+                if (c.op == RuleOp::In) {
+                    std::vector<std::string> set;
+                    for (const RuleLiteral& lit : c.operands) set.push_back(lit.text);
+                    std::sort(set.begin(), set.end());
+                    in.a = static_cast<std::int64_t>(p.strings.size());
+                    in.b = static_cast<std::int64_t>(set.size());
+                    p.strings.insert(p.strings.end(), set.begin(), set.end());
+                } else {
+                    in.a = static_cast<std::int64_t>(p.strings.size());
+                    p.strings.push_back(c.operands[0].text);
+                    if (c.op == RuleOp::Range) {
+                        in.b = static_cast<std::int64_t>(p.strings.size());
+                        p.strings.push_back(c.operands[1].text);
+                    }
+                }
+                static const Op reg_ops[] = {Op::StrEq, Op::StrNe, Op::StrLt, Op::StrLe, Op::StrGt, Op::StrGe,
+                                             Op::StrRange, Op::StrIn, Op::StrPrefix, Op::StrContains};
+                in.op = reg_ops[static_cast<std::size_t>(c.op)];
+                if (fused) {
+                    if (c.op == RuleOp::Eq) {
+                        in.op = Op::FieldStrEq;
+                    } else if (c.op == RuleOp::Prefix) {
+                        in.op = Op::FieldStrPrefix;
+                    } else if (c.op == RuleOp::Contains) {
+                        in.op = Op::FieldStrContains;
+                    } else {
+                        // No fused form: load into a scratch register first.
+                        in.reg = static_cast<std::uint8_t>(switch_vm::kRegisters - 1);
+                        p.code.push_back(Instr{Op::LoadStr, in.reg, static_cast<std::uint16_t>(f), 0, 0, 0});
+                    }
+                }
+            } else {
+                if (c.op == RuleOp::In) {
+                    std::vector<std::int64_t> set;
+                    for (const RuleLiteral& lit : c.operands) set.push_back(lit.number);
+                    std::sort(set.begin(), set.end());
+                    in.a = static_cast<std::int64_t>(p.ints.size());
+                    in.b = static_cast<std::int64_t>(set.size());
+                    p.ints.insert(p.ints.end(), set.begin(), set.end());
+                } else {
+                    in.a = c.operands[0].number;
+                    if (c.op == RuleOp::Range) in.b = c.operands[1].number;
+                }
+                static const Op reg_ops[] = {Op::IntEq, Op::IntNe, Op::IntLt, Op::IntLe,
+                                             Op::IntGt, Op::IntGe, Op::IntRange, Op::IntIn};
+                static const Op fused_ops[] = {Op::FieldEq, Op::FieldNe, Op::FieldLt, Op::FieldLe,
+                                               Op::FieldGt, Op::FieldGe, Op::FieldRange, Op::FieldIn};
+                in.op = (fused ? fused_ops : reg_ops)[static_cast<std::size_t>(c.op)];
+            }
+            pending.push_back(p.code.size());
+            p.code.push_back(in);
+        }
+        p.code.push_back(Instr{Op::Match, 0, 0, index, 0, 0});
+    }
+    for (std::size_t i : pending) p.code[i].target = static_cast<std::uint32_t>(p.code.size());
+    p.code.push_back(Instr{Op::Halt, 0, 0, 0, 0, 0});
+    return p;
+}
+
+template <typename T>
+SwitchProgram compile_bytecode(const RuleSet& rules, const RuleSchema<T>& schema) {
+    return compile_bytecode(rules, schema, check_reachability(rules));
+}
+
+// Runs a SwitchProgram against values of T. const and thread-safe like
+// CompiledSwitch: the registers live on the stack of each call.
+template <typename T>
+class BytecodeSwitch {
+public:
+    using Action = typename RuleActions<T>::Action;
+    using Field = typename RuleSchema<T>::Field;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    BytecodeSwitch(SwitchProgram program, const RuleSchema<T>& schema, const RuleActions<T>& actions)
+        : program_(std::move(program)), fields_(schema.fields()) {
+        for (std::size_t i = 0; i < program_.fields.size(); ++i) {
+            const Field* f = schema.find(program_.fields[i]);
+            if (!f || (f->type == RuleSchema<T>::Type::String) != program_.field_is_string[i]) {
+                throw std::runtime_error("field '" + program_.fields[i] + "' is missing or has the wrong type");
+            }
+            field_slots_.push_back(f);
+        }
+        for (const std::string& name : program_.actions) {
+            const Action* a = actions.find(name);
+            if (!a) throw std::runtime_error("unknown action '" + name + "'");
+            action_slots_.push_back(*a);
+        }
+    }
+
+    // Index (in rule-file order) of the first matching rule, or npos.
+    std::size_t find(const T& value) const {
+        std::uint32_t rule = run(value);
+        return rule == switch_vm::kNone ? npos : rule;
+    }
+
+    // Runs the action of the first matching rule, or the default action.
+    // Returns true if a rule (not the default) matched.
+    bool evaluate(const T& value) const { return run_action(find(value), value); }
+
+    // Runs the action of `rule` as returned by find(), or the default action
+    // for npos. Returns true if `rule` is not npos.
+    bool run_action(std::size_t rule, const T& value) const {
+        if (rule != npos) {
+            action_slots_[program_.rule_actions[rule]](value);
+            return true;
+        }
+        if (program_.default_action != switch_vm::kNone) action_slots_[program_.default_action](value);
+        return false;
+    }
+
+    const SwitchProgram& program() const { return program_; }
+
+private:
+    std::int64_t load_int(std::uint16_t field, const T& value) const { return field_slots_[field]->get_int(value); }
+    std::string_view load_str(std::uint16_t field, const T& value) const {
+        return field_slots_[field]->get_string(value);
+    }
+
+    bool in_ints(const switch_vm::Instr& in, std::int64_t v) const {
+        const std::int64_t* first = program_.ints.data() + in.a;
+        return std::binary_search(first, first + in.b, v);
+    }
+
+    bool in_strings(const switch_vm::Instr& in, std::string_view v) const {
+        const std::string* first = program_.strings.data() + in.a;
+        return std::binary_search(first, first + in.b, v,
+                                  [](const auto& x, const auto& y) { return std::string_view(x) < std::string_view(y); });
+    }
+
+    const std::string& str(std::int64_t index) const { return program_.strings[static_cast<std::size_t>(index)]; }
+
+    // Returns the matching rule index, or kNone.
+    std::uint32_t run(const T& value) const {
+        using switch_vm::Op;
+        std::int64_t iregs[switch_vm::kRegisters];
+        std::string_view sregs[switch_vm::kRegisters];
+        const switch_vm::Instr* code = program_.code.data();
+        const switch_vm::Instr* pc = code;
+
+#define SWITCH_VM_TEST(cond) \
+    pc = (cond) ? pc + 1 : code + pc->target; \
+    SWITCH_VM_DISPATCH();
+
+#if SWITCH_VM_THREADED
+        static const void* const labels[] = {
+#define SWITCH_VM_LABEL(name) &&op_##name,
+            SWITCH_VM_OPCODES(SWITCH_VM_LABEL)
+#undef SWITCH_VM_LABEL
+        };
+#define SWITCH_VM_DISPATCH() goto *labels[static_cast<std::size_t>(pc->op)]
+#define SWITCH_VM_OP(name) op_##name:
+        SWITCH_VM_DISPATCH();
+        {
+#else
+#define SWITCH_VM_DISPATCH() goto dispatch
+#define SWITCH_VM_OP(name) case Op::name:
+    dispatch:
+        switch (pc->op) {
+#endif
+        SWITCH_VM_OP(LoadInt) iregs[pc->reg] = load_int(pc->field, value); ++pc; SWITCH_VM_DISPATCH();
+        SWITCH_VM_OP(LoadStr) sregs[pc->reg] = load_str(pc->field, value); ++pc; SWITCH_VM_DISPATCH();
+
+        SWITCH_VM_OP(IntEq) SWITCH_VM_TEST(iregs[pc->reg] == pc->a)
+        SWITCH_VM_OP(IntNe) SWITCH_VM_TEST(iregs[pc->reg] != pc->a)
+        SWITCH_VM_OP(IntLt) SWITCH_VM_TEST(iregs[pc->reg] < pc->a)
+        SWITCH_VM_OP(IntLe) SWITCH_VM_TEST(iregs[pc->reg] <= pc->a)
+        SWITCH_VM_OP(IntGt) SWITCH_VM_TEST(iregs[pc->reg] > pc->a)
+        SWITCH_VM_OP(IntGe) SWITCH_VM_TEST(iregs[pc->reg] >= pc->a)
+        SWITCH_VM_OP(IntRange) SWITCH_VM_TEST(pc->a <= iregs[pc->reg] && iregs[pc->reg] <= pc->b)
+        SWITCH_VM_OP(IntIn) SWITCH_VM_TEST(in_ints(*pc, iregs[pc->reg]))
+
+        SWITCH_VM_OP(StrEq) SWITCH_VM_TEST(sregs[pc->reg] == str(pc->a))
+        SWITCH_VM_OP(StrNe) SWITCH_VM_TEST(sregs[pc->reg] != str(pc->a))
+        SWITCH_VM_OP(StrLt) SWITCH_VM_TEST(sregs[pc->reg] < str(pc->a))
+        SWITCH_VM_OP(StrLe) SWITCH_VM_TEST(sregs[pc->reg] <= str(pc->a))
+        SWITCH_VM_OP(StrGt) SWITCH_VM_TEST(sregs[pc->reg] > str(pc->a))
+        SWITCH_VM_OP(StrGe) SWITCH_VM_TEST(sregs[pc->reg] >= str(pc->a))
+        SWITCH_VM_OP(StrRange) SWITCH_VM_TEST(str(pc->a) <= sregs[pc->reg] && sregs[pc->reg] <= str(pc->b))
+        SWITCH_VM_OP(StrIn) SWITCH_VM_TEST(in_strings(*pc, sregs[pc->reg]))
+        SWITCH_VM_OP(StrPrefix) SWITCH_VM_TEST(sregs[pc->reg].substr(0, str(pc->a).size()) == str(pc->a))
+        SWITCH_VM_OP(StrContains) SWITCH_VM_TEST(sregs[pc->reg].find(str(pc->a)) != std::string_view::npos)
+
+        SWITCH_VM_OP(FieldEq) SWITCH_VM_TEST(load_int(pc->field, value) == pc->a)
+        SWITCH_VM_OP(FieldNe) SWITCH_VM_TEST(load_int(pc->field, value) != pc->a)
+        SWITCH_VM_OP(FieldLt) SWITCH_VM_TEST(load_int(pc->field, value) < pc->a)
+        SWITCH_VM_OP(FieldLe) SWITCH_VM_TEST(load_int(pc->field, value) <= pc->a)
+        SWITCH_VM_OP(FieldGt) SWITCH_VM_TEST(load_int(pc->field, value) > pc->a)
+        SWITCH_VM_OP(FieldGe) SWITCH_VM_TEST(load_int(pc->field, value) >= pc->a)
+        SWITCH_VM_OP(FieldRange) {
+            std::int64_t v = load_int(pc->field, value);
+            SWITCH_VM_TEST(pc->a <= v && v <= pc->b)
+        }
+        SWITCH_VM_OP(FieldIn) SWITCH_VM_TEST(in_ints(*pc, load_int(pc->field, value)))
+        SWITCH_VM_OP(FieldStrEq) SWITCH_VM_TEST(load_str(pc->field, value) == str(pc->a))
+        SWITCH_VM_OP(FieldStrPrefix) SWITCH_VM_TEST(load_str(pc->field, value).substr(0, str(pc->a).size()) == str(pc->a))
+        SWITCH_VM_OP(FieldStrContains) SWITCH_VM_TEST(load_str(pc->field, value).find(str(pc->a)) != std::string_view::npos)
+
+        SWITCH_VM_OP(Match) return pc->target;
+        SWITCH_VM_OP(Halt) return switch_vm::kNone;
+        }
+#undef SWITCH_VM_OP
+#undef SWITCH_VM_DISPATCH
+#undef SWITCH_VM_TEST
+        return switch_vm::kNone;
+    }
+
+    SwitchProgram program_;
+    std::shared_ptr<const std::vector<Field>> fields_; // Keeps the getters alive.
+    std::vector<const Field*> field_slots_;
+    std::vector<Action> action_slots_;
+};
+
+#endif // SWITCH_BYTECODE_HPP
@@ -0,0 +1,88 @@
+// Offline generator: reads a rule file and writes a C++ header with a native
+// switch, range cascade or constexpr table for it (see switch_codegen.hpp).
+//
+// Build: g++ -std=c++17 -O2 -o switch_codegen switch_codegen.cpp
+// Usage: ./switch_codegen RULES [-o HEADER] [--name NAMESPACE] [--key FIELD]
+//                         [--cascade-limit N] [--strict]
+// Rules that can never match are reported on stderr as warnings.
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "switch_codegen.hpp"
+
+using namespace std;
+
+static bool valid_identifier(const string& s) {
+    if (s.empty() || isdigit(static_cast<unsigned char>(s[0]))) return false;
+    for (char c : s) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_') return false;
+    }
+    return true;
+}
+
+static void print_usage() {
+    cerr << "Usage: switch_codegen RULES [-o HEADER] [--name NAMESPACE] [--key FIELD] [--cascade-limit N] [--strict]\n"
+         << "  --key FIELD  integer field dispatched natively (default: value; empty: none)\n"
+         << "  --strict     the header static_asserts that no rule is dead\n";
+}
+
+int main(int argc, char** argv) {
+    string input, output;
+    CodegenOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* value = nullptr;
+        if (arg == "-o" && (value = next())) {
+            output = value;
+        } else if (arg == "--name" && (value = next())) {
+            options.name = value;
+        } else if (arg == "--key" && (value = next())) {
+            options.key_field = value;
+        } else if (arg == "--cascade-limit" && (value = next())) {
+            options.cascade_limit = static_cast<size_t>(strtoul(value, nullptr, 10));
+        } else if (arg == "--strict") {
+            options.strict = true;
+        } else if (input.empty() && !arg.empty() && arg[0] != '-') {
+            input = arg;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (input.empty() || !valid_identifier(options.name)) {
+        print_usage();
+        return 1;
+    }
+    options.source = input;
+
+    string header;
+    try {
+        RuleSet rules = parse_rule_file(input);
+        RuleReachability reach = check_reachability(rules);
+        for (const RuleDiagnostic& d : reach.diagnostics) {
+            cerr << input << ": warning: " << d.message << endl;
+        }
+        if (!reach.complete) cerr << input << ": note: shadowing analysis skipped past its budget" << endl;
+        header = generate_switch_header(rules, options, reach);
+    } catch (const exception& e) {
+        cerr << input << ": " << e.what() << endl;
+        return 1;
+    }
+
+    if (output.empty()) {
+        cout << header;
+        return 0;
+    }
+    ofstream out(output);
+    out << header;
+    if (!out) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+    return 0;
+}
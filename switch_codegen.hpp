@@ -0,0 +1,321 @@
+#ifndef SWITCH_CODEGEN_HPP
+#define SWITCH_CODEGEN_HPP
+
+// Ahead-of-time code generation: turns a rule file (see switch_rules.hpp)
+// into a self-contained C++ header, so static rule sets compile down to a
+// native switch, a range cascade or a constexpr table.
+// The generated namespace provides, for any T with the rule fields as data
+// members (the field "value" is the value itself):
+//   constexpr std::size_t find(const T& v);  // rule index in file order, or npos
+//   constexpr Action action_of(const T& v);  // action of that rule, or the default
+// with the same first-match semantics as CompiledSwitch. Rules whose only
+// condition is on the key field are dispatched on the key:
+//   - only single values: a native switch statement;
+//   - ranges, at most `cascade_limit` segments: an if/else range cascade;
+//   - otherwise: a constexpr table of segment boundaries, binary-searched.
+// All other rules become if statements, tried in order up to the best
+// key match. Rules that can never match (see check_reachability) are left
+// out of find() and listed as rule_live[i] == false; with `strict`, the
+// generated header does not compile while there are any. If the rules are
+// exhaustive (see check_coverage), the last rule is not tested and find()
+// never returns npos.
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "switch_image.hpp"
+
+struct CodegenOptions {
+    std::string name = "rules";      // Namespace of the generated code.
+    std::string key_field = "value"; // Integer field to dispatch on; empty for none.
+    std::size_t cascade_limit = 8;   // Largest segment count emitted as an if/else cascade.
+    std::string source;              // Rule file name, for the header comment.
+    bool strict = false;             // A static_assert fails for every rule that can never match.
+};
+
+namespace switch_codegen_detail {
+
+// Escapes `s` as the body of a C++ string literal.
+inline std::string quote(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7f) {
+                    static const char hex[] = "0123456789abcdef";
+                    // A hex escape would swallow following hex digits, so
+                    // the literal is closed and reopened after it.
+                    out += "\\x";
+                    out += hex[static_cast<unsigned char>(c) >> 4];
+                    out += hex[static_cast<unsigned char>(c) & 15];
+                    out += "\" \"";
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+inline std::string int_literal(std::int64_t v) {
+    // INT64_MIN has no literal form.
+    if (v == std::numeric_limits<std::int64_t>::min()) return "(-9223372036854775807LL - 1)";
+    return std::to_string(v) + "LL";
+}
+
+inline std::string field_expr(const std::string& field, bool is_string) {
+    std::string access = field == "value" ? "v" : "v." + field;
+    return is_string ? "std::string_view(" + access + ")" : "static_cast<std::int64_t>(" + access + ")";
+}
+
+inline std::string condition_expr(const RuleCondition& c) {
+    bool is_string = c.operands[0].is_string;
+    std::string x = field_expr(c.field, is_string);
+    auto lit = [&](std::size_t i) {
+        return is_string ? "std::string_view(" + quote(c.operands[i].text) + ")" : int_literal(c.operands[i].number);
+    };
+    switch (c.op) {
+        case RuleOp::Eq: return x + " == " + lit(0);
+        case RuleOp::Ne: return x + " != " + lit(0);
+        case RuleOp::Lt: return x + " < " + lit(0);
+        case RuleOp::Le: return x + " <= " + lit(0);
+        case RuleOp::Gt: return x + " > " + lit(0);
+        case RuleOp::Ge: return x + " >= " + lit(0);
+        case RuleOp::Range: return "(" + lit(0) + " <= " + x + " && " + x + " <= " + lit(1) + ")";
+        case RuleOp::In: {
+            std::string out = "(";
+            for (std::size_t i = 0; i < c.operands.size(); ++i) {
+                if (i) out += " || ";
+                out += x + " == " + lit(i);
+            }
+            return out + ")";
+        }
+        case RuleOp::Prefix: return x + ".substr(0, " + std::to_string(c.operands[0].text.size()) + ") == " + lit(0);
+        case RuleOp::Contains: return x + ".find(" + lit(0) + ") != std::string_view::npos";
+    }
+    return "false";
+}
+
+} // namespace switch_codegen_detail
+
+// Generates the header for `rules`. Throws RuleError for rules the generated
+// code cannot express (mixed operand types, an action named no_action).
+// `reach` is check_reachability(rules).
+inline std::string generate_switch_header(const RuleSet& rules, const CodegenOptions& options, const RuleReachability& reach) {
+    namespace fmt = switch_image_format;
+    using namespace switch_codegen_detail;
+    constexpr std::uint32_t kNone = fmt::kNone;
+
+    // Evaluation order: by priority, then file order.
+    RuleCoverage coverage = check_coverage(rules, reach);
+    std::vector<std::uint32_t> order;
+    for (std::uint32_t i = 0; i < rules.rules.size(); ++i) {
+        if (!reach.dead(i)) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return rules.rules[a].priority < rules.rules[b].priority;
+    });
+
+    // Action enumerators, in order of first use.
+    std::vector<std::string> actions;
+    std::map<std::string, std::size_t> action_ids;
+    auto action_id = [&](const std::string& name, std::size_t line) {
+        if (name == "no_action") throw RuleError(line, "'no_action' is reserved in generated code");
+        auto it = action_ids.find(name);
+        if (it != action_ids.end()) return it->second;
+        actions.push_back(name);
+        return action_ids[name] = actions.size() - 1;
+    };
+    for (const Rule& rule : rules.rules) {
+        action_id(rule.action, rule.line);
+        for (const RuleCondition& c : rule.conditions) {
+            for (const RuleLiteral& lit : c.operands) {
+                if (lit.is_string != c.operands[0].is_string) {
+                    throw RuleError(rule.line, "mixed operand types for '" + c.field + "'");
+                }
+            }
+        }
+    }
+    if (!rules.default_action.empty()) action_id(rules.default_action, rules.default_line);
+
+    // Split rules into the key index and the scanned rest.
+    std::vector<std::pair<std::uint32_t, std::pair<std::int64_t, std::int64_t>>> intervals;
+    std::vector<std::uint32_t> scan;
+    bool points_only = true;
+    for (std::uint32_t pos = 0; pos < order.size(); ++pos) {
+        const Rule& rule = rules.rules[order[pos]];
+        bool indexed = false;
+        if (!options.key_field.empty() && rule.conditions.size() == 1) {
+            const RuleCondition& c = rule.conditions[0];
+            std::int64_t lo, hi;
+            if (c.field == options.key_field && !c.operands[0].is_string) {
+                if (c.op == RuleOp::In) {
+                    for (const RuleLiteral& lit : c.operands) intervals.push_back({pos, {lit.number, lit.number}});
+                    indexed = true;
+                } else if (switch_image_detail::key_interval(c, lo, hi)) {
+                    intervals.push_back({pos, {lo, hi}});
+                    points_only = points_only && lo == hi;
+                    indexed = true;
+                }
+            }
+        }
+        if (!indexed) scan.push_back(pos);
+    }
+
+    std::ostringstream out;
+    std::string guard;
+    for (char c : options.name) guard += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    guard += "_RULES_HPP";
+
+    out << "// Generated by switch_codegen" << (options.source.empty() ? "" : " from " + options.source)
+        << ". Do not edit.\n"
+        << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+        << "#include <cstddef>\n#include <cstdint>\n#include <string_view>\n\n"
+        << "namespace " << options.name << " {\n\n"
+        << "constexpr std::size_t npos = static_cast<std::size_t>(-1);\n"
+        << "constexpr std::size_t rule_count = " << rules.rules.size() << ";\n\n"
+        << "enum class Action : int {";
+    for (std::size_t i = 0; i < actions.size(); ++i) out << (i ? ", " : " ") << actions[i];
+    out << (actions.empty() ? " " : ", ") << "no_action };\n\n";
+
+    out << "// Rule names and actions, in file order.\n"
+        << "constexpr const char* rule_names[] = {";
+    for (std::size_t i = 0; i < rules.rules.size(); ++i) out << (i ? ", " : "") << quote(rules.rules[i].name);
+    out << (rules.rules.empty() ? "nullptr" : "") << "};\n"
+        << "constexpr Action rule_actions[] = {";
+    for (std::size_t i = 0; i < rules.rules.size(); ++i) out << (i ? ", " : "") << "Action::" << rules.rules[i].action;
+    out << (rules.rules.empty() ? "Action::no_action" : "") << "};\n"
+        << "constexpr Action default_action = Action::"
+        << (rules.default_action.empty() ? "no_action" : rules.default_action) << ";\n\n";
+
+    out << "// false for rules that can never match; find() does not test them.\n"
+        << "constexpr bool rule_live[] = {";
+    for (std::size_t i = 0; i < rules.rules.size(); ++i) out << (i ? ", " : "") << (reach.dead(i) ? "false" : "true");
+    out << (rules.rules.empty() ? "true" : "") << "};\n"
+        << "constexpr std::size_t dead_rule_count = " << reach.dead_count() << ";\n"
+        << "// true if some rule matches every value: find() never returns npos.\n"
+        << "constexpr bool exhaustive = " << (coverage.exhaustive ? "true" : "false") << ";\n";
+    for (const RuleDiagnostic& d : reach.diagnostics) {
+        if (options.strict) {
+            out << "static_assert(rule_live[" << d.rule << "], " << quote((options.source.empty() ? "" : options.source + ": ") + d.message) << ");\n";
+        } else {
+            out << "// " << d.message << "\n";
+        }
+    }
+    out << "\n";
+
+    // The key index yields `best`, a position in evaluation order.
+    std::vector<fmt::Segment> segments;
+    bool use_switch = !intervals.empty() && points_only;
+    bool use_table = false;
+    if (!intervals.empty() && !use_switch) {
+        segments = switch_image_detail::build_segments(intervals);
+        use_table = segments.size() > options.cascade_limit;
+    }
+    out << "namespace detail {\n\n"
+        << "constexpr std::uint32_t none = 0xFFFFFFFFu;\n"
+        << "// Rule index (file order) of each position in evaluation order.\n"
+        << "constexpr std::size_t source_index[] = {";
+    for (std::size_t i = 0; i < order.size(); ++i) out << (i ? ", " : "") << order[i];
+    out << (order.empty() ? "0" : "") << "};\n";
+    if (use_table) {
+        out << "\n// Segment starts and the first rule (position) covering each segment.\n"
+            << "constexpr std::int64_t segment_starts[] = {";
+        for (std::size_t i = 0; i < segments.size(); ++i) out << (i ? ", " : "") << int_literal(segments[i].start);
+        out << "};\nconstexpr std::uint32_t segment_rules[] = {";
+        for (std::size_t i = 0; i < segments.size(); ++i) {
+            out << (i ? ", " : "") << (segments[i].rule == kNone ? "none" : std::to_string(segments[i].rule));
+        }
+        out << "};\n\n"
+            << "constexpr std::uint32_t lookup(std::int64_t key) {\n"
+            << "    std::size_t lo = 0, hi = " << segments.size() << ";\n"
+            << "    while (lo < hi) {\n"
+            << "        std::size_t mid = lo + (hi - lo) / 2;\n"
+            << "        if (segment_starts[mid] <= key) lo = mid + 1; else hi = mid;\n"
+            << "    }\n"
+            << "    return lo == 0 ? none : segment_rules[lo - 1];\n"
+            << "}\n";
+    }
+    out << "\n} // namespace detail\n\n";
+
+    out << "template <typename T>\n"
+        << "constexpr std::size_t find(const T& v) {\n";
+    if (!intervals.empty()) {
+        std::string key = field_expr(options.key_field, false);
+        out << "    std::uint32_t best = detail::none;\n"
+            << "    const std::int64_t key = " << key << ";\n";
+        if (use_switch) {
+            // First rule per value wins; group values by rule.
+            std::map<std::int64_t, std::uint32_t> first;
+            for (const auto& iv : intervals) first.emplace(iv.second.first, iv.first);
+            std::map<std::uint32_t, std::vector<std::int64_t>> by_rule;
+            for (const auto& kv : first) by_rule[kv.second].push_back(kv.first);
+            out << "    switch (key) {\n";
+            for (const auto& kv : by_rule) {
+                out << "        ";
+                for (std::int64_t value : kv.second) out << "case " << int_literal(value) << ": ";
+                out << "best = " << kv.first << "; break;\n";
+            }
+            out << "        default: break;\n    }\n";
+        } else if (use_table) {
+            out << "    best = detail::lookup(key);\n";
+        } else {
+            for (std::size_t i = 0; i < segments.size(); ++i) {
+                out << (i ? "    else " : "    ");
+                if (i + 1 < segments.size()) {
+                    out << "if (key < " << int_literal(segments[i + 1].start) << ") ";
+                }
+                out << "{ if (key >= " << int_literal(segments[i].start) << ") best = "
+                    << (segments[i].rule == kNone ? "detail::none" : std::to_string(segments[i].rule)) << "; }\n";
+            }
+        }
+    }
+    for (std::uint32_t pos : scan) {
+        const Rule& rule = rules.rules[order[pos]];
+        if (order[pos] == coverage.last_rule) {
+            // Reached only when no other rule matched, so it matches.
+            out << "    " << (intervals.empty() ? "" : "if (best > " + std::to_string(pos) + ") ") << "return " << order[pos]
+                << "; // " << rule.name << "\n";
+            continue;
+        }
+        out << "    if (" << (intervals.empty() ? "" : "best > " + std::to_string(pos) + " && ");
+        for (std::size_t i = 0; i < rule.conditions.size(); ++i) {
+            out << (i ? " && " : "") << condition_expr(rule.conditions[i]);
+        }
+        out << ") return " << order[pos] << "; // " << rule.name << "\n";
+    }
+    // Exhaustive: a matching scanned rule has returned, so an indexed one set best.
+    if (coverage.exhaustive) {
+        out << (intervals.empty() ? "" : "    return detail::source_index[best];\n");
+    } else {
+        out << (intervals.empty() ? "    return npos;\n" : "    return best == detail::none ? npos : detail::source_index[best];\n");
+    }
+    out
+        << "}\n\n"
+        << "template <typename T>\n"
+        << "constexpr Action action_of(const T& v) {\n"
+        << "    std::size_t rule = find(v);\n"
+        << "    return rule == npos ? default_action : rule_actions[rule];\n"
+        << "}\n\n"
+        << "} // namespace " << options.name << "\n\n"
+        << "#endif // " << guard << "\n";
+    return out.str();
+}
+
+inline std::string generate_switch_header(const RuleSet& rules, const CodegenOptions& options) {
+    return generate_switch_header(rules, options, check_reachability(rules));
+}
+
+#endif // SWITCH_CODEGEN_HPP
@@ -0,0 +1,524 @@
+#ifndef SWITCH_EXPLAIN_HPP
+#define SWITCH_EXPLAIN_HPP
+
+// EXPLAIN for switches: what a switch does when it is evaluated.
+// explain() on Switch, CompiledSwitch and PlannedSwitch returns a
+// SwitchExplanation with:
+// - the strategy;
+// - how many cases are equality tests, ranges or opaque predicates;
+// - the size and approximate memory of every table;
+// - the estimated cost per evaluate (ns and cycles, from the planner's
+//   calibration);
+// - the cases that force a linear scan, and why.
+// It prints as text or JSON, and as Graphviz DOT where there is a structure
+// to draw (indexes of a CompiledSwitch, the control flow of a rule program).
+// Usage:
+//   std::cout << sw.explain().text();
+//   sw.explain().write_json(out);
+//   sw.explain().write_dot(out); // dot -Tsvg
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "compiled_switch.hpp"
+#include "custom_switch.hpp"
+#include "switch_planner.hpp"
+
+struct SwitchExplanation {
+    struct Table {
+        std::string name;
+        std::size_t entries = 0;
+        std::size_t bytes = 0; // Approximate.
+    };
+    struct Fallback {
+        std::size_t id = 0;   // Case id or rule index.
+        std::string name;     // Rule name; empty for plain cases.
+        std::string reason;
+    };
+
+    std::string engine;   // Switch, CompiledSwitch, PlannedSwitch.
+    std::string strategy;
+    std::size_t cases = 0;
+    bool has_default = false;
+    std::size_t equality_cases = 0;
+    std::size_t range_cases = 0;
+    std::size_t opaque_cases = 0;
+    std::vector<Table> tables;
+    std::size_t memory_bytes = 0;    // Sum of the tables.
+    double estimated_ns = 0;         // Per evaluate; 0 if unknown.
+    double estimated_cycles = 0;     // 0 without a cycle counter.
+    std::vector<std::pair<std::string, double>> alternatives; // Other strategies, estimated ns.
+    std::vector<Fallback> fallbacks; // Cases that are scanned linearly.
+    std::vector<std::string> notes;
+    std::string graph;               // DOT; empty if there is nothing to draw.
+
+    // Readable report; lists at most `max_fallbacks` fallback cases.
+    void write_text(std::ostream& out, std::size_t max_fallbacks = 20) const;
+    void write_json(std::ostream& out) const;
+    // Writes `graph`, or an empty digraph.
+    void write_dot(std::ostream& out) const { out << (graph.empty() ? "digraph switch {}\n" : graph); }
+
+    std::string text() const {
+        std::ostringstream out;
+        write_text(out);
+        return out.str();
+    }
+    std::string json() const {
+        std::ostringstream out;
+        write_json(out);
+        return out.str();
+    }
+
+    void add_table(std::string name, std::size_t entries, std::size_t bytes) {
+        tables.push_back(Table{std::move(name), entries, bytes});
+        memory_bytes += bytes;
+    }
+    void set_estimate(double ns, const SwitchCalibration& cal) {
+        estimated_ns = ns;
+        estimated_cycles = ns * cal.cycles_per_ns;
+    }
+};
+
+namespace switch_explain_detail {
+
+template <typename T, typename = void>
+struct is_streamable : std::false_type {};
+
+template <typename T>
+struct is_streamable<T, std::void_t<decltype(std::declval<std::ostream&>() << std::declval<const T&>())>>
+    : std::true_type {};
+
+template <typename T>
+std::string describe(const T& value) {
+    if constexpr (is_streamable<T>::value) {
+        std::ostringstream out;
+        out << value;
+        return out.str();
+    } else {
+        (void)value;
+        return "?";
+    }
+}
+
+inline void write_json_string(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static const char* const hex = "0123456789abcdef";
+                    out << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
+
+// Escapes a DOT label.
+inline std::string dot_label(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+inline std::string format_bytes(std::size_t bytes) {
+    std::ostringstream out;
+    if (bytes < 1024) {
+        out << bytes << " B";
+    } else if (bytes < 1024 * 1024) {
+        out.precision(1);
+        out << std::fixed << static_cast<double>(bytes) / 1024 << " KiB";
+    } else {
+        out.precision(1);
+        out << std::fixed << static_cast<double>(bytes) / (1024 * 1024) << " MiB";
+    }
+    return out.str();
+}
+
+// Rough heap cost of a node in a std::map/std::set (three pointers and a
+// color) or std::unordered_map (next pointer and cached hash).
+constexpr std::size_t kTreeNode = 32;
+constexpr std::size_t kHashNode = 16;
+
+// Control flow of a rule program: tests branch to the next instruction on
+// success and to their target on failure.
+inline std::string program_graph(const SwitchProgram& p) {
+    using switch_vm::Op;
+    std::ostringstream out;
+    out << "digraph rules {\n"
+        << "  node [shape=box, fontname=\"monospace\"];\n";
+    for (std::size_t pc = 0; pc < p.code.size(); ++pc) {
+        const switch_vm::Instr& in = p.code[pc];
+        std::ostringstream label;
+        label << pc << ": ";
+        p.disassemble(label, pc);
+        out << "  n" << pc << " [label=\"" << dot_label(label.str()) << '"';
+        if (in.op == Op::Match) out << ", shape=ellipse, style=bold";
+        if (in.op == Op::Halt) out << ", shape=ellipse, label=\"no match\"";
+        out << "];\n";
+        if (in.op == Op::Match || in.op == Op::Halt) continue;
+        if (in.op == Op::LoadInt || in.op == Op::LoadStr) {
+            out << "  n" << pc << " -> n" << pc + 1 << ";\n";
+        } else {
+            out << "  n" << pc << " -> n" << pc + 1 << " [label=\"yes\"];\n"
+                << "  n" << pc << " -> n" << in.target << " [label=\"no\", style=dashed];\n";
+        }
+    }
+    out << "}\n";
+    return out.str();
+}
+
+inline std::size_t program_bytes(const SwitchProgram& p) {
+    std::size_t bytes = p.code.size() * sizeof(switch_vm::Instr) + p.ints.size() * sizeof(std::int64_t);
+    for (const std::string& s : p.strings) bytes += sizeof(std::string) + s.size();
+    return bytes;
+}
+
+// How the planner's key index sees a rule: equality or range on the key,
+// or opaque (with the reason).
+inline int classify_rule(const Rule& rule, const std::string& key_field, std::string& reason) {
+    if (rule.conditions.size() != 1) {
+        reason = std::to_string(rule.conditions.size()) + " conditions";
+        return 2;
+    }
+    const RuleCondition& c = rule.conditions[0];
+    if (key_field.empty() || c.field != key_field) {
+        reason = "tests '" + c.field + "', not the key";
+        return 2;
+    }
+    bool is_string = !c.operands.empty() && c.operands[0].is_string;
+    if (c.op == RuleOp::Eq || c.op == RuleOp::In) return 0;
+    std::int64_t lo, hi;
+    if (!is_string && switch_image_detail::key_interval(c, lo, hi)) return 1;
+    reason = is_string ? "string test other than == or in {...}" : "test cannot be indexed";
+    return 2;
+}
+
+} // namespace switch_explain_detail
+
+inline void SwitchExplanation::write_text(std::ostream& out, std::size_t max_fallbacks) const {
+    using switch_explain_detail::format_bytes;
+    out << engine << ": " << cases << " cases" << (has_default ? " + default" : "") << "\n"
+        << "strategy: " << strategy << "\n"
+        << "cases: " << equality_cases << " equality, " << range_cases << " range, " << opaque_cases << " opaque\n";
+    if (!tables.empty()) {
+        out << "tables:\n";
+        for (const Table& t : tables) {
+            out << "  " << t.name << ": " << t.entries << " entries, " << format_bytes(t.bytes) << "\n";
+        }
+        out << "memory: ~" << format_bytes(memory_bytes) << "\n";
+    }
+    if (estimated_ns > 0) {
+        std::ostringstream est;
+        est.precision(1);
+        est << std::fixed << "estimated: " << estimated_ns << " ns";
+        if (estimated_cycles > 0) est << ", " << estimated_cycles << " cycles";
+        out << est.str() << " per evaluate\n";
+    }
+    if (!alternatives.empty()) out << "estimates by strategy:\n";
+    for (const auto& alt : alternatives) {
+        std::ostringstream est;
+        est.precision(1);
+        est << std::fixed << "  " << alt.first << ": " << alt.second << " ns";
+        out << est.str() << "\n";
+    }
+    if (!fallbacks.empty()) {
+        out << "linear scan (" << fallbacks.size() << " cases):\n";
+        for (std::size_t i = 0; i < fallbacks.size() && i < max_fallbacks; ++i) {
+            const Fallback& f = fallbacks[i];
+            out << "  " << (f.name.empty() ? "case " + std::to_string(f.id) : f.name) << ": " << f.reason << "\n";
+        }
+        if (fallbacks.size() > max_fallbacks) out << "  ... " << fallbacks.size() - max_fallbacks << " more\n";
+    }
+    for (const std::string& note : notes) out << "note: " << note << "\n";
+}
+
+inline void SwitchExplanation::write_json(std::ostream& out) const {
+    using switch_explain_detail::write_json_string;
+    out << "{\"engine\": ";
+    write_json_string(out, engine);
+    out << ", \"strategy\": ";
+    write_json_string(out, strategy);
+    out << ", \"cases\": " << cases << ", \"default\": " << (has_default ? "true" : "false")
+        << ", \"classification\": {\"equality\": " << equality_cases << ", \"range\": " << range_cases
+        << ", \"opaque\": " << opaque_cases << "}, \"tables\": [";
+    for (std::size_t i = 0; i < tables.size(); ++i) {
+        out << (i ? ", " : "") << "{\"name\": ";
+        write_json_string(out, tables[i].name);
+        out << ", \"entries\": " << tables[i].entries << ", \"bytes\": " << tables[i].bytes << "}";
+    }
+    out << "], \"memory_bytes\": " << memory_bytes << ", \"estimated_ns\": " << estimated_ns
+        << ", \"estimated_cycles\": " << estimated_cycles << ", \"alternatives\": {";
+    for (std::size_t i = 0; i < alternatives.size(); ++i) {
+        out << (i ? ", " : "");
+        write_json_string(out, alternatives[i].first);
+        out << ": " << alternatives[i].second;
+    }
+    out << "}, \"fallbacks\": [";
+    for (std::size_t i = 0; i < fallbacks.size(); ++i) {
+        out << (i ? ", " : "") << "{\"id\": " << fallbacks[i].id << ", \"name\": ";
+        write_json_string(out, fallbacks[i].name);
+        out << ", \"reason\": ";
+        write_json_string(out, fallbacks[i].reason);
+        out << "}";
+    }
+    out << "], \"notes\": [";
+    for (std::size_t i = 0; i < notes.size(); ++i) {
+        out << (i ? ", " : "");
+        write_json_string(out, notes[i]);
+    }
+    out << "]}\n";
+}
+
+template <typename T, typename Timing>
+SwitchExplanation Switch<T, Timing>::explain() const {
+    const SwitchCalibration& cal = switch_calibration();
+    SwitchExplanation e;
+    e.engine = "Switch";
+    e.strategy = "linear scan of predicates, rebuilt on every evaluation";
+    e.cases = cases_.size();
+    e.has_default = default_action_.has_value();
+    e.opaque_cases = cases_.size();
+    e.add_table("cases", cases_.size(), cases_.size() * sizeof(Case<T>));
+    // Half the predicates on average, plus the action.
+    e.set_estimate((0.5 * static_cast<double>(cases_.size()) + 1) * cal.function_call_ns, cal);
+    for (std::size_t i = 0; i < cases_.size(); ++i) {
+        e.fallbacks.push_back({i, "", "predicate lambda"});
+    }
+    if (!cases_.empty()) {
+        e.notes.push_back("build a CompiledSwitch with SwitchMatch::equals/one_of/between cases to index them");
+    }
+    return e;
+}
+
+template <typename T>
+SwitchExplanation CompiledSwitch<T>::explain() const {
+    using namespace switch_explain_detail;
+    using Kind = typename Match::Kind;
+    const SwitchCalibration& cal = switch_calibration();
+    SwitchExplanation e;
+    e.engine = "CompiledSwitch";
+    e.cases = size_;
+    e.has_default = default_action_.has_value();
+
+    // Cases in first-match order, as find() sees them.
+    std::vector<const Entry*> order;
+    for (const Entry& entry : entries_) {
+        if (entry.live) order.push_back(&entry);
+    }
+    std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) { return a->rank < b->rank; });
+    for (const Entry* entry : order) {
+        Kind kind = entry->match.kind();
+        if ((kind == Kind::Equals || kind == Kind::OneOf) && kHashable) {
+            ++e.equality_cases;
+        } else if (kind == Kind::Between && kRanged) {
+            ++e.range_cases;
+        } else {
+            ++e.opaque_cases;
+            std::string reason = kind == Kind::Opaque ? "opaque predicate"
+                               : kind == Kind::Between ? "ranges are indexed for integral types only"
+                                                       : "the value type has no std::hash";
+            e.fallbacks.push_back({entry->rank.id, "", reason});
+        }
+    }
+
+    std::vector<std::string> parts;
+    double ns = cal.function_call_ns; // The action.
+    std::size_t equal_ranks = 0;
+    for (const auto& kv : equal_index_) equal_ranks += kv.second.size();
+    if (!equal_index_.empty()) {
+        parts.push_back("hash index");
+        std::size_t bytes = equal_index_.size() * (sizeof(std::pair<T, std::set<Rank>>) + kHashNode) +
+                            equal_ranks * (sizeof(Rank) + kTreeNode);
+        if constexpr (kHashable) bytes += equal_index_.bucket_count() * sizeof(void*);
+        e.add_table("hash index", equal_index_.size(), bytes);
+        ns += cal.hash_probe_ns;
+    }
+    if (!range_index_.empty()) {
+        parts.push_back("interval map");
+        std::size_t range_ranks = 0;
+        for (const auto& kv : range_index_) range_ranks += kv.second.size();
+        e.add_table("interval map", range_index_.size(),
+                    range_index_.size() * (sizeof(std::pair<const T, std::set<Rank>>) + kTreeNode) +
+                        range_ranks * (sizeof(Rank) + kTreeNode));
+        // Tree nodes are chased through pointers: about two array steps each.
+        ns += 2 * std::log2(static_cast<double>(range_index_.size()) + 1) * cal.search_step_ns;
+    }
+    if (!opaque_.empty()) {
+        parts.push_back("scan of " + std::to_string(opaque_.size()) + " predicates");
+        e.add_table("scan list", opaque_.size(), opaque_.size() * (sizeof(Rank) + kTreeNode));
+        ns += 0.5 * static_cast<double>(opaque_.size()) * cal.function_call_ns;
+    }
+    e.add_table("cases", entries_.size(), entries_.size() * sizeof(Entry));
+    if (parts.empty()) parts.push_back("empty");
+    for (std::size_t i = 0; i < parts.size(); ++i) e.strategy += (i ? " + " : "") + parts[i];
+    e.set_estimate(ns, cal);
+    if (!opaque_.empty() && (!equal_index_.empty() || !range_index_.empty())) {
+        e.notes.push_back("opaque cases ranked before an indexed match are called on every evaluation");
+    }
+
+    // Indexes from the value to the first case of each key and segment,
+    // opaque cases as a chain in the order they are tried.
+    constexpr std::size_t kMaxEdges = 64;
+    std::ostringstream g;
+    g << "digraph compiled_switch {\n"
+      << "  node [shape=box];\n"
+      << "  value [shape=oval];\n";
+    std::set<CaseId> drawn;
+    auto node = [&](CaseId id) {
+        if (drawn.insert(id).second) g << "  c" << id << " [label=\"case " << id << "\"];\n";
+        return "c" + std::to_string(id);
+    };
+    if (!equal_index_.empty()) {
+        g << "  hash [label=\"hash index\\n" << equal_index_.size() << " keys\"];\n"
+          << "  value -> hash;\n";
+        std::size_t edges = 0;
+        for (const auto& kv : equal_index_) {
+            if (edges++ == kMaxEdges) {
+                g << "  hash -> hash_more [label=\"...\"];\n  hash_more [label=\"...\", shape=plaintext];\n";
+                break;
+            }
+            std::string key;
+            if constexpr (kHashable) key = describe(kv.first);
+            std::string n = node(kv.second.begin()->id);
+            g << "  hash -> " << n << " [label=\"" << dot_label(key) << "\"];\n";
+        }
+    }
+    if (!range_index_.empty()) {
+        g << "  ranges [label=\"interval map\\n" << range_index_.size() << " segments\"];\n"
+          << "  value -> ranges;\n";
+        std::size_t edges = 0;
+        for (auto it = range_index_.begin(); it != range_index_.end(); ++it) {
+            if (it->second.empty()) continue;
+            if (edges++ == kMaxEdges) {
+                g << "  ranges -> ranges_more [label=\"...\"];\n  ranges_more [label=\"...\", shape=plaintext];\n";
+                break;
+            }
+            auto next = std::next(it);
+            std::string label = "[" + describe(it->first) + ", " + (next == range_index_.end() ? "max]" : describe(next->first) + ")");
+            std::string n = node(it->second.begin()->id);
+            g << "  ranges -> " << n << " [label=\"" << dot_label(label) << "\"];\n";
+        }
+    }
+    if (!opaque_.empty()) {
+        std::string prev = "value";
+        std::size_t edges = 0;
+        for (const Rank& r : opaque_) {
+            if (edges++ == kMaxEdges) {
+                g << "  " << prev << " -> scan_more [style=dashed];\n  scan_more [label=\"...\", shape=plaintext];\n";
+                break;
+            }
+            std::string n = node(r.id);
+            g << "  " << prev << " -> " << n << (prev == "value" ? " [label=\"scan\"]" : " [label=\"no\", style=dashed]") << ";\n";
+            prev = n;
+        }
+    }
+    g << "}\n";
+    e.graph = g.str();
+    return e;
+}
+
+template <typename T>
+SwitchExplanation PlannedSwitch<T>::explain() const {
+    using namespace switch_explain_detail;
+    const SwitchCalibration& cal = switch_calibration();
+    const std::size_t chosen = static_cast<std::size_t>(plan_.strategy);
+    SwitchExplanation e;
+    if (plan_.strategy == RuleStrategy::Compiled) {
+        e = compiled_->explain();
+        for (auto& f : e.fallbacks) {
+            if (f.id < rules_.rules.size()) f.name = rules_.rules[f.id].name;
+        }
+    }
+    e.engine = "PlannedSwitch";
+    e.cases = rules_.rules.size();
+    e.has_default = !rules_.default_action.empty();
+
+    // Classification is relative to the key index, whatever the engine.
+    const RuleReachability& reach = reach_;
+    if (plan_.strategy != RuleStrategy::Compiled) {
+        for (std::size_t i = 0; i < rules_.rules.size(); ++i) {
+            if (reach.dead(i)) continue;
+            std::string reason;
+            int kind = classify_rule(rules_.rules[i], key_field_, reason);
+            ++(kind == 0 ? e.equality_cases : kind == 1 ? e.range_cases : e.opaque_cases);
+            if (kind == 2 && plan_.strategy == RuleStrategy::Image) {
+                e.fallbacks.push_back({i, rules_.rules[i].name, reason});
+            }
+        }
+    }
+
+    switch (plan_.strategy) {
+        case RuleStrategy::Compiled:
+            e.strategy = "compiled: " + e.strategy;
+            break;
+        case RuleStrategy::Bytecode: {
+            const SwitchProgram& p = bytecode_->program();
+            e.strategy = "bytecode: every rule tested in order";
+            e.add_table("program", p.code.size(), program_bytes(p));
+            e.graph = program_graph(p);
+            break;
+        }
+        case RuleStrategy::Jit: {
+            const SwitchProgram& p = jit_->program();
+            e.add_table("program", p.code.size(), program_bytes(p));
+            if (jit_->jitted()) {
+                e.strategy = "jit: native tests in rule order";
+                if (plan_.profile.tables) {
+                    e.strategy += ", " + std::to_string(plan_.profile.tables) + " jump tables over " +
+                                  std::to_string(plan_.profile.table_rules) + " rules";
+                }
+                e.add_table("native code", jit_->code_size(), jit_->code_size());
+            } else {
+                e.strategy = "jit unavailable: bytecode interpreter";
+                e.notes.push_back("no executable memory or not x86-64; running the interpreter");
+            }
+            e.graph = program_graph(p);
+            break;
+        }
+        case RuleStrategy::Image: {
+            const switch_image_format::Header& h = image_->header();
+            e.strategy = "image: " + std::string(h.key_type == switch_image_format::kStringKey ? "hash lookup" : "segment search") +
+                         " on '" + key_field_ + "' + scan of " + std::to_string(h.scan.count) + " rules";
+            e.add_table("image", h.rules.count, image_bytes_.size());
+            if (h.segments.count) e.add_table("segments", h.segments.count, h.segments.count * sizeof(switch_image_format::Segment));
+            if (h.hash.count) e.add_table("hash slots", h.hash.count, h.hash.count * sizeof(switch_image_format::HashSlot));
+            break;
+        }
+    }
+
+    for (const RuleDiagnostic& d : reach.diagnostics) e.notes.push_back(d.message + "; compiled out");
+    if (!reach.complete) e.notes.push_back("shadowing analysis skipped: too many rules to compare; some dead rules may remain");
+    // The proof the built engine used (see the PlannedSwitch constructor).
+    if (coverage_.exhaustive) {
+        e.notes.push_back("rules on '" + coverage_.field + "' cover every value: no default path, rule '" +
+                          rules_.rules[coverage_.last_rule].name + "' is not tested");
+    }
+    e.set_estimate(plan_.estimated_ns[chosen], cal);
+    e.alternatives.clear();
+    for (std::size_t s = 0; s < kRuleStrategies; ++s) {
+        if (plan_.available[s]) e.alternatives.push_back({strategy_name(static_cast<RuleStrategy>(s)), plan_.estimated_ns[s]});
+    }
+    return e;
+}
+
+#endif // SWITCH_EXPLAIN_HPP
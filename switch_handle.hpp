@@ -0,0 +1,214 @@
+#ifndef SWITCH_HANDLE_HPP
+#define SWITCH_HANDLE_HPP
+
+// RCU-style hot swap of compiled switch rules.
+// A SwitchHandle holds an atomically swappable pointer to an immutable
+// CompiledSwitch. Readers never lock: each evaluation is one acquire load of
+// the pointer plus the evaluation itself. Writers publish a new version and
+// free old versions once every reader has passed a quiescent state (QSBR).
+// Usage:
+//   SwitchHandle<int> rules(build_rules());
+//   // reader thread:
+//   SwitchReader<int> reader(rules);
+//   reader.evaluate(value);
+//   // writer thread:
+//   rules.publish(build_new_rules());
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "compiled_switch.hpp"
+
+template <typename T> class SwitchReader;
+
+template <typename T>
+class SwitchHandle {
+public:
+    static constexpr std::size_t kMaxReaders = 256;
+
+    explicit SwitchHandle(CompiledSwitch<T> initial)
+        : current_(new CompiledSwitch<T>(std::move(initial))) {}
+
+    // All readers must have been destroyed.
+    ~SwitchHandle() {
+        delete current_.load(std::memory_order_relaxed);
+        for (auto& r : retired_) delete r.version;
+    }
+
+    SwitchHandle(const SwitchHandle&) = delete;
+    SwitchHandle& operator=(const SwitchHandle&) = delete;
+
+    // Replaces the current version. The old version is retired and freed by
+    // this or a later publish()/reclaim() once no reader can still use it.
+    void publish(CompiledSwitch<T> next) {
+        auto fresh = std::make_unique<CompiledSwitch<T>>(std::move(next));
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        publish_locked(std::move(fresh));
+    }
+
+    // Copies the current version, applies `mutate(CompiledSwitch<T>&)` to the
+    // copy and publishes it. Updates and publish() are serialized: the copy is
+    // taken from the latest version and no version published meanwhile is
+    // lost, and publish() and reclaim() wait while `mutate` runs. `mutate`
+    // must not call them on this handle.
+    template <typename Mutate>
+    void update(Mutate&& mutate) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        // Versions are only retired under writer_mutex_, so the current one
+        // stays alive during the copy.
+        auto next = std::make_unique<CompiledSwitch<T>>(*current_.load(std::memory_order_acquire));
+        mutate(*next);
+        publish_locked(std::move(next));
+    }
+
+    // Frees every retired version that no reader can see any more.
+    // Returns the number of versions still waiting.
+    std::size_t reclaim() {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        reclaim_locked();
+        return retired_.size();
+    }
+
+    // Number of published versions (including the initial one).
+    std::uint64_t version() const { return epoch_.load(std::memory_order_acquire) + 1; }
+
+private:
+    friend class SwitchReader<T>;
+
+    // Per-reader state, one cache line each so readers do not false-share.
+    // `seen` is 0 while the slot is free or the reader is offline, otherwise
+    // the last epoch the reader announced.
+    struct alignas(64) ReaderSlot {
+        std::atomic<bool> in_use{false};
+        std::atomic<std::uint64_t> seen{0};
+    };
+
+    struct Retired {
+        CompiledSwitch<T>* version;
+        std::uint64_t epoch; // Safe to free once every online reader has seen it.
+    };
+
+    const CompiledSwitch<T>* load() const { return current_.load(std::memory_order_acquire); }
+
+    // Current epoch, offset by one so that 0 can mean "offline".
+    std::uint64_t announce_epoch() const { return epoch_.load(std::memory_order_acquire) + 1; }
+
+    // Orders a reader's `seen` store before its next load of current_, and a
+    // writer's exchange of current_ before its scan of `seen`. Without both,
+    // a reader coming online could load a version while the writer still
+    // reads it as offline and frees that version (store buffering).
+    static void announce_fence() { std::atomic_thread_fence(std::memory_order_seq_cst); }
+
+    ReaderSlot* acquire_slot() {
+        for (auto& slot : readers_) {
+            bool expected = false;
+            if (slot.in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                slot.seen.store(announce_epoch(), std::memory_order_release);
+                announce_fence();
+                return &slot;
+            }
+        }
+        throw std::runtime_error("SwitchHandle: too many readers");
+    }
+
+    void release_slot(ReaderSlot* slot) {
+        slot->seen.store(0, std::memory_order_release);
+        slot->in_use.store(false, std::memory_order_release);
+    }
+
+    void publish_locked(std::unique_ptr<CompiledSwitch<T>> fresh) {
+        CompiledSwitch<T>* old = current_.exchange(fresh.release(), std::memory_order_acq_rel);
+        // Readers that announce this epoch (or later) loaded the pointer after
+        // the exchange above, so they can no longer see `old`.
+        std::uint64_t epoch = epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        retired_.push_back(Retired{old, epoch});
+        reclaim_locked();
+    }
+
+    void reclaim_locked() {
+        announce_fence();
+        std::uint64_t oldest = ~std::uint64_t{0};
+        for (auto& slot : readers_) {
+            if (!slot.in_use.load(std::memory_order_acquire)) continue;
+            std::uint64_t seen = slot.seen.load(std::memory_order_acquire);
+            if (seen != 0 && seen < oldest) oldest = seen;
+        }
+        std::size_t kept = 0;
+        for (auto& r : retired_) {
+            // announce_epoch() is epoch + 1, so a reader has moved past the
+            // version retired at `r.epoch` once it announced r.epoch + 1.
+            if (oldest > r.epoch) {
+                delete r.version;
+            } else {
+                retired_[kept++] = r;
+            }
+        }
+        retired_.resize(kept);
+    }
+
+    std::atomic<CompiledSwitch<T>*> current_;
+    alignas(64) std::atomic<std::uint64_t> epoch_{0};
+    ReaderSlot readers_[kMaxReaders];
+    std::mutex writer_mutex_;
+    std::vector<Retired> retired_;
+};
+
+// A registered reader of a SwitchHandle; use one per thread.
+// evaluate() is an acquire load plus the evaluation. Every `quiescent_every`
+// evaluations the reader also announces a quiescent state (a load and a store
+// to its own cache line), which lets writers free old versions.
+template <typename T>
+class SwitchReader {
+public:
+    explicit SwitchReader(SwitchHandle<T>& handle, unsigned quiescent_every = 64)
+        : handle_(&handle), slot_(handle.acquire_slot()),
+          quiescent_every_(quiescent_every == 0 ? 1 : quiescent_every),
+          countdown_(quiescent_every_) {}
+
+    ~SwitchReader() { handle_->release_slot(slot_); }
+
+    SwitchReader(const SwitchReader&) = delete;
+    SwitchReader& operator=(const SwitchReader&) = delete;
+
+    // Evaluates the current version; see CompiledSwitch::evaluate().
+    bool evaluate(const T& value) {
+        bool matched = handle_->load()->evaluate(value);
+        if (--countdown_ == 0) quiescent();
+        return matched;
+    }
+
+    // Index of the first matching case in the current version, or npos.
+    std::size_t find(const T& value) {
+        std::size_t index = handle_->load()->find(value);
+        if (--countdown_ == 0) quiescent();
+        return index;
+    }
+
+    // Announces that this reader holds no reference into any version.
+    void quiescent() {
+        countdown_ = quiescent_every_;
+        slot_->seen.store(handle_->announce_epoch(), std::memory_order_release);
+    }
+
+    // A reader that goes idle should go offline so it does not hold back
+    // reclamation; online() must be called before the next evaluation.
+    void offline() { slot_->seen.store(0, std::memory_order_release); }
+    void online() {
+        quiescent();
+        SwitchHandle<T>::announce_fence();
+    }
+
+private:
+    SwitchHandle<T>* handle_;
+    typename SwitchHandle<T>::ReaderSlot* slot_;
+    unsigned quiescent_every_;
+    unsigned countdown_;
+};
+
+#endif // SWITCH_HANDLE_HPP
@@ -0,0 +1,762 @@
+#ifndef SWITCH_IMAGE_HPP
+#define SWITCH_IMAGE_HPP
+
+// Memory-mappable binary images of compiled rule sets.
+// An image holds the rules of a RuleSet in evaluation order together with the
+// index built for one key field: a boundary array of integer segments, or an
+// open-addressing hash table of strings. It contains only fixed-width
+// integers and offsets from the start of the image, so it can be mmap'ed
+// read-only and evaluated in place; processes mapping the same file share its
+// pages. The header carries a format version and a checksum.
+// Usage:
+//   save_switch_image("rules.img", parse_rule_file("rules.txt"), "amount");
+//   SwitchImage image = SwitchImage::map_file("rules.img");
+//   ImageSwitch<Order> sw(image, schema, actions);
+//   sw.evaluate(order);
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SWITCH_IMAGE_HAS_MMAP 1
+#else
+#define SWITCH_IMAGE_HAS_MMAP 0
+#endif
+
+#include "switch_rules.hpp"
+
+// Thrown for images that cannot be opened, are corrupt or do not fit the
+// schema and actions they are bound to.
+class SwitchImageError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// On-disk layout. Every section starts at an 8-byte aligned offset.
+namespace switch_image_format {
+
+constexpr char kMagic[8] = {'S', 'W', 'I', 'M', 'A', 'G', 'E', '\0'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::uint32_t kByteOrder = 0x01020304; // Read back differently on the other endianness.
+constexpr std::uint32_t kNone = 0xFFFFFFFFu;
+
+enum KeyType : std::uint32_t { kNoKey = 0, kIntKey = 1, kStringKey = 2 };
+
+struct Section {
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t size;           // Whole image, header included.
+    std::uint64_t checksum;       // FNV-1a of bytes [sizeof(Header), size).
+    std::uint32_t key_type;       // KeyType.
+    std::uint32_t key_field;      // Field slot of the key, or kNone.
+    std::uint32_t default_action; // Action slot, or kNone.
+    std::uint32_t reserved;
+    Section rules;      // Rule, in evaluation order.
+    Section conditions; // Condition.
+    Section ints;       // std::int64_t operands.
+    Section strings;    // String operands and names.
+    Section bytes;      // char, referenced by String.
+    Section fields;     // std::uint32_t string id of each field slot's name.
+    Section actions;    // std::uint32_t string id of each action slot's name.
+    Section scan;       // std::uint32_t positions of rules not covered by the index.
+    Section segments;   // Segment, sorted by start (integer key).
+    Section hash;       // HashSlot, power-of-two count (string key).
+};
+
+struct Rule {
+    std::uint32_t source_index; // Position in the rule file.
+    std::int32_t priority;
+    std::uint32_t name;   // String id.
+    std::uint32_t action; // Action slot.
+    std::uint32_t first_condition;
+    std::uint32_t condition_count;
+};
+
+struct Condition {
+    std::uint32_t field; // Field slot.
+    std::uint8_t op;     // RuleOp.
+    std::uint8_t is_string;
+    std::uint16_t reserved;
+    std::uint32_t first_operand; // Into ints or strings; In operands are sorted.
+    std::uint32_t operand_count;
+};
+
+struct String {
+    std::uint64_t offset; // Into bytes.
+    std::uint64_t length;
+};
+
+// Values from `start` up to the next segment's start select rule `rule`
+// (a position in evaluation order, or kNone). Below the first start: none.
+struct Segment {
+    std::int64_t start;
+    std::uint32_t rule;
+    std::uint32_t reserved;
+};
+
+struct HashSlot {
+    std::uint64_t hash;
+    std::uint32_t string; // String id of the key, or kNone for an empty slot.
+    std::uint32_t rule;   // Position in evaluation order.
+};
+
+inline std::uint64_t fnv1a(const void* data, std::size_t size, std::uint64_t h = 0xcbf29ce484222325ull) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+} // namespace switch_image_format
+
+namespace switch_image_detail {
+
+namespace fmt = switch_image_format;
+
+// Collects sections while the image is built, then lays them out.
+class ImageWriter {
+public:
+    std::uint32_t intern(const std::string& s) {
+        auto it = string_ids_.find(s);
+        if (it != string_ids_.end()) return it->second;
+        std::uint32_t id = static_cast<std::uint32_t>(strings.size());
+        strings.push_back(fmt::String{bytes.size(), s.size()});
+        bytes.insert(bytes.end(), s.begin(), s.end());
+        string_ids_.emplace(s, id);
+        return id;
+    }
+
+    template <typename Slots>
+    static std::uint32_t slot(Slots& slots, std::vector<std::uint32_t>& names, std::uint32_t name) {
+        auto it = slots.find(name);
+        if (it != slots.end()) return it->second;
+        std::uint32_t s = static_cast<std::uint32_t>(names.size());
+        names.push_back(name);
+        slots.emplace(name, s);
+        return s;
+    }
+
+    std::vector<unsigned char> finish(fmt::Header header) {
+        std::vector<unsigned char> out(sizeof(fmt::Header));
+        header.rules = append(out, rules);
+        header.conditions = append(out, conditions);
+        header.ints = append(out, ints);
+        header.strings = append(out, strings);
+        header.bytes = append(out, bytes);
+        header.fields = append(out, fields);
+        header.actions = append(out, actions);
+        header.scan = append(out, scan);
+        header.segments = append(out, segments);
+        header.hash = append(out, hash);
+        std::memcpy(header.magic, fmt::kMagic, sizeof(header.magic));
+        header.version = fmt::kVersion;
+        header.byte_order = fmt::kByteOrder;
+        header.size = out.size();
+        header.checksum = fmt::fnv1a(out.data() + sizeof(fmt::Header), out.size() - sizeof(fmt::Header));
+        std::memcpy(out.data(), &header, sizeof(header));
+        return out;
+    }
+
+    std::vector<fmt::Rule> rules;
+    std::vector<fmt::Condition> conditions;
+    std::vector<std::int64_t> ints;
+    std::vector<fmt::String> strings;
+    std::vector<char> bytes;
+    std::vector<std::uint32_t> fields;
+    std::vector<std::uint32_t> actions;
+    std::vector<std::uint32_t> scan;
+    std::vector<fmt::Segment> segments;
+    std::vector<fmt::HashSlot> hash;
+
+private:
+    template <typename E>
+    static fmt::Section append(std::vector<unsigned char>& out, const std::vector<E>& items) {
+        out.resize((out.size() + 7) & ~std::size_t{7}, 0);
+        fmt::Section section{out.size(), items.size()};
+        const auto* p = reinterpret_cast<const unsigned char*>(items.data());
+        out.insert(out.end(), p, p + items.size() * sizeof(E));
+        return section;
+    }
+
+    std::unordered_map<std::string, std::uint32_t> string_ids_;
+};
+
+// Inclusive integer interval selected by a single key condition; false if the
+// condition cannot be expressed as one.
+inline bool key_interval(const RuleCondition& c, std::int64_t& lo, std::int64_t& hi) {
+    constexpr std::int64_t kMin = std::numeric_limits<std::int64_t>::min();
+    constexpr std::int64_t kMax = std::numeric_limits<std::int64_t>::max();
+    std::int64_t v = c.operands.empty() ? 0 : c.operands[0].number;
+    switch (c.op) {
+        case RuleOp::Eq: lo = hi = v; return true;
+        case RuleOp::Lt: if (v == kMin) return false; lo = kMin; hi = v - 1; return true;
+        case RuleOp::Le: lo = kMin; hi = v; return true;
+        case RuleOp::Gt: if (v == kMax) return false; lo = v + 1; hi = kMax; return true;
+        case RuleOp::Ge: lo = v; hi = kMax; return true;
+        case RuleOp::Range: lo = v; hi = c.operands[1].number; return lo <= hi;
+        default: return false;
+    }
+}
+
+// Flattens the integer key intervals (given in evaluation order) into
+// segments that each name the first rule covering them.
+inline std::vector<fmt::Segment> build_segments(
+        const std::vector<std::pair<std::uint32_t, std::pair<std::int64_t, std::int64_t>>>& intervals) {
+    constexpr std::int64_t kMax = std::numeric_limits<std::int64_t>::max();
+    std::vector<std::int64_t> bounds;
+    for (const auto& iv : intervals) {
+        bounds.push_back(iv.second.first);
+        if (iv.second.second != kMax) bounds.push_back(iv.second.second + 1);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    // Earlier rules claim segments first; `next` skips claimed segments.
+    std::vector<std::uint32_t> owner(bounds.size(), fmt::kNone);
+    std::vector<std::size_t> next(bounds.size() + 1);
+    std::iota(next.begin(), next.end(), 0);
+    auto find_next = [&](std::size_t i) {
+        std::size_t root = i;
+        while (next[root] != root) root = next[root];
+        while (next[i] != root) {
+            std::size_t n = next[i];
+            next[i] = root;
+            i = n;
+        }
+        return root;
+    };
+    for (const auto& iv : intervals) {
+        std::size_t first = static_cast<std::size_t>(
+            std::lower_bound(bounds.begin(), bounds.end(), iv.second.first) - bounds.begin());
+        std::size_t last = iv.second.second == kMax ? bounds.size()
+            : static_cast<std::size_t>(std::lower_bound(bounds.begin(), bounds.end(), iv.second.second + 1) - bounds.begin());
+        for (std::size_t s = find_next(first); s < last; s = find_next(s)) {
+            owner[s] = iv.first;
+            next[s] = s + 1;
+        }
+    }
+
+    std::vector<fmt::Segment> segments;
+    for (std::size_t s = 0; s < bounds.size(); ++s) {
+        if (!segments.empty() && segments.back().rule == owner[s]) continue;
+        if (segments.empty() && owner[s] == fmt::kNone) continue;
+        segments.push_back(fmt::Segment{bounds[s], owner[s], 0});
+    }
+    return segments;
+}
+
+} // namespace switch_image_detail
+
+// Builds an image of `rules`. Rules whose only condition is on `key_field`
+// (==, <, <=, >, >=, ranges and sets for integers; == and sets for strings)
+// go into the key index; all others are scanned in order. An empty
+// `key_field` builds no index. Throws RuleError if the key field is compared
+// with both integers and strings. Rules that can never match (see
+// check_reachability) are left out. If the rules are exhaustive (see
+// check_coverage), there is no default and the last rule, if scanned, has
+// no conditions to test. `reach` is check_reachability(rules).
+inline std::vector<unsigned char> build_switch_image(const RuleSet& rules, const std::string& key_field,
+                                                     const RuleReachability& reach) {
+    namespace fmt = switch_image_format;
+    switch_image_detail::ImageWriter w;
+    std::unordered_map<std::uint32_t, std::uint32_t> field_slots, action_slots;
+
+    // Evaluation order: by priority, then file order.
+    RuleCoverage coverage = check_coverage(rules, reach);
+    std::vector<std::uint32_t> order;
+    for (std::uint32_t i = 0; i < rules.rules.size(); ++i) {
+        if (!reach.dead(i)) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return rules.rules[a].priority < rules.rules[b].priority;
+    });
+
+    fmt::Header header{};
+    header.key_type = fmt::kNoKey;
+    header.key_field = fmt::kNone;
+    for (const Rule& rule : rules.rules) {
+        for (const RuleCondition& c : rule.conditions) {
+            if (key_field.empty() || c.field != key_field) continue;
+            std::uint32_t type = c.operands[0].is_string ? fmt::kStringKey : fmt::kIntKey;
+            if (header.key_type != fmt::kNoKey && header.key_type != type) {
+                throw RuleError(rule.line, "key field '" + key_field + "' compared with both integers and strings");
+            }
+            header.key_type = type;
+        }
+    }
+    if (header.key_type != fmt::kNoKey) {
+        header.key_field = w.slot(field_slots, w.fields, w.intern(key_field));
+    }
+
+    std::vector<std::pair<std::uint32_t, std::pair<std::int64_t, std::int64_t>>> intervals;
+    std::vector<std::pair<std::string, std::uint32_t>> string_keys;
+    for (std::uint32_t pos = 0; pos < order.size(); ++pos) {
+        const Rule& rule = rules.rules[order[pos]];
+        fmt::Rule r{};
+        r.source_index = order[pos];
+        r.priority = rule.priority;
+        r.name = w.intern(rule.name);
+        r.action = w.slot(action_slots, w.actions, w.intern(rule.action));
+        r.first_condition = static_cast<std::uint32_t>(w.conditions.size());
+        r.condition_count = static_cast<std::uint32_t>(rule.conditions.size());
+        for (const RuleCondition& c : rule.conditions) {
+            fmt::Condition cond{};
+            cond.field = w.slot(field_slots, w.fields, w.intern(c.field));
+            cond.op = static_cast<std::uint8_t>(c.op);
+            cond.is_string = c.operands[0].is_string ? 1 : 0;
+            cond.operand_count = static_cast<std::uint32_t>(c.operands.size());
+            if (cond.is_string) {
+                std::vector<std::string> texts;
+                for (const RuleLiteral& lit : c.operands) {
+                    if (!lit.is_string) throw RuleError(rule.line, "mixed operand types for '" + c.field + "'");
+                    texts.push_back(lit.text);
+                }
+                if (c.op == RuleOp::In) std::sort(texts.begin(), texts.end());
+                cond.first_operand = static_cast<std::uint32_t>(w.strings.size());
+                // Operands are consecutive string ids, so they are not interned.
+                for (const std::string& t : texts) {
+                    w.strings.push_back(fmt::String{w.bytes.size(), t.size()});
+                    w.bytes.insert(w.bytes.end(), t.begin(), t.end());
+                }
+            } else {
+                std::vector<std::int64_t> values;
+                for (const RuleLiteral& lit : c.operands) {
+                    if (lit.is_string) throw RuleError(rule.line, "mixed operand types for '" + c.field + "'");
+                    values.push_back(lit.number);
+                }
+                if (c.op == RuleOp::In) std::sort(values.begin(), values.end());
+                cond.first_operand = static_cast<std::uint32_t>(w.ints.size());
+                w.ints.insert(w.ints.end(), values.begin(), values.end());
+            }
+            w.conditions.push_back(cond);
+        }
+        w.rules.push_back(r);
+
+        // Index the rule if its only condition is on the key.
+        bool indexed = false;
+        if (rule.conditions.size() == 1 && header.key_type != fmt::kNoKey && rule.conditions[0].field == key_field) {
+            const RuleCondition& c = rule.conditions[0];
+            if (header.key_type == fmt::kIntKey) {
+                std::int64_t lo, hi;
+                if (c.op == RuleOp::In) {
+                    for (const RuleLiteral& lit : c.operands) intervals.push_back({pos, {lit.number, lit.number}});
+                    indexed = true;
+                } else if (switch_image_detail::key_interval(c, lo, hi)) {
+                    intervals.push_back({pos, {lo, hi}});
+                    indexed = true;
+                }
+            } else if (c.op == RuleOp::Eq || c.op == RuleOp::In) {
+                for (const RuleLiteral& lit : c.operands) string_keys.push_back({lit.text, pos});
+                indexed = true;
+            }
+        }
+        if (!indexed) w.scan.push_back(pos);
+        // Reached only when no other rule matched, so it matches.
+        if (!indexed && order[pos] == coverage.last_rule) w.rules.back().condition_count = 0;
+    }
+
+    if (header.key_type == fmt::kIntKey) {
+        w.segments = switch_image_detail::build_segments(intervals);
+    } else if (header.key_type == fmt::kStringKey && !string_keys.empty()) {
+        std::size_t capacity = 1;
+        while (capacity < 2 * string_keys.size()) capacity *= 2;
+        w.hash.assign(capacity, fmt::HashSlot{0, fmt::kNone, fmt::kNone});
+        for (const auto& key : string_keys) {
+            std::uint64_t h = fmt::fnv1a(key.first.data(), key.first.size());
+            for (std::size_t i = h & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+                fmt::HashSlot& slot = w.hash[i];
+                if (slot.string == fmt::kNone) {
+                    slot = fmt::HashSlot{h, w.intern(key.first), key.second};
+                    break;
+                }
+                // Keys arrive in evaluation order: the first rule wins.
+                const fmt::String& s = w.strings[slot.string];
+                if (slot.hash == h && std::string_view(w.bytes.data() + s.offset, s.length) == key.first) break;
+            }
+        }
+    }
+
+    header.default_action = rules.default_action.empty() || coverage.exhaustive
+        ? fmt::kNone : w.slot(action_slots, w.actions, w.intern(rules.default_action));
+    return w.finish(header);
+}
+
+inline std::vector<unsigned char> build_switch_image(const RuleSet& rules, const std::string& key_field = "value") {
+    return build_switch_image(rules, key_field, check_reachability(rules));
+}
+
+// Builds an image and writes it to `path`.
+inline void save_switch_image(const std::string& path, const RuleSet& rules, const std::string& key_field = "value") {
+    std::vector<unsigned char> image = build_switch_image(rules, key_field);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+    if (!out) throw SwitchImageError("cannot write switch image: " + path);
+}
+
+// A validated image, either mapped from a file or borrowed from memory.
+// Movable, not copyable; the mapping is released on destruction.
+class SwitchImage {
+public:
+    // Maps `path` read-only and shared. With `verify_checksum` false only the
+    // structure is checked, which avoids reading every page at startup.
+    static SwitchImage map_file(const std::string& path, bool verify_checksum = true) {
+        SwitchImage image;
+#if SWITCH_IMAGE_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw SwitchImageError("cannot open switch image: " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            throw SwitchImageError("cannot stat switch image: " + path);
+        }
+        void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) throw SwitchImageError("cannot map switch image: " + path);
+        image.data_ = static_cast<const unsigned char*>(p);
+        image.size_ = static_cast<std::size_t>(st.st_size);
+        image.mapped_ = true;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw SwitchImageError("cannot open switch image: " + path);
+        image.owned_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        image.data_ = reinterpret_cast<const unsigned char*>(image.owned_.data());
+        image.size_ = image.owned_.size();
+#endif
+        image.validate(verify_checksum);
+        return image;
+    }
+
+    // Uses an image already in memory (8-byte aligned); `data` must outlive
+    // the SwitchImage.
+    static SwitchImage from_memory(const void* data, std::size_t size, bool verify_checksum = true) {
+        SwitchImage image;
+        image.data_ = static_cast<const unsigned char*>(data);
+        image.size_ = size;
+        image.validate(verify_checksum);
+        return image;
+    }
+
+    SwitchImage(SwitchImage&& o) noexcept { *this = std::move(o); }
+    SwitchImage& operator=(SwitchImage&& o) noexcept {
+        if (this != &o) {
+            release();
+            data_ = std::exchange(o.data_, nullptr);
+            size_ = std::exchange(o.size_, 0);
+            mapped_ = std::exchange(o.mapped_, false);
+            owned_ = std::move(o.owned_);
+        }
+        return *this;
+    }
+    SwitchImage(const SwitchImage&) = delete;
+    SwitchImage& operator=(const SwitchImage&) = delete;
+    ~SwitchImage() { release(); }
+
+    const switch_image_format::Header& header() const {
+        return *reinterpret_cast<const switch_image_format::Header*>(data_);
+    }
+
+    template <typename E>
+    const E* section(const switch_image_format::Section& s) const {
+        return reinterpret_cast<const E*>(data_ + s.offset);
+    }
+
+    std::string_view string(std::uint32_t id) const {
+        const auto& s = section<switch_image_format::String>(header().strings)[id];
+        return std::string_view(section<char>(header().bytes) + s.offset, static_cast<std::size_t>(s.length));
+    }
+
+    // Rules stored in the image; rules that can never match are not.
+    std::size_t rule_count() const { return static_cast<std::size_t>(header().rules.count); }
+    std::size_t size_bytes() const { return size_; }
+
+private:
+    SwitchImage() = default;
+
+    void release() {
+#if SWITCH_IMAGE_HAS_MMAP
+        if (mapped_ && data_) ::munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+        data_ = nullptr;
+        mapped_ = false;
+    }
+
+    [[noreturn]] static void corrupt(const char* what) {
+        throw SwitchImageError(std::string("corrupt switch image: ") + what);
+    }
+
+    // Checks the header, that every section and every index stays inside the
+    // image, and optionally the checksum. Evaluation relies on this.
+    void validate(bool verify_checksum) {
+        namespace fmt = switch_image_format;
+        if (size_ < sizeof(fmt::Header) || reinterpret_cast<std::uintptr_t>(data_) % 8 != 0) corrupt("header");
+        const fmt::Header& h = header();
+        if (std::memcmp(h.magic, fmt::kMagic, sizeof(h.magic)) != 0) corrupt("magic");
+        if (h.byte_order != fmt::kByteOrder) throw SwitchImageError("switch image has the wrong byte order");
+        if (h.version != fmt::kVersion) {
+            throw SwitchImageError("unsupported switch image version " + std::to_string(h.version));
+        }
+        if (h.size != size_) corrupt("size");
+        auto check = [&](const fmt::Section& s, std::size_t element) {
+            if (s.offset % 8 != 0 || s.offset < sizeof(fmt::Header) || s.offset > size_ ||
+                s.count > (size_ - s.offset) / element) {
+                corrupt("section bounds");
+            }
+        };
+        check(h.rules, sizeof(fmt::Rule));
+        check(h.conditions, sizeof(fmt::Condition));
+        check(h.ints, sizeof(std::int64_t));
+        check(h.strings, sizeof(fmt::String));
+        check(h.bytes, 1);
+        check(h.fields, sizeof(std::uint32_t));
+        check(h.actions, sizeof(std::uint32_t));
+        check(h.scan, sizeof(std::uint32_t));
+        check(h.segments, sizeof(fmt::Segment));
+        check(h.hash, sizeof(fmt::HashSlot));
+        if (verify_checksum && fmt::fnv1a(data_ + sizeof(fmt::Header), size_ - sizeof(fmt::Header)) != h.checksum) {
+            corrupt("checksum mismatch");
+        }
+
+        const auto* strings = section<fmt::String>(h.strings);
+        for (std::uint64_t i = 0; i < h.strings.count; ++i) {
+            if (strings[i].offset > h.bytes.count || strings[i].length > h.bytes.count - strings[i].offset) corrupt("string");
+        }
+        auto check_ids = [&](const fmt::Section& s) {
+            const auto* ids = section<std::uint32_t>(s);
+            for (std::uint64_t i = 0; i < s.count; ++i) {
+                if (ids[i] >= h.strings.count) corrupt("name");
+            }
+        };
+        check_ids(h.fields);
+        check_ids(h.actions);
+        const auto* rules = section<fmt::Rule>(h.rules);
+        for (std::uint64_t i = 0; i < h.rules.count; ++i) {
+            const fmt::Rule& r = rules[i];
+            if (r.name >= h.strings.count || r.action >= h.actions.count || r.first_condition > h.conditions.count ||
+                r.condition_count > h.conditions.count - r.first_condition) {
+                corrupt("rule");
+            }
+        }
+        const auto* conditions = section<fmt::Condition>(h.conditions);
+        for (std::uint64_t i = 0; i < h.conditions.count; ++i) {
+            const fmt::Condition& c = conditions[i];
+            std::uint64_t pool = c.is_string ? h.strings.count : h.ints.count;
+            std::uint32_t needed = c.op == static_cast<std::uint8_t>(RuleOp::Range) ? 2 : 1;
+            if (c.field >= h.fields.count || c.op > static_cast<std::uint8_t>(RuleOp::Contains) ||
+                c.operand_count < needed || c.first_operand > pool || c.operand_count > pool - c.first_operand ||
+                (!c.is_string && c.op >= static_cast<std::uint8_t>(RuleOp::Prefix))) {
+                corrupt("condition");
+            }
+        }
+        const auto* scan = section<std::uint32_t>(h.scan);
+        for (std::uint64_t i = 0; i < h.scan.count; ++i) {
+            if (scan[i] >= h.rules.count) corrupt("scan list");
+        }
+        const auto* segments = section<fmt::Segment>(h.segments);
+        for (std::uint64_t i = 0; i < h.segments.count; ++i) {
+            if ((segments[i].rule != fmt::kNone && segments[i].rule >= h.rules.count) ||
+                (i > 0 && segments[i].start <= segments[i - 1].start)) {
+                corrupt("segment");
+            }
+        }
+        const auto* hash = section<fmt::HashSlot>(h.hash);
+        if (h.hash.count & (h.hash.count - 1)) corrupt("hash size");
+        bool has_empty = h.hash.count == 0;
+        for (std::uint64_t i = 0; i < h.hash.count; ++i) {
+            if (hash[i].string == fmt::kNone) {
+                has_empty = true;
+            } else if (hash[i].string >= h.strings.count || hash[i].rule >= h.rules.count) {
+                corrupt("hash slot");
+            }
+        }
+        if (!has_empty) corrupt("hash full");
+        bool keyed = h.key_type == fmt::kIntKey || h.key_type == fmt::kStringKey;
+        if ((keyed && h.key_field >= h.fields.count) || (!keyed && h.key_type != fmt::kNoKey) ||
+            (h.default_action != fmt::kNone && h.default_action >= h.actions.count)) {
+            corrupt("key or default");
+        }
+    }
+
+    const unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> owned_;
+};
+
+// Evaluates a SwitchImage in place against values of T. Only the field
+// getters and actions are resolved at construction (one entry per field and
+// action name); the tables are read directly from the image, which must
+// outlive this object. const and thread-safe like CompiledSwitch.
+template <typename T>
+class ImageSwitch {
+public:
+    using Action = typename RuleActions<T>::Action;
+    using Field = typename RuleSchema<T>::Field;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    ImageSwitch(const SwitchImage& image, const RuleSchema<T>& schema, const RuleActions<T>& actions)
+        : image_(&image), fields_(schema.fields()) {
+        namespace fmt = switch_image_format;
+        const fmt::Header& h = image.header();
+        const auto* field_names = image.section<std::uint32_t>(h.fields);
+        for (std::uint64_t i = 0; i < h.fields.count; ++i) {
+            const Field* f = schema.find(image.string(field_names[i]));
+            if (!f) throw SwitchImageError("unknown field '" + std::string(image.string(field_names[i])) + "'");
+            field_slots_.push_back(f);
+        }
+        const auto* action_names = image.section<std::uint32_t>(h.actions);
+        for (std::uint64_t i = 0; i < h.actions.count; ++i) {
+            std::string name(image.string(action_names[i]));
+            const Action* a = actions.find(name);
+            if (!a) throw SwitchImageError("unknown action '" + name + "'");
+            action_slots_.push_back(*a);
+        }
+        const auto* conditions = image.section<fmt::Condition>(h.conditions);
+        for (std::uint64_t i = 0; i < h.conditions.count; ++i) {
+            bool is_string = field_slots_[conditions[i].field]->type == RuleSchema<T>::Type::String;
+            if (is_string != (conditions[i].is_string != 0)) {
+                throw SwitchImageError("field '" + field_slots_[conditions[i].field]->name + "' has the wrong type");
+            }
+        }
+        if (h.key_type != fmt::kNoKey &&
+            (field_slots_[h.key_field]->type == RuleSchema<T>::Type::String) != (h.key_type == fmt::kStringKey)) {
+            throw SwitchImageError("key field '" + field_slots_[h.key_field]->name + "' has the wrong type");
+        }
+    }
+
+    // Index (in rule-file order) of the first matching rule, or npos.
+    std::size_t find(const T& value) const {
+        std::uint32_t pos = find_position(value);
+        if (pos == switch_image_format::kNone) return npos;
+        return image_->section<switch_image_format::Rule>(image_->header().rules)[pos].source_index;
+    }
+
+    // Runs the action of the first matching rule, or the default action.
+    // Returns true if a rule (not the default) matched.
+    bool evaluate(const T& value) const {
+        namespace fmt = switch_image_format;
+        const fmt::Header& h = image_->header();
+        std::uint32_t pos = find_position(value);
+        if (pos != fmt::kNone) {
+            action_slots_[image_->section<fmt::Rule>(h.rules)[pos].action](value);
+            return true;
+        }
+        if (h.default_action != fmt::kNone) action_slots_[h.default_action](value);
+        return false;
+    }
+
+private:
+    std::uint32_t find_position(const T& value) const {
+        namespace fmt = switch_image_format;
+        const fmt::Header& h = image_->header();
+        std::uint32_t best = fmt::kNone;
+        if (h.key_type == fmt::kIntKey && h.segments.count != 0) {
+            std::int64_t key = field_slots_[h.key_field]->get_int(value);
+            const auto* segments = image_->section<fmt::Segment>(h.segments);
+            const auto* end = segments + h.segments.count;
+            const auto* it = std::upper_bound(segments, end, key,
+                                              [](std::int64_t k, const fmt::Segment& s) { return k < s.start; });
+            if (it != segments) best = (it - 1)->rule;
+        } else if (h.key_type == fmt::kStringKey && h.hash.count != 0) {
+            std::string_view key = field_slots_[h.key_field]->get_string(value);
+            std::uint64_t hash = fmt::fnv1a(key.data(), key.size());
+            const auto* slots = image_->section<fmt::HashSlot>(h.hash);
+            std::uint64_t mask = h.hash.count - 1;
+            for (std::uint64_t i = hash & mask;; i = (i + 1) & mask) {
+                if (slots[i].string == fmt::kNone) break;
+                if (slots[i].hash == hash && image_->string(slots[i].string) == key) {
+                    best = slots[i].rule;
+                    break;
+                }
+            }
+        }
+        const auto* scan = image_->section<std::uint32_t>(h.scan);
+        const auto* rules = image_->section<fmt::Rule>(h.rules);
+        for (std::uint64_t i = 0; i < h.scan.count && scan[i] < best; ++i) {
+            if (matches(rules[scan[i]], value)) return scan[i];
+        }
+        return best;
+    }
+
+    bool matches(const switch_image_format::Rule& rule, const T& value) const {
+        const auto* conditions = image_->section<switch_image_format::Condition>(image_->header().conditions);
+        for (std::uint32_t c = 0; c < rule.condition_count; ++c) {
+            if (!holds(conditions[rule.first_condition + c], value)) return false;
+        }
+        return true;
+    }
+
+    bool holds(const switch_image_format::Condition& c, const T& value) const {
+        const Field* field = field_slots_[c.field];
+        auto op = static_cast<RuleOp>(c.op);
+        if (!c.is_string) {
+            std::int64_t v = field->get_int(value);
+            const std::int64_t* ops = image_->section<std::int64_t>(image_->header().ints) + c.first_operand;
+            switch (op) {
+                case RuleOp::Eq: return v == ops[0];
+                case RuleOp::Ne: return v != ops[0];
+                case RuleOp::Lt: return v < ops[0];
+                case RuleOp::Le: return v <= ops[0];
+                case RuleOp::Gt: return v > ops[0];
+                case RuleOp::Ge: return v >= ops[0];
+                case RuleOp::Range: return ops[0] <= v && v <= ops[1];
+                case RuleOp::In: return std::binary_search(ops, ops + c.operand_count, v);
+                default: return false;
+            }
+        }
+        std::string_view v = field->get_string(value);
+        auto operand = [&](std::uint32_t i) { return image_->string(c.first_operand + i); };
+        switch (op) {
+            case RuleOp::Eq: return v == operand(0);
+            case RuleOp::Ne: return v != operand(0);
+            case RuleOp::Lt: return v < operand(0);
+            case RuleOp::Le: return v <= operand(0);
+            case RuleOp::Gt: return v > operand(0);
+            case RuleOp::Ge: return v >= operand(0);
+            case RuleOp::Range: return operand(0) <= v && v <= operand(1);
+            case RuleOp::In: {
+                std::uint32_t lo = 0, hi = c.operand_count;
+                while (lo < hi) {
+                    std::uint32_t mid = lo + (hi - lo) / 2;
+                    if (operand(mid) < v) lo = mid + 1; else hi = mid;
+                }
+                return lo < c.operand_count && operand(lo) == v;
+            }
+            case RuleOp::Prefix: return v.substr(0, operand(0).size()) == operand(0);
+            case RuleOp::Contains: return v.find(operand(0)) != std::string_view::npos;
+        }
+        return false;
+    }
+
+    const SwitchImage* image_;
+    std::shared_ptr<const std::vector<Field>> fields_; // Keeps the getters alive.
+    std::vector<const Field*> field_slots_;
+    std::vector<Action> action_slots_;
+};
+
+#endif // SWITCH_IMAGE_HPP
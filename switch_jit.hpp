@@ -0,0 +1,471 @@
+#ifndef SWITCH_JIT_HPP
+#define SWITCH_JIT_HPP
+
+// x86-64 JIT for rule programs (see switch_bytecode.hpp).
+// Integer tests compile to native compare chains and unsigned range checks;
+// small dense sets become a bit test; runs of single-value rules on the same
+// field become a jump table. String tests and large sets call back into C++.
+// Code lives in mmap'ed memory that is made executable only after it has been
+// written (W^X). On Linux the code is registered in /tmp/perf-<pid>.map so
+// that perf attributes samples to it. On other architectures, or if
+// executable memory cannot be obtained, the bytecode interpreter is used.
+// Usage:
+//   JitSwitch<Order> sw(compile_bytecode(rules, schema), schema, actions);
+//   sw.evaluate(order);
+//   sw.jitted(); // false when running on the interpreter
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "switch_bytecode.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#include <sys/mman.h>
+#include <unistd.h>
+#define SWITCH_HAS_JIT 1
+#else
+#define SWITCH_HAS_JIT 0
+#endif
+
+struct JitOptions {
+    bool enable = true;      // false: always use the interpreter.
+    bool perf_map = true;    // Append the code range to /tmp/perf-<pid>.map (Linux).
+    std::string name = "switch_jit"; // Symbol name in the perf map.
+};
+
+namespace switch_jit_detail {
+
+// Minimal x86-64 encoder for the instructions the JIT needs. Registers:
+// rbx = int64 field array, r12 = callback context, rax/rcx = scratch.
+class Assembler {
+public:
+    std::vector<unsigned char> code;
+
+    void byte(unsigned b) { code.push_back(static_cast<unsigned char>(b)); }
+    void bytes(std::initializer_list<unsigned> bs) { for (unsigned b : bs) byte(b); }
+    void u32(std::uint32_t v) { for (int i = 0; i < 4; ++i) byte((v >> (8 * i)) & 0xff); }
+    void u64(std::uint64_t v) { for (int i = 0; i < 8; ++i) byte(static_cast<unsigned>((v >> (8 * i)) & 0xff)); }
+    std::size_t here() const { return code.size(); }
+
+    void prologue() {
+        bytes({0x53});                   // push rbx
+        bytes({0x41, 0x54});             // push r12
+        bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8 (16-byte aligned calls)
+        bytes({0x48, 0x89, 0xFB});       // mov rbx, rdi
+        bytes({0x49, 0x89, 0xF4});       // mov r12, rsi
+    }
+    void epilogue() {
+        bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+        bytes({0x41, 0x5C});             // pop r12
+        bytes({0x5B});                   // pop rbx
+        bytes({0xC3});                   // ret
+    }
+    void load_field(std::uint32_t slot) { bytes({0x48, 0x8B, 0x83}); u32(slot * 8); } // mov rax, [rbx + slot*8]
+    void mov_rcx(std::int64_t v) { bytes({0x48, 0xB9}); u64(static_cast<std::uint64_t>(v)); }
+    void mov_eax(std::uint32_t v) { byte(0xB8); u32(v); }
+    void sub_rax_rcx() { bytes({0x48, 0x29, 0xC8}); }
+    void cmp_rax_rcx() { bytes({0x48, 0x39, 0xC8}); }
+    void cmp_rax(std::int64_t v) {
+        if (v >= INT32_MIN && v <= INT32_MAX) {
+            bytes({0x48, 0x3D}); // cmp rax, imm32 (sign-extended)
+            u32(static_cast<std::uint32_t>(v));
+        } else {
+            mov_rcx(v);
+            cmp_rax_rcx();
+        }
+    }
+    // Condition codes for jcc.
+    enum Cond : unsigned { B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, A = 0x7, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF };
+    // Emits jcc/jmp with a zero rel32 and returns the offset of the rel32.
+    std::size_t jcc(Cond c) { bytes({0x0F, 0x80 + c}); u32(0); return here() - 4; }
+    std::size_t jmp() { byte(0xE9); u32(0); return here() - 4; }
+    void patch(std::size_t at, std::size_t target) {
+        std::int32_t rel = static_cast<std::int32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+    void call(const void* fn) {
+        bytes({0x4C, 0x89, 0xE7}); // mov rdi, r12
+        // esi is set by the caller (mov esi, imm32).
+        bytes({0x48, 0xB8});       // mov rax, imm64
+        u64(reinterpret_cast<std::uintptr_t>(fn));
+        bytes({0xFF, 0xD0});       // call rax
+        bytes({0x84, 0xC0});       // test al, al
+    }
+    void mov_esi(std::uint32_t v) { byte(0xBE); u32(v); }
+};
+
+} // namespace switch_jit_detail
+
+template <typename T>
+class JitSwitch {
+public:
+    using Action = typename RuleActions<T>::Action;
+    using Field = typename RuleSchema<T>::Field;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    static constexpr std::size_t kMaxFields = 64; // Programs with more fields are interpreted.
+
+    JitSwitch(SwitchProgram program, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+              JitOptions options = JitOptions())
+        : interpreter_(std::move(program), schema, actions) {
+        const SwitchProgram& p = interpreter_.program();
+        for (const std::string& name : p.fields) field_slots_.push_back(schema.find(name));
+        for (const std::string& name : p.actions) action_slots_.push_back(*actions.find(name));
+        for (std::size_t f = 0; f < p.fields.size(); ++f) {
+            if (!p.field_is_string[f]) int_fields_.push_back(static_cast<std::uint16_t>(f));
+        }
+        if (options.enable && p.fields.size() <= kMaxFields) compile(options);
+    }
+
+    ~JitSwitch() { release(); }
+
+    JitSwitch(const JitSwitch&) = delete;
+    JitSwitch& operator=(const JitSwitch&) = delete;
+
+    // Index (in rule-file order) of the first matching rule, or npos.
+    std::size_t find(const T& value) const {
+        if (!entry_) return interpreter_.find(value);
+        std::uint32_t rule = run(value);
+        return rule == switch_vm::kNone ? npos : rule;
+    }
+
+    // Runs the action of the first matching rule, or the default action.
+    // Returns true if a rule (not the default) matched.
+    bool evaluate(const T& value) const {
+        if (!entry_) return interpreter_.evaluate(value);
+        std::uint32_t rule = run(value);
+        const SwitchProgram& p = program();
+        if (rule != switch_vm::kNone) {
+            action_slots_[p.rule_actions[rule]](value);
+            return true;
+        }
+        if (p.default_action != switch_vm::kNone) action_slots_[p.default_action](value);
+        return false;
+    }
+
+    bool jitted() const { return entry_ != nullptr; }
+    std::size_t code_size() const { return code_size_; }
+    const SwitchProgram& program() const { return interpreter_.program(); }
+
+private:
+    using Entry = std::uint32_t (*)(const std::int64_t* fields, const void* context);
+
+    struct CallContext {
+        const JitSwitch* self;
+        const T* value;
+    };
+
+    std::uint32_t run(const T& value) const {
+        // Integer fields are read up front; the generated code reads them
+        // from this array.
+        std::int64_t fields[kMaxFields];
+        for (std::uint16_t f : int_fields_) fields[f] = field_slots_[f]->get_int(value);
+        CallContext context{this, &value};
+        return entry_(fields, &context);
+    }
+
+    // Called from generated code for tests it does not compile natively.
+    static bool callback(const CallContext* context, std::uint32_t pc) {
+        const JitSwitch& self = *context->self;
+        return self.test(self.program().code[pc], self.pc_fields_[pc], *context->value);
+    }
+
+    bool test(const switch_vm::Instr& in, std::uint16_t field, const T& value) const {
+        using switch_vm::Op;
+        const SwitchProgram& p = program();
+        const Field* f = field_slots_[field];
+        auto str = [&](std::int64_t i) -> const std::string& { return p.strings[static_cast<std::size_t>(i)]; };
+        if (!p.field_is_string[field]) {
+            std::int64_t v = f->get_int(value);
+            const std::int64_t* first = p.ints.data() + in.a;
+            return std::binary_search(first, first + in.b, v); // Only sets are called back.
+        }
+        std::string_view v = f->get_string(value);
+        switch (in.op) {
+            case Op::StrEq: case Op::FieldStrEq: return v == str(in.a);
+            case Op::StrNe: return v != str(in.a);
+            case Op::StrLt: return v < str(in.a);
+            case Op::StrLe: return v <= str(in.a);
+            case Op::StrGt: return v > str(in.a);
+            case Op::StrGe: return v >= str(in.a);
+            case Op::StrRange: return str(in.a) <= v && v <= str(in.b);
+            case Op::StrIn: {
+                const std::string* first = p.strings.data() + in.a;
+                return std::binary_search(first, first + in.b, v, [](const auto& x, const auto& y) {
+                    return std::string_view(x) < std::string_view(y);
+                });
+            }
+            case Op::StrPrefix: case Op::FieldStrPrefix: return v.substr(0, str(in.a).size()) == str(in.a);
+            case Op::StrContains: case Op::FieldStrContains: return v.find(str(in.a)) != std::string_view::npos;
+            default: return false;
+        }
+    }
+
+#if SWITCH_HAS_JIT
+    static bool is_test(switch_vm::Op op) {
+        return op != switch_vm::Op::LoadInt && op != switch_vm::Op::LoadStr && op != switch_vm::Op::Match &&
+               op != switch_vm::Op::Halt;
+    }
+    static bool is_int_eq_or_in(switch_vm::Op op) {
+        using switch_vm::Op;
+        return op == Op::IntEq || op == Op::FieldEq || op == Op::IntIn || op == Op::FieldIn;
+    }
+    // Whether the test at `pc` is the first of its rule (only loads before
+    // it since the previous Match).
+    bool starts_rule(std::size_t pc) const {
+        using switch_vm::Op;
+        const auto& code = program().code;
+        while (pc > 0 && (code[pc - 1].op == Op::LoadInt || code[pc - 1].op == Op::LoadStr)) --pc;
+        return pc == 0 || code[pc - 1].op == Op::Match;
+    }
+
+    void compile(const JitOptions& options) {
+        using switch_vm::Op;
+        using A = switch_jit_detail::Assembler;
+        const SwitchProgram& p = program();
+        const auto& code = p.code;
+
+        // Field read by each instruction; registers are resolved through the
+        // Load that last wrote them (programs only jump forward to rule starts).
+        pc_fields_.assign(code.size(), 0);
+        std::uint16_t reg_field[2][switch_vm::kRegisters] = {};
+        for (std::size_t pc = 0; pc < code.size(); ++pc) {
+            const auto& in = code[pc];
+            if (in.op == Op::LoadInt || in.op == Op::LoadStr) {
+                reg_field[in.op == Op::LoadStr][in.reg] = in.field;
+            } else if (in.op >= Op::FieldEq) {
+                pc_fields_[pc] = in.field;
+            } else if (in.op >= Op::StrEq) {
+                pc_fields_[pc] = reg_field[1][in.reg];
+            } else {
+                pc_fields_[pc] = reg_field[0][in.reg];
+            }
+        }
+
+        A a;
+        a.prologue();
+        std::vector<std::size_t> native(code.size() + 1, 0);    // Native offset of each pc.
+        std::vector<std::pair<std::size_t, std::size_t>> fixups; // (rel32 offset, target pc)
+        std::vector<std::size_t> to_epilogue;
+        struct Table { std::size_t lea; std::size_t start; std::vector<std::size_t> targets; };
+        std::vector<Table> tables;
+
+        for (std::size_t pc = 0; pc < code.size();) {
+            native[pc] = a.here();
+            const auto& in = code[pc];
+
+            // A run of single-test rules comparing the same field with
+            // constants becomes one jump table. The run must start a rule:
+            // the failing tests of a rule before it jump to the table too,
+            // and must not find that rule's values there.
+            if (is_int_eq_or_in(in.op) && starts_rule(pc)) {
+                std::size_t end = pc;
+                std::int64_t lo = INT64_MAX, hi = INT64_MIN;
+                std::size_t values = 0;
+                while (end + 1 < code.size() && is_int_eq_or_in(code[end].op) && code[end + 1].op == Op::Match &&
+                       code[end].target == end + 2 && pc_fields_[end] == pc_fields_[pc]) {
+                    const auto& t = code[end];
+                    bool is_set = t.op == Op::IntIn || t.op == Op::FieldIn;
+                    for (std::int64_t i = 0; i < (is_set ? t.b : 1); ++i) {
+                        std::int64_t v = is_set ? p.ints[static_cast<std::size_t>(t.a + i)] : t.a;
+                        lo = std::min(lo, v);
+                        hi = std::max(hi, v);
+                        ++values;
+                    }
+                    end += 2;
+                }
+                std::size_t rules = (end - pc) / 2;
+                std::uint64_t width = static_cast<std::uint64_t>(hi) - static_cast<std::uint64_t>(lo);
+                if (rules >= 4 && width < 4096 && width < 4 * values) {
+                    std::size_t span = static_cast<std::size_t>(width) + 1;
+                    Table table{0, 0, std::vector<std::size_t>(span, end)};
+                    // Later rules first, so the first rule for a value wins.
+                    for (std::size_t r = end; r > pc; r -= 2) {
+                        const auto& t = code[r - 2];
+                        bool is_set = t.op == Op::IntIn || t.op == Op::FieldIn;
+                        for (std::int64_t i = 0; i < (is_set ? t.b : 1); ++i) {
+                            std::int64_t v = is_set ? p.ints[static_cast<std::size_t>(t.a + i)] : t.a;
+                            table.targets[static_cast<std::size_t>(static_cast<std::uint64_t>(v) - static_cast<std::uint64_t>(lo))] = r - 1; // The Match.
+                        }
+                    }
+                    a.load_field(pc_fields_[pc]);
+                    a.mov_rcx(lo);
+                    a.sub_rax_rcx();
+                    a.mov_rcx(static_cast<std::int64_t>(span - 1));
+                    a.cmp_rax_rcx();
+                    fixups.push_back({a.jcc(A::A), end});
+                    a.bytes({0x48, 0x8D, 0x0D}); // lea rcx, [rip + table]
+                    table.lea = a.here();
+                    a.u32(0);
+                    a.bytes({0x48, 0x63, 0x04, 0x81}); // movsxd rax, dword [rcx + rax*4]
+                    a.bytes({0x48, 0x01, 0xC8});       // add rax, rcx
+                    a.bytes({0xFF, 0xE0});             // jmp rax
+                    while (a.here() % 4) a.byte(0xCC);
+                    table.start = a.here();
+                    for (std::size_t i = 0; i < span; ++i) a.u32(0);
+                    tables.push_back(std::move(table));
+                    // The Match instructions of the run are emitted below.
+                    for (std::size_t r = pc; r < end; r += 2) native[r] = native[pc];
+                    for (std::size_t r = pc + 1; r < end; r += 2) {
+                        native[r] = a.here();
+                        a.mov_eax(code[r].target);
+                        to_epilogue.push_back(a.jmp());
+                    }
+                    pc = end;
+                    continue;
+                }
+            }
+
+            switch (in.op) {
+                case Op::LoadInt: case Op::LoadStr: break; // Fields are read by the caller or the callback.
+                case Op::Match:
+                    a.mov_eax(in.target);
+                    to_epilogue.push_back(a.jmp());
+                    break;
+                case Op::Halt:
+                    a.mov_eax(switch_vm::kNone);
+                    to_epilogue.push_back(a.jmp());
+                    break;
+                case Op::IntEq: case Op::FieldEq: emit_compare(a, pc, A::NE, fixups); break;
+                case Op::IntNe: case Op::FieldNe: emit_compare(a, pc, A::E, fixups); break;
+                case Op::IntLt: case Op::FieldLt: emit_compare(a, pc, A::GE, fixups); break;
+                case Op::IntLe: case Op::FieldLe: emit_compare(a, pc, A::G, fixups); break;
+                case Op::IntGt: case Op::FieldGt: emit_compare(a, pc, A::LE, fixups); break;
+                case Op::IntGe: case Op::FieldGe: emit_compare(a, pc, A::L, fixups); break;
+                case Op::IntRange: case Op::FieldRange:
+                    // Unsigned (v - lo) <= (hi - lo) checks both bounds at once.
+                    if (in.b < in.a) {
+                        fixups.push_back({a.jmp(), in.target});
+                        break;
+                    }
+                    a.load_field(pc_fields_[pc]);
+                    a.mov_rcx(in.a);
+                    a.sub_rax_rcx();
+                    a.mov_rcx(static_cast<std::int64_t>(static_cast<std::uint64_t>(in.b) - static_cast<std::uint64_t>(in.a)));
+                    a.cmp_rax_rcx();
+                    fixups.push_back({a.jcc(A::A), in.target});
+                    break;
+                case Op::IntIn: case Op::FieldIn:
+                    emit_set(a, pc, fixups);
+                    break;
+                default:
+                    a.mov_esi(static_cast<std::uint32_t>(pc));
+                    a.call(reinterpret_cast<const void*>(&JitSwitch::callback));
+                    fixups.push_back({a.jcc(A::E), in.target}); // al == 0: test failed.
+            }
+            ++pc;
+        }
+        native[code.size()] = a.here();
+        std::size_t epilogue = a.here();
+        a.epilogue();
+
+        for (const auto& f : fixups) a.patch(f.first, native[f.second]);
+        for (std::size_t at : to_epilogue) a.patch(at, epilogue);
+        for (const Table& t : tables) {
+            a.patch(t.lea, t.start);
+            for (std::size_t i = 0; i < t.targets.size(); ++i) {
+                std::int32_t rel = static_cast<std::int32_t>(static_cast<std::int64_t>(native[t.targets[i]]) -
+                                                             static_cast<std::int64_t>(t.start));
+                std::memcpy(&a.code[t.start + 4 * i], &rel, 4);
+            }
+        }
+        install(a.code, options);
+    }
+
+    void emit_compare(switch_jit_detail::Assembler& a, std::size_t pc, switch_jit_detail::Assembler::Cond fail,
+                      std::vector<std::pair<std::size_t, std::size_t>>& fixups) {
+        const auto& in = program().code[pc];
+        a.load_field(pc_fields_[pc]);
+        a.cmp_rax(in.a);
+        fixups.push_back({a.jcc(fail), in.target});
+    }
+
+    void emit_set(switch_jit_detail::Assembler& a, std::size_t pc, std::vector<std::pair<std::size_t, std::size_t>>& fixups) {
+        using A = switch_jit_detail::Assembler;
+        const auto& in = program().code[pc];
+        const std::int64_t* values = program().ints.data() + in.a;
+        std::int64_t lo = values[0], hi = values[in.b - 1]; // Sorted.
+        a.load_field(pc_fields_[pc]);
+        if (static_cast<std::uint64_t>(hi) - static_cast<std::uint64_t>(lo) < 64) {
+            // Bit test: bit (v - lo) of a 64-bit mask.
+            std::uint64_t mask = 0;
+            for (std::int64_t i = 0; i < in.b; ++i) mask |= std::uint64_t{1} << (static_cast<std::uint64_t>(values[i]) - static_cast<std::uint64_t>(lo));
+            a.mov_rcx(lo);
+            a.sub_rax_rcx();
+            a.bytes({0x48, 0x83, 0xF8, 0x3F}); // cmp rax, 63
+            fixups.push_back({a.jcc(A::A), in.target});
+            a.mov_rcx(static_cast<std::int64_t>(mask));
+            a.bytes({0x48, 0x0F, 0xA3, 0xC1}); // bt rcx, rax
+            fixups.push_back({a.jcc(A::AE), in.target}); // CF = 0: not in the set.
+        } else if (in.b <= 8) {
+            std::vector<std::size_t> hits;
+            for (std::int64_t i = 0; i < in.b; ++i) {
+                a.cmp_rax(values[i]);
+                hits.push_back(a.jcc(A::E));
+            }
+            fixups.push_back({a.jmp(), in.target});
+            for (std::size_t h : hits) a.patch(h, a.here());
+        } else {
+            a.mov_esi(static_cast<std::uint32_t>(pc));
+            a.call(reinterpret_cast<const void*>(&JitSwitch::callback));
+            fixups.push_back({a.jcc(A::E), in.target});
+        }
+    }
+
+    void install(const std::vector<unsigned char>& code, const JitOptions& options) {
+        std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t size = (code.size() + page - 1) / page * page;
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return;
+        std::memcpy(mem, code.data(), code.size());
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, size);
+            return;
+        }
+        memory_ = mem;
+        memory_size_ = size;
+        code_size_ = code.size();
+        entry_ = reinterpret_cast<Entry>(mem);
+#if defined(__linux__)
+        if (options.perf_map) {
+            std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+            if (FILE* f = std::fopen(path.c_str(), "a")) {
+                std::fprintf(f, "%lx %lx %s\n", static_cast<unsigned long>(reinterpret_cast<std::uintptr_t>(mem)),
+                             static_cast<unsigned long>(code.size()), options.name.c_str());
+                std::fclose(f);
+            }
+        }
+#else
+        (void)options;
+#endif
+    }
+
+    void release() {
+        if (memory_) munmap(memory_, memory_size_);
+        memory_ = nullptr;
+        entry_ = nullptr;
+    }
+#else
+    void compile(const JitOptions&) {}
+    void release() {}
+#endif
+
+    BytecodeSwitch<T> interpreter_;
+    std::vector<const Field*> field_slots_;
+    std::vector<Action> action_slots_;
+    std::vector<std::uint16_t> int_fields_;
+    std::vector<std::uint16_t> pc_fields_;
+    Entry entry_ = nullptr;
+    void* memory_ = nullptr;
+    std::size_t memory_size_ = 0;
+    std::size_t code_size_ = 0;
+};
+
+#endif // SWITCH_JIT_HPP
@@ -0,0 +1,92 @@
+#ifndef SWITCH_MATCH_HPP
+#define SWITCH_MATCH_HPP
+
+// Case conditions that CompiledSwitch can see into.
+// A SwitchMatch is either a structured condition (equality, inclusive range,
+// set membership), which CompiledSwitch indexes in a hash table or an
+// interval map, or an opaque predicate, which it has to call.
+// Usage:
+//   using M = SwitchMatch<int>;
+//   sw.add_case(M::equals(7), action);
+//   sw.add_case(M::between(10, 20), action);
+//   sw.add_case(M::one_of({1, 2, 3}), action);
+//   sw.add_case([](const int& v) { return v % 2 == 0; }, action); // opaque
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SwitchMatch {
+public:
+    using Predicate = std::function<bool(const T&)>;
+
+    enum class Kind { Equals, Between, OneOf, Opaque };
+
+    // Opaque condition: any callable taking const T& and returning bool.
+    template <typename F,
+              typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, SwitchMatch> &&
+                                          std::is_invocable_r_v<bool, F&, const T&>>>
+    SwitchMatch(F predicate) : kind_(Kind::Opaque), predicate_(std::move(predicate)) {}
+
+    // value == v
+    static SwitchMatch equals(T v) {
+        SwitchMatch m(Kind::Equals, {std::move(v)});
+        m.predicate_ = [v = m.values_[0]](const T& value) { return value == v; };
+        return m;
+    }
+
+    // lo <= value && value <= hi
+    static SwitchMatch between(T lo, T hi) {
+        SwitchMatch m(Kind::Between, {std::move(lo), std::move(hi)});
+        m.predicate_ = [lo = m.values_[0], hi = m.values_[1]](const T& value) {
+            return !(value < lo) && !(hi < value);
+        };
+        return m;
+    }
+
+    // value equals one of `vs`
+    static SwitchMatch one_of(std::vector<T> vs) {
+        SwitchMatch m(Kind::OneOf, std::move(vs));
+        m.predicate_ = [vs = m.values_](const T& value) {
+            for (const T& v : vs) {
+                if (value == v) return true;
+            }
+            return false;
+        };
+        return m;
+    }
+
+    bool operator()(const T& value) const { return predicate_(value); }
+
+    // Whether no value satisfies both conditions, so that cases with them
+    // can be tried in either order. false if either one is opaque.
+    static bool disjoint(const SwitchMatch& a, const SwitchMatch& b) {
+        if (a.kind_ == Kind::Opaque || b.kind_ == Kind::Opaque) return false;
+        if (a.kind_ == Kind::Between && b.kind_ == Kind::Between) return a.high() < b.low() || b.high() < a.low();
+        // A set against a range or another set: test its values.
+        const SwitchMatch& set = a.kind_ == Kind::Between ? b : a;
+        const SwitchMatch& other = a.kind_ == Kind::Between ? a : b;
+        for (const T& v : set.values_) {
+            if (other(v)) return false;
+        }
+        return true;
+    }
+
+    Kind kind() const { return kind_; }
+    // Equals: {v}; Between: {lo, hi}; OneOf: the set; Opaque: empty.
+    const std::vector<T>& values() const { return values_; }
+    const T& low() const { return values_.front(); }
+    const T& high() const { return values_.back(); }
+    const Predicate& predicate() const { return predicate_; }
+
+private:
+    SwitchMatch(Kind kind, std::vector<T> values) : kind_(kind), values_(std::move(values)) {}
+
+    Kind kind_;
+    std::vector<T> values_;
+    Predicate predicate_;
+};
+
+#endif // SWITCH_MATCH_HPP
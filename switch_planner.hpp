@@ -0,0 +1,589 @@
+#ifndef SWITCH_PLANNER_HPP
+#define SWITCH_PLANNER_HPP
+
+// Picks the rule engine expected to be fastest for a rule set on this machine.
+// The planner combines an analysis of the rule set (how many rules, which
+// conditions can be indexed on the key field, integer vs string tests) with
+// per-operation costs measured by a short calibration run: a std::function
+// call, integer and string tests in bytecode and in native code, a
+// binary-search step and a hash probe. Calibration takes a few tens of
+// milliseconds. It runs once per process and is cached on disk per CPU
+// model and compiler.
+// Usage:
+//   PlannedSwitch<Order> sw(parse_rule_file("rules.txt"), schema, actions, "customer");
+//   sw.evaluate(order);
+//   sw.plan().strategy; // RuleStrategy::Jit, ...
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compiled_switch.hpp"
+#include "switch_bytecode.hpp"
+#include "switch_image.hpp"
+#include "switch_jit.hpp"
+#include "switch_rules.hpp"
+#include "switch_timing.hpp"
+
+struct SwitchExplanation; // switch_explain.hpp
+
+enum class RuleStrategy { Compiled, Bytecode, Jit, Image };
+
+constexpr std::size_t kRuleStrategies = 4;
+
+inline const char* strategy_name(RuleStrategy s) {
+    static const char* const names[] = {"compiled", "bytecode", "jit", "image"};
+    return names[static_cast<std::size_t>(s)];
+}
+
+// Machine-specific costs in ns per operation.
+struct SwitchCalibration {
+    static constexpr int kVersion = 3;
+
+    std::string machine;              // CPU model and compiler the costs were measured with.
+    double function_call_ns = 0;      // One std::function call (predicates, field getters).
+    double vm_test_ns = 0;            // One bytecode integer test that fails, moving to the next rule.
+    double vm_string_test_ns = 0;     // The same for a string test on a field loaded at entry.
+    double native_test_ns = 0;        // One JIT compare-and-branch; 0 without a JIT.
+    double native_string_test_ns = 0; // One JIT string test: a call back into C++ that reads the field.
+    double search_step_ns = 0;   // One step of an image key lookup (binary search over segments).
+    double hash_probe_ns = 0;    // Hashing a short string and one probe.
+    double cycles_per_ns = 0;    // Cycle-counter rate; 0 where there is none.
+
+    // Runs the microbenchmarks.
+    static SwitchCalibration measure();
+
+    // Reads `path`; false if it is missing, from another version or from
+    // another machine.
+    bool load(const std::string& path);
+    // Writes `path`, creating its directory; false on failure.
+    bool save(const std::string& path) const;
+
+    // $SWITCH_CALIBRATION_FILE, else $XDG_CACHE_HOME/custom_switch/calibration,
+    // else ~/.cache/custom_switch/calibration; empty if none is set.
+    static std::string default_path();
+
+    // Loads `path`, or measures and saves it if that fails.
+    static SwitchCalibration cached(const std::string& path = default_path());
+
+    static std::string current_machine();
+};
+
+// Calibration for this process: cached() on first use, then reused.
+inline const SwitchCalibration& switch_calibration() {
+    static const SwitchCalibration calibration = SwitchCalibration::cached();
+    return calibration;
+}
+
+// What the planner knows about a rule set.
+struct RuleSetProfile {
+    std::size_t rules = 0;            // Rules that can match; the rest are not counted below.
+    std::size_t dead_rules = 0;       // Never match (see check_reachability); compiled out.
+    std::size_t conditions = 0;
+    std::size_t int_conditions = 0;
+    std::size_t string_conditions = 0;
+    std::size_t first_string = 0;     // Rules whose first test is on a string.
+    // Tests after the first, per rule tried: each is counted with the odds
+    // that the first test passes (see analyze_rules).
+    double later_int_tests = 0;
+    double later_string_tests = 0;
+    std::size_t fields = 0;           // Distinct fields tested.
+    std::size_t int_fields = 0;
+    std::size_t key_indexed = 0;      // Rules the image indexes on the key field.
+    std::size_t value_indexed = 0;    // Rules CompiledSwitch indexes (single test on "value").
+    bool string_key = false;
+    std::size_t key_intervals = 0;    // Points and ranges on an integer key.
+    double key_density = 0;           // Distinct key points / span of the points (1: dense).
+    std::size_t table_rules = 0;      // Rules the JIT folds into jump tables.
+    std::size_t tables = 0;
+};
+
+struct SwitchPlan {
+    RuleStrategy strategy = RuleStrategy::Compiled;
+    RuleSetProfile profile;
+    std::array<bool, kRuleStrategies> available{};
+    std::array<double, kRuleStrategies> estimated_ns{}; // Per evaluation.
+};
+
+// Rules whose first tests are on the same field are assumed to split its
+// values between them, as keys usually do: the first test of such a rule
+// passes with odds 1 / (number of those rules), and only then are its other
+// tests run. `reach` is check_reachability(rules).
+inline RuleSetProfile analyze_rules(const RuleSet& rules, const std::string& key_field, const RuleReachability& reach) {
+    RuleSetProfile p;
+    p.dead_rules = reach.dead_count();
+    p.rules = rules.rules.size() - p.dead_rules;
+    std::set<std::string> fields, int_fields;
+    std::set<std::int64_t> points;
+    std::unordered_map<std::string, std::size_t> first_fields;
+    for (std::size_t index = 0; index < rules.rules.size(); ++index) {
+        if (!reach.dead(index) && !rules.rules[index].conditions.empty()) ++first_fields[rules.rules[index].conditions[0].field];
+    }
+    for (std::size_t index = 0; index < rules.rules.size(); ++index) {
+        if (reach.dead(index)) continue;
+        const Rule& rule = rules.rules[index];
+        double pass = rule.conditions.empty() ? 0 : 1.0 / static_cast<double>(first_fields[rule.conditions[0].field]);
+        for (std::size_t i = 0; i < rule.conditions.size(); ++i) {
+            const RuleCondition& c = rule.conditions[i];
+            bool is_string = !c.operands.empty() && c.operands[0].is_string;
+            ++p.conditions;
+            ++(is_string ? p.string_conditions : p.int_conditions);
+            if (i == 0 && is_string) ++p.first_string;
+            if (i > 0) (is_string ? p.later_string_tests : p.later_int_tests) += pass;
+            fields.insert(c.field);
+            if (!is_string) int_fields.insert(c.field);
+        }
+        if (rule.conditions.size() != 1) continue;
+        const RuleCondition& c = rule.conditions[0];
+        bool is_string = !c.operands.empty() && c.operands[0].is_string;
+        if (c.field == "value" && c.op != RuleOp::Ne && c.op != RuleOp::Prefix && c.op != RuleOp::Contains &&
+            (!is_string || c.op == RuleOp::Eq || c.op == RuleOp::In)) {
+            ++p.value_indexed;
+        }
+        if (key_field.empty() || c.field != key_field) continue;
+        std::int64_t lo, hi;
+        if (is_string) {
+            if (c.op != RuleOp::Eq && c.op != RuleOp::In) continue;
+            p.string_key = true;
+        } else if (c.op == RuleOp::In) {
+            for (const RuleLiteral& lit : c.operands) points.insert(lit.number);
+            p.key_intervals += c.operands.size();
+        } else if (switch_image_detail::key_interval(c, lo, hi)) {
+            if (lo == hi) points.insert(lo);
+            ++p.key_intervals;
+        } else {
+            continue;
+        }
+        ++p.key_indexed;
+    }
+    // Runs of single-test integer rules on one field, as switch_jit.hpp
+    // turns them into jump tables (evaluation order: priority, then file).
+    std::vector<const Rule*> order;
+    for (std::size_t index = 0; index < rules.rules.size(); ++index) {
+        if (!reach.dead(index)) order.push_back(&rules.rules[index]);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const Rule* a, const Rule* b) { return a->priority < b->priority; });
+    auto table_test = [](const Rule* r) {
+        return r->conditions.size() == 1 && (r->conditions[0].op == RuleOp::Eq || r->conditions[0].op == RuleOp::In) &&
+               !r->conditions[0].operands.empty() && !r->conditions[0].operands[0].is_string;
+    };
+    for (std::size_t i = 0; i < order.size();) {
+        std::size_t j = i;
+        std::int64_t lo = 0, hi = 0;
+        std::size_t values = 0;
+        while (j < order.size() && table_test(order[j]) && order[j]->conditions[0].field == order[i]->conditions[0].field) {
+            for (const RuleLiteral& lit : order[j]->conditions[0].operands) {
+                lo = values ? std::min(lo, lit.number) : lit.number;
+                hi = values ? std::max(hi, lit.number) : lit.number;
+                ++values;
+            }
+            ++j;
+        }
+        std::uint64_t width = static_cast<std::uint64_t>(hi) - static_cast<std::uint64_t>(lo);
+        if (j - i >= 4 && width < 4096 && width < 4 * values) {
+            p.table_rules += j - i;
+            ++p.tables;
+        }
+        i = std::max(j, i + 1);
+    }
+
+    if (p.rules) {
+        p.later_int_tests /= static_cast<double>(p.rules);
+        p.later_string_tests /= static_cast<double>(p.rules);
+    }
+    p.fields = fields.size();
+    p.int_fields = int_fields.size();
+    if (!points.empty()) {
+        double span = static_cast<double>(*points.rbegin()) - static_cast<double>(*points.begin()) + 1;
+        p.key_density = static_cast<double>(points.size()) / span;
+    }
+    return p;
+}
+
+inline RuleSetProfile analyze_rules(const RuleSet& rules, const std::string& key_field) {
+    return analyze_rules(rules, key_field, check_reachability(rules));
+}
+
+// Estimates the cost of each engine from the profile and the calibration
+// and picks the cheapest. The model assumes an evaluation tries half of the
+// candidate rules. Each rule tried runs its first test, and its later tests
+// only as often as the first one passes.
+inline SwitchPlan plan_rules(const RuleSetProfile& profile, const SwitchCalibration& cal) {
+    SwitchPlan plan;
+    plan.profile = profile;
+    const RuleSetProfile& p = profile;
+    double rules = static_cast<double>(p.rules);
+    double first_string = p.rules == 0 ? 0 : static_cast<double>(p.first_string) / rules;
+    // Tests per rule tried, by kind.
+    double int_tests = 1 - first_string + p.later_int_tests;
+    double string_tests = first_string + p.later_string_tests;
+    double per_rule = int_tests + string_tests;
+    double vm_rule = int_tests * cal.vm_test_ns + string_tests * cal.vm_string_test_ns;
+    double fcall = cal.function_call_ns;
+
+    auto set = [&](RuleStrategy s, double ns) {
+        plan.available[static_cast<std::size_t>(s)] = true;
+        plan.estimated_ns[static_cast<std::size_t>(s)] = ns;
+    };
+
+    // CompiledSwitch: opaque rules are std::function calls that read fields
+    // through getters, indexed rules cost one lookup.
+    double opaque = rules - static_cast<double>(p.value_indexed);
+    set(RuleStrategy::Compiled, (p.value_indexed ? cal.hash_probe_ns : 0) + 0.5 * opaque * (fcall + per_rule * fcall + vm_rule));
+
+    // Bytecode: fields are read once at entry, then one dispatch per test.
+    set(RuleStrategy::Bytecode, static_cast<double>(p.fields) * fcall + 0.5 * rules * vm_rule);
+
+    // JIT: integer fields are read up front; string tests call back; a
+    // jump table costs a few instructions however many rules it holds.
+    if (cal.native_test_ns > 0 && p.fields <= JitSwitch<int>::kMaxFields) {
+        double native_rules = 0.5 * (rules - static_cast<double>(p.table_rules));
+        set(RuleStrategy::Jit, static_cast<double>(p.int_fields) * fcall + 4 * static_cast<double>(p.tables) * cal.native_test_ns +
+                                   native_rules * (int_tests * cal.native_test_ns + string_tests * cal.native_string_test_ns));
+    }
+
+    // Image: one key lookup, then only the unindexed rules ranked before the
+    // indexed match are scanned; each condition reads its field and decodes
+    // its operands.
+    double lookup = 0;
+    if (p.key_indexed) {
+        lookup = (p.string_key ? cal.hash_probe_ns
+                                       : std::log2(2.0 * static_cast<double>(p.key_intervals) + 1) * cal.search_step_ns);
+    }
+    double scanned = rules - static_cast<double>(p.key_indexed);
+    set(RuleStrategy::Image, lookup + 0.5 * scanned * (per_rule * 2 * fcall + vm_rule));
+
+    double best = -1;
+    for (std::size_t s = 0; s < kRuleStrategies; ++s) {
+        if (plan.available[s] && (best < 0 || plan.estimated_ns[s] < best)) {
+            best = plan.estimated_ns[s];
+            plan.strategy = static_cast<RuleStrategy>(s);
+        }
+    }
+    return plan;
+}
+
+inline SwitchPlan plan_rules(const RuleSet& rules, const std::string& key_field = "value",
+                             const SwitchCalibration& cal = switch_calibration()) {
+    return plan_rules(analyze_rules(rules, key_field), cal);
+}
+
+// A rule set bound to the engine its plan picked.
+template <typename T>
+class PlannedSwitch {
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    PlannedSwitch(const RuleSet& rules, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+                  const std::string& key_field = "value", const SwitchCalibration& cal = switch_calibration())
+        : PlannedSwitch(rules, schema, actions, key_field, check_reachability(rules), &cal, nullptr) {}
+
+    // Uses `plan` as given, e.g. to force a strategy.
+    PlannedSwitch(const RuleSet& rules, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+                  const std::string& key_field, const SwitchPlan& plan)
+        : PlannedSwitch(rules, schema, actions, key_field, check_reachability(rules), nullptr, &plan) {}
+
+    // Index (in rule-file order) of the first matching rule, or npos.
+    std::size_t find(const T& value) const {
+        switch (plan_.strategy) {
+            case RuleStrategy::Compiled: return compiled_->find(value);
+            case RuleStrategy::Bytecode: return bytecode_->find(value);
+            case RuleStrategy::Jit: return jit_->find(value);
+            case RuleStrategy::Image: return mapped_->find(value);
+        }
+        return npos;
+    }
+
+    // Runs the action of the first matching rule, or the default action.
+    // Returns true if a rule (not the default) matched.
+    bool evaluate(const T& value) const {
+        switch (plan_.strategy) {
+            case RuleStrategy::Compiled: return compiled_->evaluate(value);
+            case RuleStrategy::Bytecode: return bytecode_->evaluate(value);
+            case RuleStrategy::Jit: return jit_->evaluate(value);
+            case RuleStrategy::Image: return mapped_->evaluate(value);
+        }
+        return false;
+    }
+
+    const SwitchPlan& plan() const { return plan_; }
+
+    // What was planned and built, with the estimates for every engine
+    // (defined in switch_explain.hpp).
+    SwitchExplanation explain() const;
+
+private:
+    // The reachability analysis is run once, for the plan, the engine and explain().
+    PlannedSwitch(const RuleSet& rules, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+                  const std::string& key_field, RuleReachability reach, const SwitchCalibration* cal, const SwitchPlan* plan)
+        : plan_(plan ? *plan : plan_rules(analyze_rules(rules, key_field, reach), *cal)), rules_(rules),
+          reach_(std::move(reach)),
+          // The proof the chosen engine relies on: the image does not know
+          // the schema's field bounds.
+          coverage_(plan_.strategy == RuleStrategy::Image ? check_coverage(rules, reach_)
+                                                          : check_coverage(rules, reach_, schema)),
+          key_field_(key_field) {
+        switch (plan_.strategy) {
+            case RuleStrategy::Compiled:
+                compiled_ = std::make_unique<CompiledSwitch<T>>(compile_rules(rules, schema, actions, reach_));
+                break;
+            case RuleStrategy::Bytecode:
+                bytecode_ = std::make_unique<BytecodeSwitch<T>>(compile_bytecode(rules, schema, reach_), schema, actions);
+                break;
+            case RuleStrategy::Jit:
+                jit_ = std::make_unique<JitSwitch<T>>(compile_bytecode(rules, schema, reach_), schema, actions);
+                break;
+            case RuleStrategy::Image:
+                image_bytes_ = build_switch_image(rules, key_field, reach_);
+                image_ = std::make_unique<SwitchImage>(SwitchImage::from_memory(image_bytes_.data(), image_bytes_.size()));
+                mapped_ = std::make_unique<ImageSwitch<T>>(*image_, schema, actions);
+                break;
+        }
+    }
+
+    SwitchPlan plan_;
+    RuleSet rules_; // Kept for explain().
+    RuleReachability reach_;
+    RuleCoverage coverage_; // As used by the engine built; for explain().
+    std::string key_field_;
+    std::unique_ptr<CompiledSwitch<T>> compiled_;
+    std::unique_ptr<BytecodeSwitch<T>> bytecode_;
+    std::unique_ptr<JitSwitch<T>> jit_;
+    std::vector<unsigned char> image_bytes_;
+    std::unique_ptr<SwitchImage> image_;
+    std::unique_ptr<ImageSwitch<T>> mapped_;
+};
+
+// --- Calibration ---
+
+namespace switch_planner_detail {
+
+struct Probe {
+    std::int64_t a;
+    std::int64_t b;
+    std::string t;
+};
+
+// Best of three runs of `body` (which performs `ops` operations), each
+// repeated until it takes at least 2 ms; ns per operation.
+template <typename Body>
+double time_per_op(std::size_t ops, Body&& body) {
+    using Clock = std::chrono::steady_clock;
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+        std::size_t reps = 0;
+        auto start = Clock::now();
+        std::chrono::duration<double, std::nano> elapsed{};
+        do {
+            body();
+            ++reps;
+            elapsed = Clock::now() - start;
+        } while (elapsed.count() < 2e6);
+        double ns = elapsed.count() / static_cast<double>(reps * ops);
+        if (run == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+inline volatile std::size_t calibration_sink = 0;
+
+} // namespace switch_planner_detail
+
+inline SwitchCalibration SwitchCalibration::measure() {
+    using namespace switch_planner_detail;
+    constexpr std::size_t kRules = 64;
+    SwitchCalibration cal;
+    cal.machine = current_machine();
+
+    // Rules the probe fails on their first test, none of them dead (dead
+    // rules are compiled out) and none foldable into a jump table: integer
+    // rules with further conditions, and string rules.
+    std::string text, string_text;
+    for (std::size_t i = 0; i < kRules; ++i) {
+        std::string lo = std::to_string(1000 + 10 * i), hi = std::to_string(1004 + 10 * i);
+        text += "rule r" + std::to_string(i) + ": a in " + lo + ".." + hi + " and b >= 0 and t prefix \"q\" -> hit\n";
+        std::string tag = std::to_string(100 + i);
+        string_text += "rule s" + std::to_string(i) + ": t prefix \"q" + tag + "\" -> hit\n";
+    }
+    RuleSet rules = parse_rules(text);
+    RuleSet string_rules = parse_rules(string_text);
+    RuleSchema<Probe> schema;
+    schema.int_field("a", [](const Probe& p) { return p.a; })
+          .int_field("b", [](const Probe& p) { return p.b; })
+          .string_field("t", [](const Probe& p) { return std::string_view(p.t); });
+    RuleActions<Probe> actions;
+    actions.bind("hit", [](const Probe&) { calibration_sink = calibration_sink + 1; });
+    Probe probe{0, 0, "alpha"};
+
+    std::vector<std::function<bool(const Probe&)>> predicates;
+    for (std::size_t i = 0; i < kRules; ++i) {
+        std::int64_t k = static_cast<std::int64_t>(1000 + i);
+        predicates.push_back([k](const Probe& p) { return p.a > k; });
+    }
+    cal.function_call_ns = time_per_op(kRules, [&] {
+        std::size_t n = 0;
+        for (const auto& f : predicates) n += f(probe);
+        calibration_sink = calibration_sink + n;
+    });
+
+    // Per test, without the field reads at entry.
+    auto per_test = [&](double ns_per_rule, std::size_t entry_reads) {
+        return std::max(0.0, ns_per_rule - static_cast<double>(entry_reads) * cal.function_call_ns / kRules);
+    };
+    BytecodeSwitch<Probe> vm(compile_bytecode(rules, schema), schema, actions);
+    BytecodeSwitch<Probe> string_vm(compile_bytecode(string_rules, schema), schema, actions);
+    cal.vm_test_ns = per_test(time_per_op(kRules, [&] { calibration_sink = calibration_sink + vm.find(probe); }), 3);
+    cal.vm_string_test_ns = per_test(time_per_op(kRules, [&] { calibration_sink = calibration_sink + string_vm.find(probe); }), 1);
+
+    JitOptions options;
+    options.perf_map = false;
+    JitSwitch<Probe> jit(compile_bytecode(rules, schema), schema, actions, options);
+    JitSwitch<Probe> string_jit(compile_bytecode(string_rules, schema), schema, actions, options);
+    if (jit.jitted() && string_jit.jitted()) {
+        cal.native_test_ns = per_test(time_per_op(kRules, [&] { calibration_sink = calibration_sink + jit.find(probe); }), 2);
+        cal.native_string_test_ns =
+            per_test(time_per_op(kRules, [&] { calibration_sink = calibration_sink + string_jit.find(probe); }), 0);
+    }
+
+    // An image indexing 4096 points on the key: the lookup includes the key
+    // read and the image's own bookkeeping.
+    constexpr std::size_t kPoints = 4096;
+    std::string point_text;
+    for (std::size_t i = 0; i < kPoints; ++i) point_text += "rule p" + std::to_string(i) + ": a == " + std::to_string(i * 7) + " -> hit\n";
+    std::vector<unsigned char> bytes = build_switch_image(parse_rules(point_text), "a");
+    SwitchImage image = SwitchImage::from_memory(bytes.data(), bytes.size());
+    ImageSwitch<Probe> mapped(image, schema, actions);
+    std::uint64_t x = 88172645463325252ull; // xorshift keys defeat branch prediction.
+    std::vector<Probe> keys(256, probe);
+    for (auto& k : keys) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        k.a = static_cast<std::int64_t>(x % (kPoints * 7));
+    }
+    double steps = std::log2(2.0 * kPoints + 1);
+    cal.search_step_ns = time_per_op(keys.size(), [&] {
+        std::size_t n = 0;
+        for (const Probe& k : keys) n += mapped.find(k);
+        calibration_sink = calibration_sink + n;
+    }) / steps;
+
+    std::unordered_map<std::string, std::size_t> table;
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < 256; ++i) {
+        names.push_back("key-" + std::to_string(i * 2654435761u % 100000));
+        table.emplace(names.back(), i);
+    }
+    cal.hash_probe_ns = time_per_op(names.size(), [&] {
+        std::size_t n = 0;
+        for (const auto& s : names) n += table.find(s)->second;
+        calibration_sink = calibration_sink + n;
+    });
+
+#if SWITCH_HAS_RDTSC
+    auto wall_start = std::chrono::steady_clock::now();
+    std::uint64_t cycles_start = switch_cycles_begin();
+    std::chrono::duration<double, std::nano> wall{};
+    do {
+        wall = std::chrono::steady_clock::now() - wall_start;
+    } while (wall.count() < 2e6);
+    cal.cycles_per_ns = static_cast<double>(switch_cycles_end() - cycles_start) / wall.count();
+#endif
+    return cal;
+}
+
+inline std::string SwitchCalibration::current_machine() {
+    std::string cpu = "unknown";
+    std::ifstream in("/proc/cpuinfo");
+    for (std::string line; std::getline(in, line);) {
+        if (line.compare(0, 10, "model name") == 0) {
+            auto colon = line.find(':');
+            if (colon != std::string::npos) cpu = line.substr(line.find_first_not_of(' ', colon + 1));
+            break;
+        }
+    }
+#if defined(__VERSION__)
+    cpu += " | " __VERSION__;
+#endif
+    return cpu;
+}
+
+inline bool SwitchCalibration::load(const std::string& path) {
+    std::ifstream in(path);
+    std::string key;
+    int version = 0;
+    if (!(in >> key >> version) || key != "switch-calibration" || version != kVersion) return false;
+    SwitchCalibration cal;
+    in >> key;
+    if (key != "machine") return false;
+    in.ignore(1);
+    std::getline(in, cal.machine);
+    if (cal.machine != current_machine()) return false;
+    std::unordered_map<std::string, double*> values = {
+        {"function_call_ns", &cal.function_call_ns},
+        {"vm_test_ns", &cal.vm_test_ns},
+        {"vm_string_test_ns", &cal.vm_string_test_ns},
+        {"native_test_ns", &cal.native_test_ns},
+        {"native_string_test_ns", &cal.native_string_test_ns},
+        {"search_step_ns", &cal.search_step_ns},
+        {"hash_probe_ns", &cal.hash_probe_ns},
+        {"cycles_per_ns", &cal.cycles_per_ns}};
+    std::size_t seen = 0;
+    double value;
+    while (in >> key >> value) {
+        auto it = values.find(key);
+        if (it == values.end() || !std::isfinite(value) || value < 0) return false;
+        *it->second = value;
+        ++seen;
+    }
+    if (seen != values.size()) return false;
+    *this = cal;
+    return true;
+}
+
+inline bool SwitchCalibration::save(const std::string& path) const {
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+    std::ofstream out(path);
+    out << "switch-calibration " << kVersion << "\n"
+        << "machine " << machine << "\n"
+        << "function_call_ns " << function_call_ns << "\n"
+        << "vm_test_ns " << vm_test_ns << "\n"
+        << "vm_string_test_ns " << vm_string_test_ns << "\n"
+        << "native_test_ns " << native_test_ns << "\n"
+        << "native_string_test_ns " << native_string_test_ns << "\n"
+        << "search_step_ns " << search_step_ns << "\n"
+        << "hash_probe_ns " << hash_probe_ns << "\n"
+        << "cycles_per_ns " << cycles_per_ns << "\n";
+    return static_cast<bool>(out);
+}
+
+inline std::string SwitchCalibration::default_path() {
+    if (const char* file = std::getenv("SWITCH_CALIBRATION_FILE")) return file;
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) {
+        return std::string(cache) + "/custom_switch/calibration";
+    }
+    if (const char* home = std::getenv("HOME"); home && *home) return std::string(home) + "/.cache/custom_switch/calibration";
+    return "";
+}
+
+inline SwitchCalibration SwitchCalibration::cached(const std::string& path) {
+    SwitchCalibration cal;
+    if (!path.empty() && cal.load(path)) return cal;
+    cal = measure();
+    if (!path.empty()) cal.save(path);
+    return cal;
+}
+
+#endif // SWITCH_PLANNER_HPP
@@ -0,0 +1,1355 @@
+#ifndef SWITCH_RULES_HPP
+#define SWITCH_RULES_HPP
+
+// Rule files: business rules kept in configuration and compiled into a
+// CompiledSwitch at runtime.
+// Format, one rule per line ('#' starts a comment):
+//   rule small_domestic priority 10: amount < 100 and country == "US" -> approve
+//   rule vip: customer in {17, 42, 99} -> fast_track
+//   rule mid: amount in 100..999 and sku prefix "AB" -> review
+//   default -> reject
+// Conditions compare a field with an integer or a "string": == != < <= > >=,
+// `in lo..hi` (inclusive), `in {a, b, ...}`, and for strings `prefix "x"` and
+// `contains "x"`. Rules are tried by priority (default 0, lower first), then
+// in file order; a rule matches when all its conditions hold.
+// Usage:
+//   RuleSchema<Order> schema;
+//   schema.int_field("amount", [](const Order& o) { return o.amount; })
+//         .string_field("country", [](const Order& o) { return std::string_view(o.country); });
+//   RuleActions<Order> actions;
+//   actions.bind("approve", approve).bind("reject", reject);
+//   CompiledSwitch<Order> sw = load_rule_file("rules.txt", schema, actions);
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "compiled_switch.hpp"
+
+// --- Parsed rules ---
+// Independent of the value type, so the same parse can be compiled into a
+// CompiledSwitch, written to a binary image or turned into C++ source.
+
+struct RuleLiteral {
+    bool is_string = false;
+    std::int64_t number = 0;
+    std::string text;
+};
+
+enum class RuleOp { Eq, Ne, Lt, Le, Gt, Ge, Range, In, Prefix, Contains };
+
+struct RuleCondition {
+    std::string field;
+    RuleOp op = RuleOp::Eq;
+    std::vector<RuleLiteral> operands; // Range: {lo, hi}; In: the set; otherwise one.
+};
+
+struct Rule {
+    std::string name;
+    int priority = 0;
+    std::vector<RuleCondition> conditions;
+    std::string action;
+    std::size_t line = 0;
+};
+
+struct RuleSet {
+    std::vector<Rule> rules;       // In file order.
+    std::string default_action;    // Empty if the file has no default.
+    std::size_t default_line = 0;
+};
+
+// Thrown for malformed rule files and for rules that do not fit the schema
+// or the action registry.
+class RuleError : public std::runtime_error {
+public:
+    RuleError(std::size_t line, const std::string& message)
+        : std::runtime_error("line " + std::to_string(line) + ": " + message), line_(line) {}
+
+    std::size_t line() const { return line_; }
+
+private:
+    std::size_t line_;
+};
+
+namespace switch_rules_detail {
+
+// Tokenizer and parser for a single line.
+class LineParser {
+public:
+    LineParser(std::string_view text, std::size_t line) : s_(text), line_(line) {}
+
+    bool at_end() {
+        skip_space();
+        return pos_ >= s_.size() || s_[pos_] == '#';
+    }
+
+    [[noreturn]] void fail(const std::string& message) const { throw RuleError(line_, message); }
+
+    // Consumes `symbol` if it comes next.
+    bool accept(std::string_view symbol) {
+        skip_space();
+        if (s_.compare(pos_, symbol.size(), symbol) != 0) return false;
+        // Keywords must not be followed by more identifier characters.
+        if (is_ident_char(symbol.back()) && pos_ + symbol.size() < s_.size() &&
+            is_ident_char(s_[pos_ + symbol.size()])) {
+            return false;
+        }
+        pos_ += symbol.size();
+        return true;
+    }
+
+    void expect(std::string_view symbol) {
+        if (!accept(symbol)) fail("expected '" + std::string(symbol) + "'");
+    }
+
+    std::string identifier() {
+        skip_space();
+        std::size_t start = pos_;
+        while (pos_ < s_.size() && is_ident_char(s_[pos_])) ++pos_;
+        if (start == pos_ || std::isdigit(static_cast<unsigned char>(s_[start]))) fail("expected a name");
+        return std::string(s_.substr(start, pos_ - start));
+    }
+
+    std::int64_t integer() {
+        skip_space();
+        std::size_t start = pos_;
+        bool negative = pos_ < s_.size() && s_[pos_] == '-';
+        if (negative) ++pos_;
+        std::uint64_t value = 0;
+        std::size_t digits = pos_;
+        while (pos_ < s_.size() && std::isdigit(static_cast<unsigned char>(s_[pos_]))) {
+            std::uint64_t digit = static_cast<std::uint64_t>(s_[pos_] - '0');
+            if (value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10) fail("integer out of range");
+            value = value * 10 + digit;
+            ++pos_;
+        }
+        if (digits == pos_) {
+            pos_ = start;
+            fail("expected an integer");
+        }
+        std::uint64_t limit = static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) + (negative ? 1 : 0);
+        if (value > limit) fail("integer out of range");
+        return negative ? static_cast<std::int64_t>(0 - value) : static_cast<std::int64_t>(value);
+    }
+
+    RuleLiteral literal() {
+        skip_space();
+        RuleLiteral lit;
+        if (pos_ < s_.size() && s_[pos_] == '"') {
+            lit.is_string = true;
+            ++pos_;
+            while (true) {
+                if (pos_ >= s_.size()) fail("unterminated string");
+                char c = s_[pos_++];
+                if (c == '"') break;
+                if (c == '\\') {
+                    if (pos_ >= s_.size()) fail("unterminated string");
+                    c = s_[pos_++];
+                    if (c == 'n') c = '\n';
+                    else if (c == 't') c = '\t';
+                }
+                lit.text.push_back(c);
+            }
+        } else {
+            lit.number = integer();
+        }
+        return lit;
+    }
+
+    RuleCondition condition() {
+        RuleCondition cond;
+        cond.field = identifier();
+        if (accept("==")) cond.op = RuleOp::Eq;
+        else if (accept("!=")) cond.op = RuleOp::Ne;
+        else if (accept("<=")) cond.op = RuleOp::Le;
+        else if (accept(">=")) cond.op = RuleOp::Ge;
+        else if (accept("<")) cond.op = RuleOp::Lt;
+        else if (accept(">")) cond.op = RuleOp::Gt;
+        else if (accept("prefix")) cond.op = RuleOp::Prefix;
+        else if (accept("contains")) cond.op = RuleOp::Contains;
+        else if (accept("in")) {
+            if (accept("{")) {
+                cond.op = RuleOp::In;
+                do {
+                    cond.operands.push_back(literal());
+                } while (accept(","));
+                expect("}");
+            } else {
+                cond.op = RuleOp::Range;
+                cond.operands.push_back(literal());
+                expect("..");
+                cond.operands.push_back(literal());
+            }
+            return cond;
+        } else {
+            fail("expected an operator after '" + cond.field + "'");
+        }
+        cond.operands.push_back(literal());
+        return cond;
+    }
+
+private:
+    static bool is_ident_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    void skip_space() {
+        while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\r')) ++pos_;
+    }
+
+    std::string_view s_;
+    std::size_t pos_ = 0;
+    std::size_t line_;
+};
+
+} // namespace switch_rules_detail
+
+// Parses rule text; throws RuleError on the first malformed line.
+inline RuleSet parse_rules(std::string_view text) {
+    RuleSet set;
+    std::size_t line_no = 0;
+    std::size_t start = 0;
+    while (start <= text.size()) {
+        std::size_t end = text.find('\n', start);
+        if (end == std::string_view::npos) end = text.size();
+        ++line_no;
+        switch_rules_detail::LineParser p(text.substr(start, end - start), line_no);
+        start = end + 1;
+        if (p.at_end()) continue;
+
+        if (p.accept("default")) {
+            if (!set.default_action.empty()) p.fail("duplicate default");
+            p.expect("->");
+            set.default_action = p.identifier();
+            set.default_line = line_no;
+        } else {
+            p.expect("rule");
+            Rule rule;
+            rule.line = line_no;
+            rule.name = p.identifier();
+            if (p.accept("priority")) {
+                std::int64_t priority = p.integer();
+                if (priority < std::numeric_limits<int>::min() || priority > std::numeric_limits<int>::max()) {
+                    p.fail("priority out of range");
+                }
+                rule.priority = static_cast<int>(priority);
+            }
+            p.expect(":");
+            do {
+                rule.conditions.push_back(p.condition());
+            } while (p.accept("and"));
+            p.expect("->");
+            rule.action = p.identifier();
+            set.rules.push_back(std::move(rule));
+        }
+        if (!p.at_end()) p.fail("unexpected text at end of line");
+    }
+    return set;
+}
+
+// Reads and parses a rule file.
+inline RuleSet parse_rule_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open rule file: " + path);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return parse_rules(text.str());
+}
+
+// --- Reachability ---
+// Rules that can never match. A rule is unreachable if its own conditions
+// contradict each other (amount < 10 and amount > 20), and shadowed if every
+// value it matches is taken by rules tried before it. Integer conditions are
+// compared as interval sets; string conditions through their literal sets
+// (== and in {...}), and otherwise only against the same or a stricter
+// prefix/contains test. Rules found dead never match, but not every dead
+// rule is found. The compilers skip dead rules, so they cost nothing at
+// evaluation time; rule indexes are unchanged.
+
+struct RuleDiagnostic {
+    enum class Kind { Unreachable, Shadowed };
+
+    Kind kind = Kind::Shadowed;
+    std::size_t rule = 0;        // Index in RuleSet::rules.
+    std::vector<std::size_t> by; // Shadowed: the earlier rules that cover it.
+    std::string message;         // "line 7: rule 'b' is shadowed by 'a' (line 3)"
+};
+
+struct RuleReachability {
+    std::vector<bool> live;                  // Per rule, in file order.
+    std::vector<RuleDiagnostic> diagnostics; // In file order.
+    bool complete = true;                    // false: the rule-by-rule comparisons hit their budget (see below).
+
+    bool dead(std::size_t rule) const { return !live[rule]; }
+    std::size_t dead_count() const { return diagnostics.size(); }
+};
+
+namespace switch_rules_detail {
+
+// A set of int64 values as sorted, disjoint, non-adjacent inclusive intervals.
+class IntSet {
+public:
+    using Interval = std::pair<std::int64_t, std::int64_t>;
+
+    static constexpr std::int64_t kMin = std::numeric_limits<std::int64_t>::min();
+    static constexpr std::int64_t kMax = std::numeric_limits<std::int64_t>::max();
+
+    static IntSet all() { return between(kMin, kMax); }
+
+    static IntSet between(std::int64_t lo, std::int64_t hi) {
+        IntSet s;
+        if (lo <= hi) s.v_.push_back({lo, hi});
+        return s;
+    }
+
+    // The union of `intervals`, in any order; sorted once.
+    static IntSet join(std::vector<Interval> intervals) {
+        IntSet s;
+        s.v_ = std::move(intervals);
+        s.normalize();
+        return s;
+    }
+
+    static IntSet points(std::vector<std::int64_t> values) {
+        IntSet s;
+        for (std::int64_t v : values) s.v_.push_back({v, v});
+        s.normalize();
+        return s;
+    }
+
+    // The values an integer condition accepts.
+    static IntSet of(const RuleCondition& c) {
+        std::int64_t v = c.operands[0].number;
+        switch (c.op) {
+            case RuleOp::Eq: return between(v, v);
+            case RuleOp::Ne: {
+                IntSet s;
+                if (v != kMin) s.v_.push_back({kMin, v - 1});
+                if (v != kMax) s.v_.push_back({v + 1, kMax});
+                return s;
+            }
+            case RuleOp::Lt: return v == kMin ? IntSet() : between(kMin, v - 1);
+            case RuleOp::Le: return between(kMin, v);
+            case RuleOp::Gt: return v == kMax ? IntSet() : between(v + 1, kMax);
+            case RuleOp::Ge: return between(v, kMax);
+            case RuleOp::Range: return between(v, c.operands[1].number);
+            case RuleOp::In: {
+                std::vector<std::int64_t> values;
+                for (const RuleLiteral& lit : c.operands) values.push_back(lit.number);
+                return points(std::move(values));
+            }
+            default: return all();
+        }
+    }
+
+    bool empty() const { return v_.empty(); }
+    bool full() const { return v_.size() == 1 && v_[0].first == kMin && v_[0].second == kMax; }
+
+    IntSet intersect(const IntSet& o) const {
+        IntSet s;
+        for (std::size_t i = 0, j = 0; i < v_.size() && j < o.v_.size();) {
+            std::int64_t lo = std::max(v_[i].first, o.v_[j].first);
+            std::int64_t hi = std::min(v_[i].second, o.v_[j].second);
+            if (lo <= hi) s.v_.push_back({lo, hi});
+            (v_[i].second < o.v_[j].second ? i : j)++;
+        }
+        return s;
+    }
+
+    bool subset_of(const IntSet& o) const {
+        for (const Interval& iv : v_) {
+            // The interval of `o` that starts at or before iv must reach its end.
+            auto it = std::upper_bound(o.v_.begin(), o.v_.end(), iv.first,
+                                       [](std::int64_t x, const Interval& b) { return x < b.first; });
+            if (it == o.v_.begin() || std::prev(it)->second < iv.second) return false;
+        }
+        return true;
+    }
+
+    bool overlaps(const IntSet& o) const {
+        for (std::size_t i = 0, j = 0; i < v_.size() && j < o.v_.size();) {
+            if (std::max(v_[i].first, o.v_[j].first) <= std::min(v_[i].second, o.v_[j].second)) return true;
+            (v_[i].second < o.v_[j].second ? i : j)++;
+        }
+        return false;
+    }
+
+    const std::vector<Interval>& intervals() const { return v_; }
+
+private:
+    void normalize() {
+        std::sort(v_.begin(), v_.end());
+        std::size_t out = 0;
+        for (std::size_t i = 0; i < v_.size(); ++i) {
+            if (out && (v_[out - 1].second == kMax || v_[i].first <= v_[out - 1].second + 1)) {
+                v_[out - 1].second = std::max(v_[out - 1].second, v_[i].second);
+            } else {
+                v_[out++] = v_[i];
+            }
+        }
+        v_.resize(out);
+    }
+
+    std::vector<Interval> v_;
+};
+
+// A union of intervals that grows one set at a time and is queried in
+// between; each insert costs O(log n), not a copy of the union.
+class IntUnion {
+public:
+    void add(const IntSet& s) {
+        for (const IntSet::Interval& iv : s.intervals()) add(iv.first, iv.second);
+    }
+
+    void add(std::int64_t lo, std::int64_t hi) {
+        auto it = v_.upper_bound(lo);
+        if (it != v_.begin() && (lo == IntSet::kMin || std::prev(it)->second >= lo - 1)) --it;
+        while (it != v_.end() && (hi == IntSet::kMax || it->first <= hi + 1)) {
+            lo = std::min(lo, it->first);
+            hi = std::max(hi, it->second);
+            it = v_.erase(it);
+        }
+        v_.emplace_hint(it, lo, hi);
+    }
+
+    bool covers(const IntSet& s) const {
+        for (const IntSet::Interval& iv : s.intervals()) {
+            auto it = v_.upper_bound(iv.first);
+            if (it == v_.begin() || std::prev(it)->second < iv.second) return false;
+        }
+        return true;
+    }
+
+private:
+    std::map<std::int64_t, std::int64_t> v_; // lo -> hi; disjoint, non-adjacent.
+};
+
+// Whether string condition `c` holds for `v`.
+inline bool text_holds(const RuleCondition& c, std::string_view v) {
+    const std::string& t = c.operands[0].text;
+    switch (c.op) {
+        case RuleOp::Eq: return v == t;
+        case RuleOp::Ne: return v != t;
+        case RuleOp::Lt: return v < t;
+        case RuleOp::Le: return v <= t;
+        case RuleOp::Gt: return v > t;
+        case RuleOp::Ge: return v >= t;
+        case RuleOp::Range: return t <= v && v <= c.operands[1].text;
+        case RuleOp::In:
+            for (const RuleLiteral& lit : c.operands) {
+                if (v == lit.text) return true;
+            }
+            return false;
+        case RuleOp::Prefix: return v.substr(0, t.size()) == t;
+        case RuleOp::Contains: return v.find(t) != std::string_view::npos;
+    }
+    return false;
+}
+
+// The values one field may take for a rule to match.
+struct FieldDomain {
+    std::string field;
+    bool is_string = false;
+    IntSet ints = IntSet::all();
+    bool finite = false;               // Strings: `strings` is the exact set.
+    std::vector<std::string> strings;  // Sorted.
+    std::vector<const RuleCondition*> open; // Strings without a literal set.
+
+    // Whether every string of this domain satisfies `c`.
+    bool implies(const RuleCondition& c) const {
+        if (finite) {
+            for (const std::string& s : strings) {
+                if (!text_holds(c, s)) return false;
+            }
+            return true;
+        }
+        const std::string& t = c.operands[0].text;
+        if ((c.op == RuleOp::Prefix || c.op == RuleOp::Contains) && t.empty()) return true;
+        for (const RuleCondition* o : open) {
+            const std::string& u = o->operands[0].text;
+            if (o->op == c.op && o->operands.size() == c.operands.size() &&
+                std::equal(o->operands.begin(), o->operands.end(), c.operands.begin(),
+                           [](const RuleLiteral& a, const RuleLiteral& b) { return a.text == b.text; })) {
+                return true;
+            }
+            if (c.op == RuleOp::Prefix && o->op == RuleOp::Prefix && u.compare(0, t.size(), t) == 0) return true;
+            if (c.op == RuleOp::Contains && (o->op == RuleOp::Prefix || o->op == RuleOp::Contains) &&
+                u.find(t) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool contains(std::string_view s) const {
+        if (finite) return std::binary_search(strings.begin(), strings.end(), s);
+        for (const RuleCondition* c : open) {
+            if (!text_holds(*c, s)) return false;
+        }
+        return true;
+    }
+
+    // Whether every value of `inner` (the same field) is in this domain.
+    bool covers(const FieldDomain& inner) const {
+        if (!is_string) return inner.ints.subset_of(ints);
+        if (inner.finite) {
+            for (const std::string& s : inner.strings) {
+                if (!contains(s)) return false;
+            }
+            return true;
+        }
+        if (finite) return false;
+        for (const RuleCondition* c : open) {
+            if (!inner.implies(*c)) return false;
+        }
+        return true;
+    }
+
+    // Whether the domain places no restriction on the field.
+    bool unrestricted() const { return is_string ? !finite && open.empty() : ints.full(); }
+};
+
+// A rule as one domain per tested field, sorted by field name.
+struct RuleShape {
+    std::vector<FieldDomain> fields;
+    bool analyzable = true; // false: operands of mixed types, which the compilers reject.
+    bool empty = false;     // No value satisfies all conditions.
+
+    const FieldDomain* find(const std::string& field) const {
+        auto it = std::lower_bound(fields.begin(), fields.end(), field,
+                                   [](const FieldDomain& d, const std::string& f) { return d.field < f; });
+        return it != fields.end() && it->field == field ? &*it : nullptr;
+    }
+
+    // Whether every value matched by `later` is matched by this rule.
+    bool covers(const RuleShape& later) const {
+        for (const FieldDomain& d : fields) {
+            const FieldDomain* l = later.find(d.field);
+            if (l ? !d.covers(*l) : !d.unrestricted()) return false;
+        }
+        return true;
+    }
+};
+
+inline RuleShape rule_shape(const Rule& rule) {
+    RuleShape shape;
+    for (const RuleCondition& c : rule.conditions) {
+        bool is_string = c.operands[0].is_string;
+        for (const RuleLiteral& lit : c.operands) {
+            if (lit.is_string != is_string) shape.analyzable = false;
+        }
+        auto it = std::lower_bound(shape.fields.begin(), shape.fields.end(), c.field,
+                                   [](const FieldDomain& d, const std::string& f) { return d.field < f; });
+        if (it == shape.fields.end() || it->field != c.field) {
+            it = shape.fields.insert(it, FieldDomain());
+            it->field = c.field;
+            it->is_string = is_string;
+        } else if (it->is_string != is_string) {
+            shape.analyzable = false;
+        }
+        if (!shape.analyzable) return shape;
+        FieldDomain& d = *it;
+        if (!is_string) {
+            d.ints = d.ints.intersect(IntSet::of(c));
+        } else if (c.op == RuleOp::Eq || c.op == RuleOp::In) {
+            std::vector<std::string> set;
+            for (const RuleLiteral& lit : c.operands) set.push_back(lit.text);
+            std::sort(set.begin(), set.end());
+            set.erase(std::unique(set.begin(), set.end()), set.end());
+            if (d.finite) {
+                std::vector<std::string> both;
+                std::set_intersection(d.strings.begin(), d.strings.end(), set.begin(), set.end(), std::back_inserter(both));
+                set = std::move(both);
+            }
+            d.finite = true;
+            d.strings = std::move(set);
+        } else {
+            d.open.push_back(&c);
+        }
+    }
+    for (FieldDomain& d : shape.fields) {
+        if (d.finite) {
+            // The exact set absorbs the other conditions on the field.
+            std::vector<std::string> kept;
+            for (std::string& s : d.strings) {
+                if (std::all_of(d.open.begin(), d.open.end(), [&](const RuleCondition* c) { return text_holds(*c, s); })) {
+                    kept.push_back(std::move(s));
+                }
+            }
+            d.strings = std::move(kept);
+            d.open.clear();
+            shape.empty = shape.empty || d.strings.empty();
+        } else if (d.is_string) {
+            for (const RuleCondition* c : d.open) {
+                if (c->op == RuleOp::Range && c->operands[1].text < c->operands[0].text) shape.empty = true;
+            }
+        } else {
+            shape.empty = shape.empty || d.ints.empty();
+        }
+    }
+    return shape;
+}
+
+inline std::string rule_ref(const Rule& rule) {
+    return "'" + rule.name + "' (line " + std::to_string(rule.line) + ")";
+}
+
+} // namespace switch_rules_detail
+
+// Finds the rules that can never match (see above). Rules are taken in
+// evaluation order: by priority, then file order. Comparing a rule with the
+// earlier rules one by one is bounded by a budget; past it, rules are only
+// checked against the single-field rules and `complete` is false.
+inline RuleReachability check_reachability(const RuleSet& rules) {
+    using namespace switch_rules_detail;
+    constexpr std::size_t kBudget = std::size_t(1) << 22; // Rule comparisons.
+    const std::size_t n = rules.rules.size();
+    RuleReachability result;
+    result.live.assign(n, true);
+    std::size_t budget = kBudget;
+    auto spend = [&](std::size_t cost) {
+        if (cost > budget) {
+            budget = 0;
+            result.complete = false;
+            return false;
+        }
+        budget -= cost;
+        return true;
+    };
+
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return rules.rules[a].priority < rules.rules[b].priority;
+    });
+    std::vector<std::size_t> rank(n);
+    for (std::size_t i = 0; i < n; ++i) rank[order[i]] = i;
+
+    // Earlier live rules that test several fields are compared one by one.
+    // Rules that test a single field are also merged per field, so that a
+    // later rule covered by several of them together is found.
+    struct Single {
+        std::size_t rule;
+        const FieldDomain* domain;
+    };
+    struct FieldUnion {
+        IntUnion ints;
+        std::vector<Single> rules;
+    };
+    // A multi-field rule can only cover rules whose bounds on its narrowest
+    // integer field (its pivot) lie within its own. Rules are indexed per
+    // pivot field and per width class k (width < 2^k) by their lower bound:
+    // one that holds [lo, hi] starts in [hi - 2^k + 1, lo], so a lookup
+    // visits only rules near the value, not every earlier rule.
+    struct Multi {
+        std::size_t rule;
+        IntSet::Interval bounds;
+    };
+    using PivotIndex = std::array<std::multimap<std::int64_t, Multi>, 65>;
+    std::vector<RuleShape> shapes(n);
+    std::vector<std::size_t> unpivoted; // Multi-field rules without an integer field to index.
+    std::unordered_map<std::string, PivotIndex> pivots;
+    std::unordered_map<std::string, FieldUnion> singles;
+    std::vector<std::size_t> candidates;
+    auto bounds_of = [](const FieldDomain& d) {
+        return IntSet::Interval{d.ints.intervals().front().first, d.ints.intervals().back().second};
+    };
+    auto width_class = [](const IntSet::Interval& b) {
+        std::uint64_t w = static_cast<std::uint64_t>(b.second) - static_cast<std::uint64_t>(b.first);
+        std::size_t k = 0;
+        while (k < 64 && (w >> k) != 0) ++k;
+        return k;
+    };
+
+    for (std::size_t index : order) {
+        const Rule& rule = rules.rules[index];
+        RuleShape& shape = shapes[index] = rule_shape(rule);
+        if (!shape.analyzable) continue;
+
+        RuleDiagnostic diag;
+        diag.rule = index;
+        bool dead = shape.empty;
+        if (dead) {
+            diag.kind = RuleDiagnostic::Kind::Unreachable;
+            diag.message = "rule '" + rule.name + "' can never match: its conditions contradict each other";
+        }
+        for (std::size_t i = 0; !dead && i < shape.fields.size(); ++i) {
+            const FieldDomain& d = shape.fields[i];
+            auto it = singles.find(d.field);
+            if (it == singles.end()) continue;
+            const FieldUnion& u = it->second;
+            bool covered;
+            if (!d.is_string) {
+                covered = u.ints.covers(d.ints);
+            } else {
+                if (!spend(u.rules.size() * (d.strings.size() + 1))) continue;
+                covered = d.finite;
+                for (std::size_t s = 0; covered && s < d.strings.size(); ++s) {
+                    covered = std::any_of(u.rules.begin(), u.rules.end(),
+                                          [&](const Single& r) { return r.domain->contains(d.strings[s]); });
+                }
+                if (!covered) {
+                    for (const Single& r : u.rules) {
+                        if (r.domain->covers(d)) {
+                            covered = true;
+                            break;
+                        }
+                    }
+                }
+            }
+            if (!covered) continue;
+            dead = true;
+            for (const Single& r : u.rules) {
+                bool used = d.is_string ? r.domain->covers(d) || (d.finite && std::any_of(d.strings.begin(), d.strings.end(),
+                                                                   [&](const std::string& s) { return r.domain->contains(s); }))
+                                        : r.domain->ints.overlaps(d.ints);
+                if (used) diag.by.push_back(r.rule);
+            }
+        }
+        if (!dead && budget > 0) {
+            // Candidates in evaluation order; the first that covers the rule is reported.
+            candidates.clear();
+            for (const FieldDomain& d : shape.fields) {
+                auto it = d.is_string ? pivots.end() : pivots.find(d.field);
+                if (it == pivots.end()) continue;
+                IntSet::Interval b = bounds_of(d);
+                for (std::size_t k = 0; k < it->second.size(); ++k) {
+                    const auto& by_start = it->second[k];
+                    if (by_start.empty()) continue;
+                    std::uint64_t span = k == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << k) - 1;
+                    std::int64_t from = static_cast<std::uint64_t>(b.second) - static_cast<std::uint64_t>(IntSet::kMin) <= span
+                                            ? IntSet::kMin
+                                            : static_cast<std::int64_t>(static_cast<std::uint64_t>(b.second) - span);
+                    for (auto m = by_start.lower_bound(from); m != by_start.end() && m->first <= b.first; ++m) {
+                        if (!spend(1)) break;
+                        if (b.second <= m->second.bounds.second) candidates.push_back(rank[m->second.rule]);
+                    }
+                }
+            }
+            if (spend(unpivoted.size())) {
+                for (std::size_t r : unpivoted) candidates.push_back(rank[r]);
+            }
+            std::sort(candidates.begin(), candidates.end());
+            for (std::size_t c : candidates) {
+                if (!spend(1)) break;
+                if (shapes[order[c]].covers(shape)) {
+                    dead = true;
+                    diag.by.push_back(order[c]);
+                    break;
+                }
+            }
+        }
+
+        if (!dead) {
+            if (shape.fields.size() == 1) {
+                FieldUnion& u = singles[shape.fields[0].field];
+                if (!shape.fields[0].is_string) u.ints.add(shape.fields[0].ints);
+                u.rules.push_back({index, &shape.fields[0]});
+            } else {
+                const FieldDomain* pivot = nullptr;
+                std::size_t width = 0;
+                for (const FieldDomain& d : shape.fields) {
+                    if (d.is_string || d.ints.full()) continue;
+                    std::size_t k = width_class(bounds_of(d));
+                    if (!pivot || k < width) {
+                        pivot = &d;
+                        width = k;
+                    }
+                }
+                if (pivot) {
+                    IntSet::Interval b = bounds_of(*pivot);
+                    pivots[pivot->field][width].emplace(b.first, Multi{index, b});
+                } else {
+                    unpivoted.push_back(index);
+                }
+            }
+            continue;
+        }
+        result.live[index] = false;
+        if (diag.kind == RuleDiagnostic::Kind::Shadowed) {
+            diag.message = "rule '" + rule.name + "' is shadowed by ";
+            for (std::size_t k = 0; k < diag.by.size() && k < 3; ++k) {
+                diag.message += (k ? ", " : "") + rule_ref(rules.rules[diag.by[k]]);
+            }
+            if (diag.by.size() > 3) diag.message += " and " + std::to_string(diag.by.size() - 3) + " more";
+        }
+        diag.message = "line " + std::to_string(rule.line) + ": " + diag.message;
+        result.diagnostics.push_back(std::move(diag));
+    }
+    std::sort(result.diagnostics.begin(), result.diagnostics.end(),
+              [](const RuleDiagnostic& a, const RuleDiagnostic& b) { return a.rule < b.rule; });
+    return result;
+}
+
+// --- Exhaustiveness ---
+// A rule set is exhaustive when the rules that test one integer field alone
+// cover every value that field can take. Then some rule matches every value:
+// the default never runs, and the last rule in evaluation order matches
+// whenever it is reached, so the compilers drop the default and emit that
+// rule without its tests. A field can take any int64 unless the schema says
+// otherwise (narrower integral values, enum fields).
+
+struct RuleCoverage {
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    bool exhaustive = false;           // Some rule matches every value.
+    std::string field;                 // Exhaustive: the field whose values the rules cover.
+    std::size_t last_rule = npos;      // Exhaustive: the last live rule in evaluation order.
+    std::vector<std::string> warnings; // Enum fields of a rule set without a default: uncovered enumerators.
+};
+
+namespace switch_rules_detail {
+
+// The values an integer field can take; enumerators for enum fields.
+struct FieldBounds {
+    std::string field;
+    IntSet values = IntSet::all();
+    std::vector<std::pair<std::string, std::int64_t>> enumerators;
+};
+
+inline RuleCoverage check_coverage(const RuleSet& rules, const RuleReachability& reach,
+                                   const std::vector<FieldBounds>& bounds) {
+    RuleCoverage result;
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < rules.rules.size(); ++i) {
+        if (!reach.dead(i)) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return rules.rules[a].priority < rules.rules[b].priority;
+    });
+
+    // Union of the single-field rules, per integer field, in first-use order.
+    // The intervals are collected first and merged once per field.
+    std::vector<std::pair<std::string, IntSet>> unions;
+    std::vector<std::vector<IntSet::Interval>> parts;
+    std::unordered_map<std::string, std::size_t> slots;
+    for (std::size_t index : order) {
+        const Rule& rule = rules.rules[index];
+        if (rule.conditions.empty() || std::any_of(rule.conditions.begin(), rule.conditions.end(), [&](const RuleCondition& c) {
+                return c.field != rule.conditions[0].field;
+            })) {
+            continue;
+        }
+        RuleShape shape = rule_shape(rule);
+        if (!shape.analyzable || shape.fields[0].is_string) continue;
+        const FieldDomain& d = shape.fields[0];
+        auto slot = slots.emplace(d.field, unions.size());
+        if (slot.second) {
+            unions.push_back({d.field, IntSet()});
+            parts.emplace_back();
+        }
+        std::vector<IntSet::Interval>& part = parts[slot.first->second];
+        part.insert(part.end(), d.ints.intervals().begin(), d.ints.intervals().end());
+    }
+    for (std::size_t i = 0; i < unions.size(); ++i) unions[i].second = IntSet::join(std::move(parts[i]));
+    for (const auto& u : unions) {
+        auto b = std::find_if(bounds.begin(), bounds.end(), [&](const FieldBounds& f) { return f.field == u.first; });
+        if (!(b == bounds.end() ? IntSet::all() : b->values).subset_of(u.second)) continue;
+        result.exhaustive = true;
+        result.field = u.first;
+        result.last_rule = order.back();
+        return result;
+    }
+    if (!rules.default_action.empty()) return result;
+    for (const auto& u : unions) {
+        auto b = std::find_if(bounds.begin(), bounds.end(), [&](const FieldBounds& f) { return f.field == u.first; });
+        if (b == bounds.end()) continue;
+        for (const auto& e : b->enumerators) {
+            if (!IntSet::between(e.second, e.second).subset_of(u.second)) {
+                result.warnings.push_back("enumerator " + e.first + " (" + std::to_string(e.second) + ") of '" + u.first +
+                                          "' is not matched by any rule on '" + u.first + "' alone, and there is no default");
+            }
+        }
+    }
+    return result;
+}
+
+} // namespace switch_rules_detail
+
+// Proves the rule set exhaustive over int64 fields (see above). Use the
+// overload taking a schema to account for field types.
+inline RuleCoverage check_coverage(const RuleSet& rules, const RuleReachability& reach) {
+    return switch_rules_detail::check_coverage(rules, reach, {});
+}
+
+inline RuleCoverage check_coverage(const RuleSet& rules) {
+    return check_coverage(rules, check_reachability(rules));
+}
+
+// --- Mutual exclusivity ---
+// First-match order only matters between rules that can match the same
+// value. Two rules are disjoint if a field they both test has no value that
+// both accept (amount < 100 and amount >= 100, tag == "a" and tag prefix "b",
+// tag prefix "ab" and tag prefix "b"). Disjoint rules can be tried in any
+// order, or all at once; order is kept only where rules may overlap.
+
+namespace switch_rules_detail {
+
+// Whether no value is in both domains of one field; false if unsure.
+inline bool disjoint(const FieldDomain& a, const FieldDomain& b) {
+    if (a.is_string != b.is_string) return false;
+    if (!a.is_string) return !a.ints.overlaps(b.ints);
+    if (a.finite || b.finite) {
+        const FieldDomain& set = a.finite ? a : b;
+        const FieldDomain& other = a.finite ? b : a;
+        return std::none_of(set.strings.begin(), set.strings.end(), [&](const std::string& s) { return other.contains(s); });
+    }
+    for (const RuleCondition* c : a.open) {
+        for (const RuleCondition* d : b.open) {
+            if (c->op != RuleOp::Prefix || d->op != RuleOp::Prefix) continue;
+            const std::string& p = c->operands[0].text;
+            const std::string& q = d->operands[0].text;
+            if (p.compare(0, q.size(), q) != 0 && q.compare(0, p.size(), p) != 0) return true;
+        }
+    }
+    return false;
+}
+
+// Whether no value matches both rules; false if unsure.
+inline bool disjoint(const RuleShape& a, const RuleShape& b) {
+    if (a.empty || b.empty) return true;
+    if (!a.analyzable || !b.analyzable) return false;
+    for (std::size_t i = 0, j = 0; i < a.fields.size() && j < b.fields.size();) {
+        int cmp = a.fields[i].field.compare(b.fields[j].field);
+        if (cmp == 0 && disjoint(a.fields[i], b.fields[j])) return true;
+        if (cmp <= 0) ++i;
+        if (cmp >= 0) ++j;
+    }
+    return false;
+}
+
+inline std::vector<std::size_t> evaluation_order(const RuleSet& rules) {
+    std::vector<std::size_t> order(rules.rules.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return rules.rules[a].priority < rules.rules[b].priority;
+    });
+    return order;
+}
+
+} // namespace switch_rules_detail
+
+// Whether no value can match both rules. false means they may overlap.
+inline bool rules_disjoint(const Rule& a, const Rule& b) {
+    return switch_rules_detail::disjoint(switch_rules_detail::rule_shape(a), switch_rules_detail::rule_shape(b));
+}
+
+// Splits the live rules, in evaluation order, into consecutive groups of
+// pairwise disjoint rules. At most one rule of a group matches any value, so
+// the rules of a group can be tested in any order or in parallel; groups
+// are tried in order. `reach` is check_reachability(rules).
+inline std::vector<std::vector<std::size_t>> disjoint_groups(const RuleSet& rules, const RuleReachability& reach) {
+    using namespace switch_rules_detail;
+    std::vector<RuleShape> shapes(rules.rules.size());
+    std::vector<std::vector<std::size_t>> groups;
+    for (std::size_t index : evaluation_order(rules)) {
+        if (reach.dead(index)) continue;
+        shapes[index] = rule_shape(rules.rules[index]);
+        bool fits = !groups.empty() && std::all_of(groups.back().begin(), groups.back().end(),
+                                                   [&](std::size_t g) { return disjoint(shapes[g], shapes[index]); });
+        if (!fits) groups.emplace_back();
+        groups.back().push_back(index);
+    }
+    return groups;
+}
+
+inline std::vector<std::vector<std::size_t>> disjoint_groups(const RuleSet& rules) {
+    return disjoint_groups(rules, check_reachability(rules));
+}
+
+// Returns `rules` with priorities that try frequently matched rules first.
+// `hits[i]` counts the matches of rule i (as returned by find()). A rule
+// moves ahead of an earlier one only if the two are disjoint, so every
+// value still matches the same rule; rule indexes do not change. Rules
+// that can never match go last. Like an insertion sort: O(n^2) at worst.
+// `reach` is check_reachability(rules); it still holds for the result.
+inline RuleSet reorder_rules(const RuleSet& rules, const std::vector<std::uint64_t>& hits, const RuleReachability& reach) {
+    using namespace switch_rules_detail;
+    auto hits_of = [&](std::size_t i) { return i < hits.size() ? hits[i] : 0; };
+    std::vector<RuleShape> shapes(rules.rules.size());
+    std::vector<std::size_t> out, dead;
+    for (std::size_t index : evaluation_order(rules)) {
+        if (reach.dead(index)) {
+            dead.push_back(index);
+            continue;
+        }
+        shapes[index] = rule_shape(rules.rules[index]);
+        // Ahead of the placed rules with fewer hits, up to the first rule
+        // it may overlap.
+        std::size_t pos = out.size();
+        while (pos > 0 && hits_of(out[pos - 1]) < hits_of(index) && disjoint(shapes[out[pos - 1]], shapes[index])) --pos;
+        out.insert(out.begin() + static_cast<std::ptrdiff_t>(pos), index);
+    }
+    out.insert(out.end(), dead.begin(), dead.end());
+    RuleSet reordered = rules;
+    for (std::size_t pos = 0; pos < out.size(); ++pos) reordered.rules[out[pos]].priority = static_cast<int>(pos);
+    return reordered;
+}
+
+inline RuleSet reorder_rules(const RuleSet& rules, const std::vector<std::uint64_t>& hits) {
+    return reorder_rules(rules, hits, check_reachability(rules));
+}
+
+// --- Binding to a value type ---
+
+// Named fields of T that rules may test. For integral T and std::string the
+// value itself is available as the field "value".
+template <typename T>
+class RuleSchema {
+public:
+    enum class Type { Int, String };
+
+    struct Field {
+        std::string name;
+        Type type = Type::Int;
+        std::function<std::int64_t(const T&)> get_int;
+        std::function<std::string_view(const T&)> get_string;
+        bool identity = false; // The field is the value itself.
+        // Int: the values get_int can return, for check_coverage().
+        std::int64_t min = std::numeric_limits<std::int64_t>::min();
+        std::int64_t max = std::numeric_limits<std::int64_t>::max();
+        std::vector<std::pair<std::string, std::int64_t>> enumerators; // Enum fields: the only values.
+    };
+
+    RuleSchema() : fields_(std::make_shared<std::vector<Field>>()) {
+        if constexpr (std::is_integral_v<T>) {
+            fields_->push_back(make_field("value", Type::Int, [](const T& v) { return static_cast<std::int64_t>(v); },
+                                          nullptr, true));
+            if constexpr (std::is_signed_v<T> || sizeof(T) < sizeof(std::int64_t)) {
+                fields_->back().min = static_cast<std::int64_t>(std::numeric_limits<T>::min());
+                fields_->back().max = static_cast<std::int64_t>(std::numeric_limits<T>::max());
+            }
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            fields_->push_back(make_field("value", Type::String, nullptr,
+                                          [](const T& v) { return std::string_view(v); }, true));
+        }
+    }
+
+    RuleSchema& int_field(std::string name, std::function<std::int64_t(const T&)> get) {
+        add(make_field(std::move(name), Type::Int, std::move(get), nullptr, false));
+        return *this;
+    }
+
+    // An integer field that only takes the values of `enumerators`, such as
+    // an enum converted to its underlying value. Rule sets without a default
+    // get a warning from check_coverage() for enumerators no rule matches.
+    RuleSchema& enum_field(std::string name, std::function<std::int64_t(const T&)> get,
+                           std::vector<std::pair<std::string, std::int64_t>> enumerators) {
+        Field field = make_field(std::move(name), Type::Int, std::move(get), nullptr, false);
+        field.enumerators = std::move(enumerators);
+        add(std::move(field));
+        return *this;
+    }
+
+    RuleSchema& string_field(std::string name, std::function<std::string_view(const T&)> get) {
+        add(make_field(std::move(name), Type::String, nullptr, std::move(get), false));
+        return *this;
+    }
+
+    const Field* find(std::string_view name) const {
+        for (const Field& f : *fields_) {
+            if (f.name == name) return &f;
+        }
+        return nullptr;
+    }
+
+    // Shared with compiled switches, which keep the getters alive.
+    std::shared_ptr<const std::vector<Field>> fields() const { return fields_; }
+
+private:
+    static Field make_field(std::string name, Type type, std::function<std::int64_t(const T&)> get_int,
+                            std::function<std::string_view(const T&)> get_string, bool identity) {
+        Field f;
+        f.name = std::move(name);
+        f.type = type;
+        f.get_int = std::move(get_int);
+        f.get_string = std::move(get_string);
+        f.identity = identity;
+        return f;
+    }
+
+    void add(Field field) {
+        // Copy on write: switches compiled earlier keep pointers into the old list.
+        auto next = std::make_shared<std::vector<Field>>(*fields_);
+        next->push_back(std::move(field));
+        fields_ = std::move(next);
+    }
+
+    std::shared_ptr<std::vector<Field>> fields_;
+};
+
+namespace switch_rules_detail {
+
+template <typename T>
+std::vector<FieldBounds> field_bounds(const RuleSchema<T>& schema) {
+    std::vector<FieldBounds> bounds;
+    for (const auto& f : *schema.fields()) {
+        if (f.type != RuleSchema<T>::Type::Int) continue;
+        FieldBounds b{f.name, IntSet::between(f.min, f.max), f.enumerators};
+        if (!f.enumerators.empty()) {
+            std::vector<std::int64_t> values;
+            for (const auto& e : f.enumerators) values.push_back(e.second);
+            b.values = IntSet::points(std::move(values));
+        }
+        bounds.push_back(std::move(b));
+    }
+    return bounds;
+}
+
+} // namespace switch_rules_detail
+
+// Proves the rule set exhaustive for the field types of `schema`: the value
+// of an integral switch spans only its type, and an enum field only its
+// enumerators.
+template <typename T>
+RuleCoverage check_coverage(const RuleSet& rules, const RuleReachability& reach, const RuleSchema<T>& schema) {
+    return switch_rules_detail::check_coverage(rules, reach, switch_rules_detail::field_bounds(schema));
+}
+
+template <typename T>
+RuleCoverage check_coverage(const RuleSet& rules, const RuleSchema<T>& schema) {
+    return check_coverage(rules, check_reachability(rules), schema);
+}
+
+// Callables that rule actions are bound to by name.
+template <typename T>
+class RuleActions {
+public:
+    using Action = typename CompiledSwitch<T>::Action;
+
+    RuleActions& bind(std::string name, Action action) {
+        actions_[std::move(name)] = std::move(action);
+        return *this;
+    }
+
+    const Action* find(const std::string& name) const {
+        auto it = actions_.find(name);
+        return it == actions_.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::unordered_map<std::string, Action> actions_;
+};
+
+namespace switch_rules_detail {
+
+// A condition checked against a field, with its operands pre-converted.
+template <typename T>
+struct BoundCondition {
+    const typename RuleSchema<T>::Field* field = nullptr;
+    RuleOp op = RuleOp::Eq;
+    std::int64_t lo = 0, hi = 0;      // Int: operand, or range bounds.
+    std::string text;                 // String: operand.
+    std::vector<std::int64_t> ints;   // Int In: sorted.
+    std::vector<std::string> strings; // String In: sorted.
+
+    bool holds(const T& value) const {
+        if (field->type == RuleSchema<T>::Type::Int) {
+            std::int64_t v = field->get_int(value);
+            switch (op) {
+                case RuleOp::Eq: return v == lo;
+                case RuleOp::Ne: return v != lo;
+                case RuleOp::Lt: return v < lo;
+                case RuleOp::Le: return v <= lo;
+                case RuleOp::Gt: return v > lo;
+                case RuleOp::Ge: return v >= lo;
+                case RuleOp::Range: return lo <= v && v <= hi;
+                case RuleOp::In: return std::binary_search(ints.begin(), ints.end(), v);
+                default: return false;
+            }
+        }
+        std::string_view v = field->get_string(value);
+        switch (op) {
+            case RuleOp::Eq: return v == text;
+            case RuleOp::Ne: return v != text;
+            case RuleOp::Lt: return v < text;
+            case RuleOp::Le: return v <= text;
+            case RuleOp::Gt: return v > text;
+            case RuleOp::Ge: return v >= text;
+            case RuleOp::Range: return text <= v && v <= strings[0];
+            case RuleOp::In: return std::binary_search(strings.begin(), strings.end(), v,
+                                                       [](std::string_view a, std::string_view b) { return a < b; });
+            case RuleOp::Prefix: return v.substr(0, text.size()) == text;
+            case RuleOp::Contains: return v.find(text) != std::string_view::npos;
+        }
+        return false;
+    }
+};
+
+template <typename T>
+BoundCondition<T> bind_condition(const RuleCondition& cond, const RuleSchema<T>& schema, std::size_t line) {
+    using Type = typename RuleSchema<T>::Type;
+    const auto* field = schema.find(cond.field);
+    if (!field) throw RuleError(line, "unknown field '" + cond.field + "'");
+    bool want_string = field->type == Type::String;
+    for (const RuleLiteral& lit : cond.operands) {
+        if (lit.is_string != want_string) {
+            throw RuleError(line, "field '" + cond.field + "' is " + (want_string ? "a string" : "an integer"));
+        }
+    }
+    if (!want_string && (cond.op == RuleOp::Prefix || cond.op == RuleOp::Contains)) {
+        throw RuleError(line, "prefix/contains need a string field");
+    }
+
+    BoundCondition<T> bound;
+    bound.field = field;
+    bound.op = cond.op;
+    if (want_string) {
+        if (cond.op == RuleOp::In) {
+            for (const RuleLiteral& lit : cond.operands) bound.strings.push_back(lit.text);
+            std::sort(bound.strings.begin(), bound.strings.end());
+        } else {
+            bound.text = cond.operands[0].text;
+            if (cond.op == RuleOp::Range) bound.strings.push_back(cond.operands[1].text);
+        }
+    } else {
+        if (cond.op == RuleOp::In) {
+            for (const RuleLiteral& lit : cond.operands) bound.ints.push_back(lit.number);
+            std::sort(bound.ints.begin(), bound.ints.end());
+        } else {
+            bound.lo = cond.operands[0].number;
+            bound.hi = cond.op == RuleOp::Range ? cond.operands[1].number : bound.lo;
+        }
+    }
+    return bound;
+}
+
+// A single condition on the value itself becomes an indexed SwitchMatch where
+// the value type allows it. Returns false if it has to stay a predicate.
+template <typename T>
+bool structured_match(const BoundCondition<T>& c, SwitchMatch<T>& out) {
+    using M = SwitchMatch<T>;
+    if constexpr (std::is_integral_v<T> && (std::is_signed_v<T> || sizeof(T) < sizeof(std::int64_t))) {
+        constexpr std::int64_t kMin = static_cast<std::int64_t>(std::numeric_limits<T>::min());
+        constexpr std::int64_t kMax = static_cast<std::int64_t>(std::numeric_limits<T>::max());
+        auto fits = [](std::int64_t v) { return kMin <= v && v <= kMax; };
+        std::int64_t lo = kMin, hi = kMax;
+        switch (c.op) {
+            case RuleOp::Eq:
+                if (!fits(c.lo)) return false;
+                out = M::equals(static_cast<T>(c.lo));
+                return true;
+            case RuleOp::In: {
+                std::vector<T> values;
+                for (std::int64_t v : c.ints) {
+                    if (fits(v)) values.push_back(static_cast<T>(v));
+                }
+                out = M::one_of(std::move(values));
+                return true;
+            }
+            case RuleOp::Lt: if (c.lo == kMin) return false; hi = c.lo - 1; break;
+            case RuleOp::Le: hi = c.lo; break;
+            case RuleOp::Gt: if (c.lo == kMax) return false; lo = c.lo + 1; break;
+            case RuleOp::Ge: lo = c.lo; break;
+            case RuleOp::Range: lo = c.lo; hi = c.hi; break;
+            default: return false;
+        }
+        lo = std::max(lo, kMin);
+        hi = std::min(hi, kMax);
+        if (hi < lo) return false;
+        out = M::between(static_cast<T>(lo), static_cast<T>(hi));
+        return true;
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        if (c.op == RuleOp::Eq) {
+            out = M::equals(c.text);
+            return true;
+        }
+        if (c.op == RuleOp::In) {
+            out = M::one_of(c.strings);
+            return true;
+        }
+        return false;
+    } else {
+        (void)c;
+        (void)out;
+        return false;
+    }
+}
+
+} // namespace switch_rules_detail
+
+// Compiles parsed rules into a CompiledSwitch. Case ids follow rule order, so
+// find() returns an index into `rules.rules`. Throws RuleError for unknown
+// fields or actions and for operands of the wrong type. Rules that can never
+// match (see check_reachability) are checked like the others, then removed.
+// If the rules are exhaustive (see check_coverage), the default is dropped
+// and the last rule, unless it is indexed, is not tested. `reach` is
+// check_reachability(rules), for callers that already have it.
+template <typename T>
+CompiledSwitch<T> compile_rules(const RuleSet& rules, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+                                const RuleReachability& reach) {
+    using Bound = switch_rules_detail::BoundCondition<T>;
+    RuleCoverage coverage = check_coverage(rules, reach, schema);
+    CompiledSwitch<T> compiled;
+    auto fields = schema.fields();
+    for (std::size_t index = 0; index < rules.rules.size(); ++index) {
+        const Rule& rule = rules.rules[index];
+        const auto* action = actions.find(rule.action);
+        if (!action) throw RuleError(rule.line, "unknown action '" + rule.action + "'");
+
+        std::vector<Bound> bound;
+        bound.reserve(rule.conditions.size());
+        for (const RuleCondition& cond : rule.conditions) {
+            bound.push_back(switch_rules_detail::bind_condition(cond, schema, rule.line));
+        }
+
+        SwitchMatch<T> match([](const T&) { return false; });
+        if (!(bound.size() == 1 && bound[0].field->identity && switch_rules_detail::structured_match(bound[0], match))) {
+            if (index == coverage.last_rule) {
+                // Reached only when no other rule matched, so it matches.
+                compiled.insert_case(rule.priority, SwitchMatch<T>([](const T&) { return true; }), *action);
+                continue;
+            }
+            match = SwitchMatch<T>([fields, bound = std::move(bound)](const T& value) {
+                for (const Bound& c : bound) {
+                    if (!c.holds(value)) return false;
+                }
+                return true;
+            });
+        }
+        compiled.insert_case(rule.priority, std::move(match), *action);
+    }
+    // Removed only now: a freed id would be reused by the next insert.
+    for (const RuleDiagnostic& d : reach.diagnostics) compiled.remove_case(d.rule);
+    if (!rules.default_action.empty()) {
+        const auto* action = actions.find(rules.default_action);
+        if (!action) throw RuleError(rules.default_line, "unknown action '" + rules.default_action + "'");
+        if (!coverage.exhaustive) compiled.add_default(*action);
+    }
+    return compiled;
+}
+
+template <typename T>
+CompiledSwitch<T> compile_rules(const RuleSet& rules, const RuleSchema<T>& schema, const RuleActions<T>& actions) {
+    return compile_rules(rules, schema, actions, check_reachability(rules));
+}
+
+// Parses and compiles rule text in one step.
+template <typename T>
+CompiledSwitch<T> load_rules(std::string_view text, const RuleSchema<T>& schema, const RuleActions<T>& actions) {
+    return compile_rules(parse_rules(text), schema, actions);
+}
+
+// Reads, parses and compiles a rule file.
+template <typename T>
+CompiledSwitch<T> load_rule_file(const std::string& path, const RuleSchema<T>& schema, const RuleActions<T>& actions) {
+    return compile_rules(parse_rule_file(path), schema, actions);
+}
+
+#endif // SWITCH_RULES_HPP
@@ -0,0 +1,1088 @@
+// Tests for the rule engines, binary rule images and SwitchHandle.
+// - differential: random rule sets (mixed, runs of single values and ranges
+//   that become jump tables, sets full of dead rules, exhaustive sets, and
+//   sets with priorities) are compiled by every engine: CompiledSwitch, the
+//   bytecode VM, the JIT, the tiered switch before and after promotion, the
+//   binary image with and without a key, PlannedSwitch with each strategy,
+//   the same engines on reorder_rules() output, and headers generated by
+//   switch_codegen.hpp (built with $CXX, default c++). Every engine must
+//   return the rule and run the action that a reference trying the rules one
+//   by one finds. The analyses are checked on the same values: a dead rule
+//   never matches first, an exhaustive set always matches, and rules called
+//   disjoint never match the same value.
+// - image: truncated images and images with corrupted words or bytes (with
+//   and without a matching checksum) must be rejected by
+//   SwitchImage::from_memory or ImageSwitch with SwitchImageError, or
+//   evaluate without any other error.
+// - handle: readers that come and go and go offline and online evaluate a
+//   SwitchHandle while writers publish(), update() and reclaim(). No version
+//   may be used after it is freed, no update may be lost, and every retired
+//   version must be freed at the end.
+// Build with -fsanitize=address,undefined to also catch memory errors that
+// do not change a result.
+//
+// Build: g++ -std=c++17 -O2 -pthread -o switch_test switch_test.cpp
+// Usage: ./switch_test [--only differential|image|handle] [--seed S]
+//                      [--sets N] [--codegen N] [--image-mutations N]
+//                      [--handle-ms MS]
+// Exits with 1 if any check fails.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "switch_codegen.hpp"
+#include "switch_handle.hpp"
+#include "switch_planner.hpp"
+#include "switch_tiered.hpp"
+
+using namespace std;
+
+using Rng = mt19937_64;
+
+static const size_t npos = static_cast<size_t>(-1);
+
+static uint64_t below(Rng& rng, uint64_t n) { return rng() % n; }
+static bool chance(Rng& rng, int percent) { return below(rng, 100) < static_cast<uint64_t>(percent); }
+
+// --- Failure reporting ---
+
+static size_t failures = 0;
+
+static ostream& fail() {
+    ++failures;
+    return cerr << "FAIL: ";
+}
+
+// Failures past the first few per section are counted, not printed.
+static bool report_more(size_t section_failures) { return section_failures < 10; }
+
+// --- Value types ---
+
+struct Record {
+    int64_t k = 0;
+    int64_t a = 0;
+    string s;
+};
+
+struct FieldSpec {
+    const char* name;
+    bool is_string;
+};
+
+static bool holds(const RuleCondition& c, int64_t v) {
+    auto n = [&](size_t i) { return c.operands[i].number; };
+    switch (c.op) {
+        case RuleOp::Eq: return v == n(0);
+        case RuleOp::Ne: return v != n(0);
+        case RuleOp::Lt: return v < n(0);
+        case RuleOp::Le: return v <= n(0);
+        case RuleOp::Gt: return v > n(0);
+        case RuleOp::Ge: return v >= n(0);
+        case RuleOp::Range: return n(0) <= v && v <= n(1);
+        case RuleOp::In:
+            for (const RuleLiteral& lit : c.operands) {
+                if (lit.number == v) return true;
+            }
+            return false;
+        default: return false;
+    }
+}
+
+static bool holds(const RuleCondition& c, string_view v) {
+    auto t = [&](size_t i) { return string_view(c.operands[i].text); };
+    switch (c.op) {
+        case RuleOp::Eq: return v == t(0);
+        case RuleOp::Ne: return v != t(0);
+        case RuleOp::Lt: return v < t(0);
+        case RuleOp::Le: return v <= t(0);
+        case RuleOp::Gt: return v > t(0);
+        case RuleOp::Ge: return v >= t(0);
+        case RuleOp::Range: return t(0) <= v && v <= t(1);
+        case RuleOp::In:
+            for (const RuleLiteral& lit : c.operands) {
+                if (lit.text == v) return true;
+            }
+            return false;
+        case RuleOp::Prefix: return v.substr(0, t(0).size()) == t(0);
+        case RuleOp::Contains: return v.find(t(0)) != string_view::npos;
+    }
+    return false;
+}
+
+static string cpp_int(int64_t v) {
+    if (v == numeric_limits<int64_t>::min()) return "(-9223372036854775807 - 1)";
+    if (v == numeric_limits<int>::min()) return "(-2147483647 - 1)";
+    return to_string(v);
+}
+
+static string cpp_string(const string& s) { return "\"" + s + "\""; }
+
+// Records with two integer fields and a string field; rules dispatch on k.
+struct RecordDomain {
+    using Value = Record;
+    static constexpr const char* kName = "record";
+    static constexpr const char* kType = "Record";
+    static constexpr const char* kKey = "k";
+    static constexpr int64_t kMin = numeric_limits<int64_t>::min();
+    static constexpr int64_t kMax = numeric_limits<int64_t>::max();
+
+    static vector<FieldSpec> fields() { return {{"k", false}, {"a", false}, {"s", true}}; }
+
+    static RuleSchema<Record> schema() {
+        RuleSchema<Record> schema;
+        schema.int_field("k", [](const Record& r) { return r.k; })
+              .int_field("a", [](const Record& r) { return r.a; })
+              .string_field("s", [](const Record& r) { return string_view(r.s); });
+        return schema;
+    }
+
+    static bool holds(const RuleCondition& c, const Record& r) {
+        if (c.field == "s") return ::holds(c, string_view(r.s));
+        return ::holds(c, c.field == "k" ? r.k : r.a);
+    }
+
+    static Record make(const vector<int64_t>& ints, const vector<string>& strings, Rng& rng) {
+        return Record{ints[below(rng, ints.size())], ints[below(rng, ints.size())], strings[below(rng, strings.size())]};
+    }
+
+    static string literal(const Record& r) { return "{" + cpp_int(r.k) + ", " + cpp_int(r.a) + ", " + cpp_string(r.s) + "}"; }
+};
+
+// Plain ints; the only field is the value, bounded by the range of int.
+struct IntDomain {
+    using Value = int;
+    static constexpr const char* kName = "int";
+    static constexpr const char* kType = "int";
+    static constexpr const char* kKey = "value";
+    static constexpr int64_t kMin = numeric_limits<int>::min();
+    static constexpr int64_t kMax = numeric_limits<int>::max();
+
+    static vector<FieldSpec> fields() { return {{"value", false}}; }
+
+    static RuleSchema<int> schema() { return RuleSchema<int>(); }
+
+    static bool holds(const RuleCondition& c, int v) { return ::holds(c, static_cast<int64_t>(v)); }
+
+    static int make(const vector<int64_t>& ints, const vector<string>&, Rng& rng) {
+        return static_cast<int>(ints[below(rng, ints.size())]);
+    }
+
+    static string literal(int v) { return cpp_int(v); }
+};
+
+// --- Random rule files ---
+
+static int64_t add_saturated(int64_t v, int64_t d) {
+    if (d > 0 && v > numeric_limits<int64_t>::max() - d) return numeric_limits<int64_t>::max();
+    if (d < 0 && v < numeric_limits<int64_t>::min() - d) return numeric_limits<int64_t>::min();
+    return v + d;
+}
+
+static const char* const kStrings[] = {"", "a", "b", "ab", "ba", "abc", "bca", "aab", "c"};
+
+enum class SetKind { Mixed, Table, Dead, Exhaustive, Priorities };
+constexpr size_t kSetKinds = 5;
+
+static const char* kind_name(SetKind kind) {
+    static const char* const names[] = {"mixed", "table", "dead", "exhaustive", "priorities"};
+    return names[static_cast<size_t>(kind)];
+}
+
+// Writes rule text over `fields`, whose first field is the integer key.
+class RuleWriter {
+public:
+    RuleWriter(Rng& rng, vector<FieldSpec> fields, int64_t min, int64_t max)
+        : rng_(rng), fields_(std::move(fields)), min_(min), max_(max) {}
+
+    int64_t int_value() {
+        if (chance(rng_, 85)) return static_cast<int64_t>(below(rng_, 27)) - 6;
+        const int64_t extremes[] = {min_, max_, min_ + 1, max_ - 1, int64_t{1} << 40, -(int64_t{1} << 40)};
+        return extremes[below(rng_, 6)];
+    }
+
+    string string_value() { return kStrings[below(rng_, size(kStrings))]; }
+
+    const FieldSpec& key() const { return fields_[0]; }
+    const FieldSpec& any_field() { return fields_[below(rng_, fields_.size())]; }
+
+    string condition(const FieldSpec& f) {
+        string out = string(f.name) + " ";
+        auto lit = [&]() { return f.is_string ? cpp_string(string_value()) : to_string(int_value()); };
+        switch (below(rng_, f.is_string ? 10 : 8)) {
+            case 0: case 1: return out + "== " + lit();
+            case 2: return out + "!= " + lit();
+            case 3: return out + (chance(rng_, 50) ? "< " : "<= ") + lit();
+            case 4: return out + (chance(rng_, 50) ? "> " : ">= ") + lit();
+            case 5:
+                if (f.is_string) {
+                    string lo = string_value(), hi = string_value();
+                    if (hi < lo) swap(lo, hi);
+                    return out + "in " + cpp_string(lo) + ".." + cpp_string(hi);
+                } else {
+                    int64_t lo = int_value();
+                    // Now and then an empty range.
+                    int64_t hi = chance(rng_, 5) ? add_saturated(lo, -1) : add_saturated(lo, static_cast<int64_t>(below(rng_, 8)));
+                    return out + "in " + to_string(lo) + ".." + to_string(hi);
+                }
+            case 6: case 7: {
+                out += "in {";
+                size_t n = 1 + below(rng_, 4);
+                for (size_t i = 0; i < n; ++i) out += (i ? ", " : "") + lit();
+                return out + "}";
+            }
+            case 8: return out + "prefix " + cpp_string(string_value());
+            default: return out + "contains " + cpp_string(string_value());
+        }
+    }
+
+    string conditions(size_t max) {
+        size_t n = 1 + below(rng_, max);
+        string out;
+        for (size_t i = 0; i < n; ++i) out += (i ? " and " : "") + condition(any_field());
+        return out;
+    }
+
+    void rule(const string& conditions, int priority = 0) {
+        text_ += "rule r" + to_string(count_++);
+        if (priority != 0 || chance(rng_, 5)) text_ += " priority " + to_string(priority);
+        text_ += ": " + conditions + " -> act" + to_string(below(rng_, 4)) + "\n";
+        history_.push_back(conditions);
+    }
+
+    // Random conditions; now and then on the key alone.
+    void mixed_rule(int priority = 0) {
+        rule(chance(rng_, 30) ? condition(key()) : conditions(3), priority);
+    }
+
+    string text() { return text_ + (chance(rng_, 50) ? "default -> fallback\n" : ""); }
+
+    void generate(SetKind kind) {
+        switch (kind) {
+            case SetKind::Mixed:
+                for (size_t n = 1 + below(rng_, 24), i = 0; i < n; ++i) mixed_rule();
+                break;
+            case SetKind::Table: table(); break;
+            case SetKind::Dead: dead(); break;
+            case SetKind::Exhaustive: exhaustive(); break;
+            case SetKind::Priorities:
+                for (size_t n = 1 + below(rng_, 24), i = 0; i < n; ++i) mixed_rule(static_cast<int>(below(rng_, 7)) - 3);
+                break;
+        }
+    }
+
+private:
+    // Runs of single key values and of adjacent ranges, dispatched through a
+    // switch, a range cascade or a segment table.
+    void table() {
+        string k = key().name;
+        for (size_t runs = 1 + below(rng_, 3); runs > 0; --runs) {
+            int64_t start = static_cast<int64_t>(below(rng_, 60)) - 20;
+            int64_t len = 3 + static_cast<int64_t>(below(rng_, 30));
+            bool ranges = chance(rng_, 30);
+            for (int64_t j = 0; j < len; ++j) {
+                if (ranges) {
+                    rule(k + " in " + to_string(start + 2 * j) + ".." + to_string(start + 2 * j + 1));
+                } else if (chance(rng_, 10)) {
+                    rule(k + " in {" + to_string(start + j) + ", " + to_string(start + j + 40) + "}");
+                } else {
+                    rule(k + " == " + to_string(start + j));
+                }
+                if (chance(rng_, 8)) rule(k + " == " + to_string(start + static_cast<int64_t>(below(rng_, len)))); // Maybe shadowed.
+                if (chance(rng_, 8)) mixed_rule();
+            }
+        }
+    }
+
+    // Duplicates, narrowed copies and contradictions of earlier rules.
+    void dead() {
+        string k = key().name;
+        for (size_t n = 2 + below(rng_, 24), i = 0; i < n; ++i) {
+            if (history_.empty() || chance(rng_, 50)) {
+                mixed_rule();
+                continue;
+            }
+            const string earlier = history_[below(rng_, history_.size())];
+            switch (below(rng_, 4)) {
+                case 0: rule(earlier); break;
+                case 1: rule(earlier + " and " + condition(any_field())); break;
+                case 2: rule(condition(any_field()) + " and " + earlier); break;
+                default: {
+                    int64_t x = int_value();
+                    rule(k + " < " + to_string(x) + " and " + k + " > " + to_string(add_saturated(x, static_cast<int64_t>(below(rng_, 3)))));
+                    break;
+                }
+            }
+        }
+    }
+
+    // A partition of one field, among other rules, so no value falls through.
+    void exhaustive() {
+        for (size_t n = below(rng_, 6), i = 0; i < n; ++i) mixed_rule();
+        vector<FieldSpec> ints;
+        for (const FieldSpec& f : fields_) {
+            if (!f.is_string) ints.push_back(f);
+        }
+        bool on_string = fields_.size() > 1 && chance(rng_, 20);
+        vector<string> parts;
+        if (on_string) {
+            string cut = kStrings[1 + below(rng_, size(kStrings) - 1)];
+            parts = {"s < " + cpp_string(cut), "s >= " + cpp_string(cut)};
+        } else {
+            string f = ints[below(rng_, ints.size())].name;
+            set<int64_t> cut_set;
+            for (size_t n = 1 + below(rng_, 5), i = 0; i < n; ++i) cut_set.insert(static_cast<int64_t>(below(rng_, 30)) - 10);
+            vector<int64_t> cuts(cut_set.begin(), cut_set.end());
+            parts.push_back(chance(rng_, 50) ? f + " < " + to_string(cuts[0]) : f + " <= " + to_string(cuts[0] - 1));
+            for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+                parts.push_back(f + " in " + to_string(cuts[i]) + ".." + to_string(cuts[i + 1] - 1));
+            }
+            // The last part may rely on the field's bounds.
+            parts.push_back(chance(rng_, 50) ? f + " >= " + to_string(cuts.back())
+                                             : f + " in " + to_string(cuts.back()) + ".." + to_string(max_));
+        }
+        shuffle(parts.begin(), parts.end(), rng_);
+        bool priorities = chance(rng_, 30);
+        for (const string& p : parts) {
+            int priority = priorities ? static_cast<int>(below(rng_, 5)) - 2 : 0;
+            if (chance(rng_, 15)) {
+                // The same part, split again.
+                rule(p + " and " + condition(any_field()), priority);
+                rule(p, priority);
+            } else {
+                rule(p, priority);
+            }
+        }
+        for (size_t n = below(rng_, 3), i = 0; i < n; ++i) mixed_rule(); // Dead when nothing falls through.
+    }
+
+    Rng& rng_;
+    vector<FieldSpec> fields_;
+    int64_t min_, max_;
+    string text_;
+    size_t count_ = 0;
+    vector<string> history_;
+};
+
+// Values around every literal of `rules`, and the extremes.
+template <typename D>
+vector<typename D::Value> sample_values(const RuleSet& rules, Rng& rng) {
+    set<int64_t> ints = {D::kMin, D::kMax, D::kMin + 1, D::kMax - 1, 0, 1, -1};
+    set<string> strings(begin(kStrings), end(kStrings));
+    for (const Rule& rule : rules.rules) {
+        for (const RuleCondition& c : rule.conditions) {
+            for (const RuleLiteral& lit : c.operands) {
+                if (lit.is_string) {
+                    strings.insert(lit.text);
+                    strings.insert(lit.text + "a");
+                    if (!lit.text.empty()) strings.insert(lit.text.substr(0, lit.text.size() - 1));
+                } else {
+                    for (int64_t d = -1; d <= 1; ++d) {
+                        int64_t v = add_saturated(lit.number, d);
+                        if (v >= D::kMin && v <= D::kMax) ints.insert(v);
+                    }
+                }
+            }
+        }
+    }
+    vector<int64_t> int_list(ints.begin(), ints.end());
+    vector<string> string_list(strings.begin(), strings.end());
+    vector<typename D::Value> values;
+    for (size_t i = 0; i < 400; ++i) values.push_back(D::make(int_list, string_list, rng));
+    return values;
+}
+
+// --- Reference ---
+
+template <typename D>
+bool rule_matches(const Rule& rule, const typename D::Value& v) {
+    for (const RuleCondition& c : rule.conditions) {
+        if (!D::holds(c, v)) return false;
+    }
+    return true;
+}
+
+// Tries the rules one by one, by priority, then in file order.
+template <typename D>
+size_t reference_find(const RuleSet& rules, const typename D::Value& v) {
+    vector<size_t> order(rules.rules.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    stable_sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return rules.rules[a].priority < rules.rules[b].priority; });
+    for (size_t i : order) {
+        if (rule_matches<D>(rules.rules[i], v)) return i;
+    }
+    return npos;
+}
+
+// --- Engines ---
+
+// The action run by the last evaluation: 0..3 for act0..act3, 4 for the default.
+static int fired = -1;
+
+static int action_id(const string& name) { return name == "fallback" ? 4 : name.back() - '0'; }
+
+template <typename T>
+RuleActions<T> test_actions() {
+    RuleActions<T> actions;
+    for (int i = 0; i < 4; ++i) actions.bind("act" + to_string(i), [i](const T&) { fired = i; });
+    actions.bind("fallback", [](const T&) { fired = 4; });
+    return actions;
+}
+
+template <typename T>
+struct Engine {
+    string name;
+    function<size_t(const T&)> find;
+    function<bool(const T&)> evaluate;
+};
+
+template <typename T, typename S>
+Engine<T> engine(string name, shared_ptr<S> sw) {
+    return Engine<T>{std::move(name), [sw](const T& v) { return sw->find(v); }, [sw](const T& v) { return sw->evaluate(v); }};
+}
+
+// An image and the aligned copy of the bytes it points into.
+struct ImageHolder {
+    vector<uint64_t> storage;
+    unique_ptr<SwitchImage> image;
+};
+
+template <typename T>
+Engine<T> image_engine(string name, const RuleSet& rules, const string& key, const RuleReachability& reach,
+                       const RuleSchema<T>& schema, const RuleActions<T>& actions) {
+    vector<unsigned char> bytes = build_switch_image(rules, key, reach);
+    auto holder = make_shared<ImageHolder>();
+    holder->storage.resize((bytes.size() + 7) / 8);
+    memcpy(holder->storage.data(), bytes.data(), bytes.size());
+    holder->image = make_unique<SwitchImage>(SwitchImage::from_memory(holder->storage.data(), bytes.size()));
+    auto sw = make_shared<ImageSwitch<T>>(*holder->image, schema, actions);
+    return Engine<T>{std::move(name), [holder, sw](const T& v) { return sw->find(v); },
+                     [holder, sw](const T& v) { return sw->evaluate(v); }};
+}
+
+template <typename T>
+vector<Engine<T>> build_engines(const RuleSet& rules, const RuleReachability& reach, const string& key,
+                                const RuleSchema<T>& schema, const RuleActions<T>& actions) {
+    vector<Engine<T>> engines;
+    engines.push_back(engine<T>("compiled", make_shared<CompiledSwitch<T>>(compile_rules(rules, schema, actions))));
+    engines.push_back(engine<T>("bytecode", make_shared<BytecodeSwitch<T>>(compile_bytecode(rules, schema), schema, actions)));
+    engines.push_back(engine<T>("jit", make_shared<JitSwitch<T>>(compile_bytecode(rules, schema, reach), schema, actions)));
+    engines.push_back(image_engine<T>("image:" + key, rules, key, reach, schema, actions));
+    engines.push_back(image_engine<T>("image:nokey", rules, "", reach, schema, actions));
+    for (size_t s = 0; s < kRuleStrategies; ++s) {
+        SwitchPlan plan;
+        plan.strategy = static_cast<RuleStrategy>(s);
+        engines.push_back(engine<T>(string("planned:") + strategy_name(plan.strategy),
+                                    make_shared<PlannedSwitch<T>>(rules, schema, actions, key, plan)));
+    }
+    return engines;
+}
+
+// --- Differential test ---
+
+struct CodegenCase {
+    string domain; // kName of the domain.
+    string type;
+    string text;
+    CodegenOptions options;
+    vector<string> values;  // C++ literals.
+    vector<size_t> expected;
+};
+
+struct DifferentialStats {
+    size_t sets = 0, values = 0, checks = 0, dead = 0, exhaustive = 0, section_failures = 0;
+};
+
+// Returns false on the first value `e` gets wrong.
+template <typename D>
+bool check_engine(const Engine<typename D::Value>& e, const RuleSet& rules, const vector<typename D::Value>& values,
+                  const vector<size_t>& expected, const string& where, DifferentialStats& stats) {
+    for (size_t i = 0; i < values.size(); ++i) {
+        const auto& v = values[i];
+        size_t got = e.find(v);
+        fired = -1;
+        bool matched = e.evaluate(v);
+        int want_action = expected[i] != npos ? action_id(rules.rules[expected[i]].action)
+                                              : rules.default_action.empty() ? -1 : 4;
+        ++stats.checks;
+        if (got != expected[i] || matched != (expected[i] != npos) || fired != want_action) {
+            if (report_more(stats.section_failures++)) {
+                fail() << where << ": " << e.name << " on " << D::literal(v) << ": find " << static_cast<long long>(got)
+                       << ", evaluate " << matched << " ran " << fired << "; expected rule "
+                       << static_cast<long long>(expected[i]) << " and action " << want_action << "\n";
+            } else {
+                ++failures;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename D>
+void differential_set(Rng& rng, SetKind kind, size_t index, bool keep_for_codegen, vector<CodegenCase>& codegen,
+                      DifferentialStats& stats) {
+    using T = typename D::Value;
+    RuleWriter writer(rng, D::fields(), D::kMin, D::kMax);
+    writer.generate(kind);
+    string text = writer.text();
+    string where = string(D::kName) + " set " + to_string(index) + " (" + kind_name(kind) + ")";
+    auto report = [&](const string& message) {
+        if (report_more(stats.section_failures++)) {
+            fail() << where << ": " << message << "\n" << text;
+        } else {
+            ++failures;
+        }
+    };
+
+    try {
+        RuleSet rules = parse_rules(text);
+        RuleSchema<T> schema = D::schema();
+        RuleActions<T> actions = test_actions<T>();
+        RuleReachability reach = check_reachability(rules);
+        RuleCoverage coverage = check_coverage(rules, reach, schema);
+        vector<T> values = sample_values<D>(rules, rng);
+        vector<size_t> expected;
+        for (const T& v : values) expected.push_back(reference_find<D>(rules, v));
+        ++stats.sets;
+        stats.values += values.size();
+        stats.dead += reach.diagnostics.size();
+        stats.exhaustive += coverage.exhaustive;
+
+        // The analyses.
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (expected[i] != npos && reach.dead(expected[i])) {
+                report("rule " + to_string(expected[i]) + " was found dead but matches " + D::literal(values[i]));
+                break;
+            }
+            if (expected[i] == npos && coverage.exhaustive) {
+                report("rules were found exhaustive but none matches " + D::literal(values[i]));
+                break;
+            }
+        }
+        for (const auto& group : disjoint_groups(rules, reach)) {
+            for (const T& v : values) {
+                size_t matching = 0;
+                for (size_t r : group) matching += rule_matches<D>(rules.rules[r], v);
+                if (matching > 1) {
+                    report("a disjoint group has two rules matching " + D::literal(v));
+                    break;
+                }
+            }
+        }
+        for (size_t pairs = 0; pairs < 32 && rules.rules.size() > 1; ++pairs) {
+            size_t a = below(rng, rules.rules.size()), b = below(rng, rules.rules.size());
+            if (a == b || !rules_disjoint(rules.rules[a], rules.rules[b])) continue;
+            for (const T& v : values) {
+                if (rule_matches<D>(rules.rules[a], v) && rule_matches<D>(rules.rules[b], v)) {
+                    report("rules " + to_string(a) + " and " + to_string(b) + " were found disjoint but both match " +
+                           D::literal(v));
+                    break;
+                }
+            }
+        }
+
+        bool shown = false;
+        auto check = [&](const Engine<T>& e) {
+            if (!check_engine<D>(e, rules, values, expected, where, stats) && !shown) {
+                shown = true;
+                cerr << text;
+            }
+        };
+
+        // Every engine, on the rules as written.
+        for (const auto& e : build_engines<T>(rules, reach, D::kKey, schema, actions)) {
+            check(e);
+        }
+
+        // Tier 0 counts the matches, which order the rules of the promoted tier.
+        TieringOptions tiering;
+        tiering.hot_after = numeric_limits<uint64_t>::max();
+        tiering.background = false;
+        auto tiered = make_shared<TieredSwitch<T>>(rules, schema, actions, tiering);
+        check(engine<T>("tiered:interpreted", tiered));
+        tiered->promote();
+        check(engine<T>("tiered:promoted", tiered));
+
+        // Reordered by random hit counts: the same rule must match.
+        vector<uint64_t> hits(rules.rules.size());
+        for (auto& h : hits) h = below(rng, 4) == 0 ? 0 : below(rng, 1000);
+        RuleSet reordered = reorder_rules(rules, hits, reach);
+        for (size_t i = 0; i < values.size(); ++i) {
+            size_t got = reference_find<D>(reordered, values[i]);
+            if (got != expected[i]) {
+                report("reorder_rules() changes the match for " + D::literal(values[i]) + " from " +
+                       to_string(static_cast<long long>(expected[i])) + " to " + to_string(static_cast<long long>(got)));
+                break;
+            }
+        }
+        for (auto e : build_engines<T>(reordered, check_reachability(reordered), D::kKey, schema, actions)) {
+            e.name = "reordered " + e.name;
+            check(e);
+        }
+
+        if (keep_for_codegen) {
+            CodegenCase c;
+            c.domain = D::kName;
+            c.type = D::kType;
+            c.text = text;
+            c.options.name = "g" + to_string(codegen.size());
+            c.options.key_field = chance(rng, 80) ? D::kKey : "";
+            const size_t limits[] = {0, 1, 3, 8, 1000};
+            c.options.cascade_limit = limits[below(rng, 5)];
+            for (const T& v : values) c.values.push_back(D::literal(v));
+            c.expected = expected;
+            codegen.push_back(std::move(c));
+        }
+    } catch (const exception& e) {
+        report(string("unexpected exception: ") + e.what());
+    }
+}
+
+// Compiles all generated headers into one driver that checks them against
+// the reference results. Returns false if no compiler could be run.
+static bool run_codegen(const vector<CodegenCase>& cases, uint64_t seed, DifferentialStats& stats) {
+    const char* env = getenv("CXX");
+    string cxx = env && *env ? env : "c++";
+    if (system((cxx + " --version > /dev/null 2>&1").c_str()) != 0) return false;
+
+    filesystem::path dir = filesystem::temp_directory_path() / ("switch_test_" + to_string(seed) + "_" + to_string(random_device()()));
+    filesystem::create_directories(dir);
+    ostringstream driver;
+    driver << "#include <cstdint>\n#include <cstdio>\n\n"
+           << "// Like Record, but constant-initialized.\n"
+           << "struct Record {\n    std::int64_t k;\n    std::int64_t a;\n    const char* s;\n};\n\n";
+    for (const CodegenCase& c : cases) {
+        try {
+            ofstream(dir / (c.options.name + ".hpp")) << generate_switch_header(parse_rules(c.text), c.options);
+        } catch (const exception& e) {
+            fail() << "codegen " << c.options.name << ": " << e.what() << "\n" << c.text;
+            return true;
+        }
+        driver << "#include \"" << c.options.name << ".hpp\"\n";
+    }
+    driver << "\nint main() {\n    int bad = 0;\n";
+    for (const CodegenCase& c : cases) {
+        driver << "    {\n        static const " << c.type << " values[] = {";
+        for (size_t i = 0; i < c.values.size(); ++i) driver << (i ? ", " : "") << c.values[i];
+        driver << "};\n        static const std::size_t expected[] = {";
+        for (size_t i = 0; i < c.expected.size(); ++i) {
+            driver << (i ? ", " : "") << (c.expected[i] == npos ? "static_cast<std::size_t>(-1)" : to_string(c.expected[i]));
+        }
+        driver << "};\n        for (std::size_t i = 0; i < " << c.values.size() << "; ++i) {\n"
+               << "            if (" << c.options.name << "::find(values[i]) != expected[i]) {\n"
+               << "                std::printf(\"" << c.options.name << " %zu\\n\", i);\n"
+               << "                ++bad;\n                break;\n            }\n        }\n    }\n";
+        stats.checks += c.values.size();
+    }
+    driver << "    return bad;\n}\n";
+    ofstream(dir / "driver.cpp") << driver.str();
+
+    string exe = (dir / "driver").string();
+    string compile = cxx + " -std=c++17 -O1 -o " + exe + " " + (dir / "driver.cpp").string() + " 2> " + (dir / "errors.txt").string();
+    if (system(compile.c_str()) != 0) {
+        fail() << "generated headers do not compile; see " << dir.string() << "/errors.txt\n";
+        return true;
+    }
+    string run = exe + " > " + (dir / "mismatches.txt").string();
+    if (system(run.c_str()) != 0) {
+        ifstream in(dir / "mismatches.txt");
+        string line;
+        while (getline(in, line)) {
+            size_t space = line.find(' ');
+            size_t n = static_cast<size_t>(stoul(line.substr(1, space - 1)));
+            fail() << "generated " << cases[n].domain << " header " << line.substr(0, space) << " (key '"
+                   << cases[n].options.key_field << "', cascade limit " << cases[n].options.cascade_limit
+                   << ") differs on value " << line.substr(space + 1) << "\n" << cases[n].text;
+        }
+        return true;
+    }
+    filesystem::remove_all(dir);
+    return true;
+}
+
+static void test_differential(uint64_t seed, size_t sets, size_t codegen_sets) {
+    Rng rng(seed);
+    DifferentialStats stats;
+    vector<CodegenCase> codegen;
+    for (size_t i = 0; i < sets; ++i) {
+        SetKind kind = static_cast<SetKind>(i % kSetKinds);
+        bool keep = codegen.size() < codegen_sets;
+        if (i % 4 == 3) {
+            differential_set<IntDomain>(rng, kind, i, keep, codegen, stats);
+        } else {
+            differential_set<RecordDomain>(rng, kind, i, keep, codegen, stats);
+        }
+    }
+    string note;
+    if (!codegen.empty() && !run_codegen(codegen, seed, stats)) note = " (generated headers skipped: no compiler; set CXX)";
+    cout << "differential: " << stats.sets << " rule sets (" << stats.dead << " dead rules, " << stats.exhaustive
+         << " exhaustive sets), " << stats.values << " values, " << stats.checks << " engine checks" << note << "\n";
+}
+
+// --- Corrupted images ---
+
+struct ImageStats {
+    size_t images = 0, accepted = 0, rejected = 0, section_failures = 0;
+};
+
+// Loads `size` bytes at `data` and evaluates `values` on the result. Any
+// error but SwitchImageError is a failure.
+template <typename T>
+void load_image(const void* data, size_t size, bool verify, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+                const vector<T>& values, const string& what, ImageStats& stats) {
+    try {
+        SwitchImage image = SwitchImage::from_memory(data, size, verify);
+        ImageSwitch<T> sw(image, schema, actions);
+        for (const T& v : values) {
+            sw.find(v);
+            sw.evaluate(v);
+        }
+        ++stats.accepted;
+    } catch (const SwitchImageError&) {
+        ++stats.rejected;
+    } catch (const exception& e) {
+        if (report_more(stats.section_failures++)) {
+            fail() << "image " << what << ": " << e.what() << "\n";
+        } else {
+            ++failures;
+        }
+    }
+}
+
+static void fix_checksum(vector<uint64_t>& buf, size_t size) {
+    namespace fmt = switch_image_format;
+    auto* bytes = reinterpret_cast<unsigned char*>(buf.data());
+    auto* h = reinterpret_cast<fmt::Header*>(bytes);
+    h->checksum = fmt::fnv1a(bytes + sizeof(fmt::Header), size - sizeof(fmt::Header));
+}
+
+template <typename D>
+void corrupt_image(const string& text, const string& key, Rng& rng, size_t mutations, ImageStats& stats) {
+    using T = typename D::Value;
+    RuleSet rules = parse_rules(text);
+    RuleSchema<T> schema = D::schema();
+    RuleActions<T> actions = test_actions<T>();
+    vector<T> values = sample_values<D>(rules, rng);
+    vector<unsigned char> bytes = build_switch_image(rules, key);
+    size_t size = bytes.size();
+    vector<uint64_t> original((size + 7) / 8);
+    memcpy(original.data(), bytes.data(), size);
+    vector<uint64_t> buf = original;
+    auto* data = reinterpret_cast<unsigned char*>(buf.data());
+    string name = string(D::kName) + " image keyed on '" + key + "'";
+    ++stats.images;
+
+    size_t rejected = stats.rejected;
+    load_image<T>(data, size, true, schema, actions, values, name, stats);
+    if (stats.rejected != rejected) fail() << name << ": the intact image is rejected\n";
+
+    // Every truncation.
+    for (size_t n = 0; n < size; ++n) {
+        rejected = stats.rejected;
+        load_image<T>(data, n, false, schema, actions, values, name + " truncated", stats);
+        if (stats.rejected == rejected) fail() << name << ": truncated to " << n << " of " << size << " bytes is accepted\n";
+    }
+
+    // Every 32-bit word set to values that tend to break bounds checks, with
+    // the checksum fixed up so the structure checks are reached.
+    const size_t checksum_at = offsetof(switch_image_format::Header, checksum);
+    for (size_t at = 0; at + 4 <= size; at += 4) {
+        if (at >= checksum_at && at < checksum_at + 8) continue;
+        uint32_t word;
+        memcpy(&word, data + at, 4);
+        const uint32_t replacements[] = {0, 1, 2, 7, 8, 0x7FFFFFFFu, 0x80000000u, 0xFFFFFFFEu, 0xFFFFFFFFu,
+                                         word + 1, word - 1, word ^ 0x10000u, static_cast<uint32_t>(size),
+                                         static_cast<uint32_t>(size / 8)};
+        for (uint32_t r : replacements) {
+            if (r == word) continue;
+            memcpy(data + at, &r, 4);
+            fix_checksum(buf, size);
+            load_image<T>(data, size, true, schema, actions, values, name + " with word " + to_string(at) + " = " + to_string(r), stats);
+        }
+        buf = original;
+    }
+
+    // Random bytes; without a fixed checksum they must be caught by it.
+    for (size_t m = 0; m < mutations; ++m) {
+        for (size_t n = 1 + below(rng, 8); n > 0; --n) {
+            size_t at = sizeof(switch_image_format::Header) + below(rng, size - sizeof(switch_image_format::Header));
+            data[at] = chance(rng, 50) ? static_cast<unsigned char>(data[at] ^ (1u << below(rng, 8)))
+                                       : static_cast<unsigned char>(rng());
+        }
+        if (memcmp(buf.data(), original.data(), size) != 0) {
+            if (chance(rng, 30)) {
+                rejected = stats.rejected;
+                load_image<T>(data, size, true, schema, actions, values, name + " with bytes changed", stats);
+                if (stats.rejected == rejected) fail() << name << ": changed bytes pass the checksum\n";
+                load_image<T>(data, size, false, schema, actions, values, name + " with bytes changed, unverified", stats);
+            } else {
+                fix_checksum(buf, size);
+                load_image<T>(data, size, true, schema, actions, values, name + " with bytes changed", stats);
+            }
+        }
+        buf = original;
+    }
+}
+
+static void test_images(uint64_t seed, size_t mutations) {
+    Rng rng(seed);
+    ImageStats stats;
+    const string records =
+        "rule k1: k == 1 -> act0\n"
+        "rule k2: k in 2..5 -> act1\n"
+        "rule k3: k in {7, 9, 11} -> act2\n"
+        "rule mixed priority -1: a > 3 and s prefix \"ab\" -> act3\n"
+        "rule strs: s in {\"a\", \"b\", \"bca\"} and k != 4 -> act0\n"
+        "rule range: s in \"b\"..\"c\" and a in -5..5 -> act1\n"
+        "rule has: s contains \"c\" -> act2\n"
+        "rule big: k >= 1000 -> act3\n"
+        "default -> fallback\n";
+    const string strings =
+        "rule s1: s == \"a\" -> act0\n"
+        "rule s2: s == \"ab\" -> act1\n"
+        "rule s3: s == \"abc\" -> act2\n"
+        "rule s4: s == \"bca\" -> act3\n"
+        "rule s5: s == \"c\" -> act0\n"
+        "rule other: k < 0 and s prefix \"b\" -> act1\n"
+        "default -> fallback\n";
+    const string ints =
+        "rule neg: value < 0 -> act0\n"
+        "rule small: value in 0..9 -> act1\n"
+        "rule set: value in {10, 12, 14} -> act2\n"
+        "rule rest: value >= 15 -> act3\n";
+    corrupt_image<RecordDomain>(records, "k", rng, mutations, stats);
+    corrupt_image<RecordDomain>(records, "", rng, mutations, stats);
+    corrupt_image<RecordDomain>(strings, "s", rng, mutations, stats);
+    corrupt_image<IntDomain>(ints, "value", rng, mutations, stats);
+    cout << "image: " << stats.images << " images, " << stats.rejected << " corrupted loads rejected, "
+         << stats.accepted << " accepted and evaluated\n";
+}
+
+// --- SwitchHandle under concurrent readers and writers ---
+
+// Marks when the version whose canary case holds it is freed.
+struct VersionTag {
+    atomic<bool> freed{false};
+};
+
+struct TagGuard {
+    explicit TagGuard(VersionTag* t) : tag(t) {}
+    TagGuard(const TagGuard&) = delete;
+    TagGuard& operator=(const TagGuard&) = delete;
+    ~TagGuard() { tag->freed.store(true, memory_order_release); }
+
+    VersionTag* tag;
+};
+
+static atomic<uint64_t> used_after_free{0};
+
+constexpr int kCanary = -1;
+
+// Matches kCanary and notes if it runs after its version was freed. The
+// guard is shared by copies (see update()) until one replaces the canary.
+static SwitchMatch<int> canary(VersionTag* tag) {
+    auto guard = make_shared<TagGuard>(tag);
+    return SwitchMatch<int>([tag, guard](const int& v) {
+        if (tag->freed.load(memory_order_acquire)) used_after_free.fetch_add(1, memory_order_relaxed);
+        return v == kCanary;
+    });
+}
+
+static void noop(const int&) {}
+
+// Case 0 is the canary; the others match their own token.
+static CompiledSwitch<int> handle_version(VersionTag* tag, int tokens) {
+    CompiledSwitch<int> sw;
+    sw.insert_case(-1, canary(tag), noop);
+    for (int t = 1; t <= tokens; ++t) sw.add_case(SwitchMatch<int>::equals(1000000 + t), noop);
+    return sw;
+}
+
+struct HandleStats {
+    atomic<uint64_t> evaluations{0}, readers{0}, wrong{0};
+};
+
+// Readers that register, go offline and online, and unregister at random.
+static void handle_reader(SwitchHandle<int>& handle, atomic<bool>& stop, uint64_t seed, HandleStats& stats) {
+    Rng rng(seed);
+    while (!stop.load(memory_order_acquire)) {
+        SwitchReader<int> reader(handle, 1 + static_cast<unsigned>(below(rng, 64)));
+        stats.readers.fetch_add(1, memory_order_relaxed);
+        for (size_t n = 100 + below(rng, 3000); n > 0 && !stop.load(memory_order_relaxed); --n) {
+            // The canary is case 0 in every version.
+            if (reader.find(kCanary) != 0) stats.wrong.fetch_add(1, memory_order_relaxed);
+            reader.evaluate(static_cast<int>(below(rng, 3000)) + 1000000);
+            stats.evaluations.fetch_add(1, memory_order_relaxed);
+            if (chance(rng, 2)) {
+                reader.offline();
+                if (chance(rng, 50)) this_thread::yield();
+                reader.online();
+            }
+        }
+    }
+}
+
+static void test_handle(uint64_t seed, int duration_ms) {
+    const int kReaders = 6, kUpdaters = 3, kUpdates = 400, kPublishes = 300;
+    const size_t kVersions = 1 + kUpdaters * kUpdates + kPublishes;
+    vector<VersionTag> tags(kVersions + kUpdaters * kUpdates);
+    atomic<size_t> next_tag{1};
+    HandleStats stats;
+    used_after_free = 0;
+    auto start = chrono::steady_clock::now();
+
+    {
+        SwitchHandle<int> handle(handle_version(&tags[0], 0));
+
+        // Phase 1: updates only, so every token added must survive.
+        {
+            atomic<bool> stop{false};
+            vector<thread> threads;
+            for (int r = 0; r < kReaders; ++r) threads.emplace_back(handle_reader, ref(handle), ref(stop), seed + r, ref(stats));
+            vector<thread> writers;
+            for (int u = 0; u < kUpdaters; ++u) {
+                writers.emplace_back([&, u] {
+                    for (int i = 0; i < kUpdates; ++i) {
+                        int token = 1000000 + u * kUpdates + i + 1;
+                        VersionTag* tag = &tags[next_tag.fetch_add(1)];
+                        handle.update([&](CompiledSwitch<int>& sw) {
+                            sw.remove_case(0);
+                            sw.insert_case(-1, canary(tag), noop); // Reuses id 0.
+                            sw.add_case(SwitchMatch<int>::equals(token), noop);
+                        });
+                        if (i % 64 == 0) handle.reclaim();
+                    }
+                });
+            }
+            for (auto& t : writers) t.join();
+            stop = true;
+            for (auto& t : threads) t.join();
+        }
+        {
+            SwitchReader<int> reader(handle);
+            for (int t = 1; t <= kUpdaters * kUpdates; ++t) {
+                if (reader.find(1000000 + t) == npos) {
+                    fail() << "handle: the update adding token " << t << " was lost\n";
+                    break;
+                }
+            }
+        }
+        if (handle.version() != 1 + kUpdaters * kUpdates) {
+            fail() << "handle: " << handle.version() << " versions after " << kUpdaters * kUpdates << " updates\n";
+        }
+
+        // Phase 2: publish(), update() and reclaim() racing, for at least
+        // `duration_ms`.
+        {
+            atomic<bool> stop{false};
+            vector<thread> threads;
+            for (int r = 0; r < kReaders; ++r) threads.emplace_back(handle_reader, ref(handle), ref(stop), seed + 100 + r, ref(stats));
+            thread publisher([&] {
+                Rng rng(seed + 200);
+                for (int i = 0; i < kPublishes; ++i) {
+                    handle.publish(handle_version(&tags[next_tag.fetch_add(1)], static_cast<int>(below(rng, 50))));
+                    if (chance(rng, 30)) this_thread::yield();
+                }
+            });
+            thread updater([&] {
+                for (int i = 0; i < kUpdaters * kUpdates; ++i) {
+                    VersionTag* tag = &tags[next_tag.fetch_add(1)];
+                    handle.update([&](CompiledSwitch<int>& sw) {
+                        sw.remove_case(0);
+                        sw.insert_case(-1, canary(tag), noop);
+                    });
+                }
+            });
+            thread reclaimer([&] {
+                while (!stop.load(memory_order_acquire)) {
+                    handle.reclaim();
+                    this_thread::yield();
+                }
+            });
+            publisher.join();
+            updater.join();
+            while (chrono::steady_clock::now() - start < chrono::milliseconds(duration_ms)) this_thread::sleep_for(chrono::milliseconds(1));
+            stop = true;
+            reclaimer.join();
+            for (auto& t : threads) t.join();
+        }
+        if (handle.reclaim() != 0) fail() << "handle: retired versions remain with no readers\n";
+        size_t freed = 0;
+        for (size_t i = 0; i < next_tag.load(); ++i) freed += tags[i].freed.load();
+        if (freed + 1 != next_tag.load()) {
+            fail() << "handle: " << freed << " of " << next_tag.load() - 1 << " replaced versions freed\n";
+        }
+    }
+    if (used_after_free != 0) fail() << "handle: " << used_after_free << " evaluations used a freed version\n";
+    if (stats.wrong != 0) fail() << "handle: " << stats.wrong << " evaluations found the wrong case\n";
+    cout << "handle: " << next_tag.load() << " versions, " << stats.readers << " reader registrations, "
+         << stats.evaluations << " evaluations\n";
+}
+
+static void print_usage() {
+    cerr << "usage: switch_test [--only differential|image|handle] [--seed S] [--sets N] [--codegen N]\n"
+            "                   [--image-mutations N] [--handle-ms MS]\n";
+}
+
+int main(int argc, char** argv) {
+    string only;
+    uint64_t seed = 1;
+    size_t sets = 1000, codegen_sets = 40, mutations = 20000;
+    int handle_ms = 500;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* value = nullptr;
+        if (arg == "--only" && (value = next())) {
+            only = value;
+        } else if (arg == "--seed" && (value = next())) {
+            seed = strtoull(value, nullptr, 10);
+        } else if (arg == "--sets" && (value = next())) {
+            sets = static_cast<size_t>(strtoul(value, nullptr, 10));
+        } else if (arg == "--codegen" && (value = next())) {
+            codegen_sets = static_cast<size_t>(strtoul(value, nullptr, 10));
+        } else if (arg == "--image-mutations" && (value = next())) {
+            mutations = static_cast<size_t>(strtoul(value, nullptr, 10));
+        } else if (arg == "--handle-ms" && (value = next())) {
+            handle_ms = atoi(value);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (!only.empty() && only != "differential" && only != "image" && only != "handle") {
+        print_usage();
+        return 1;
+    }
+
+    if (only.empty() || only == "differential") test_differential(seed, sets, codegen_sets);
+    if (only.empty() || only == "image") test_images(seed, mutations);
+    if (only.empty() || only == "handle") test_handle(seed, handle_ms);
+    if (failures != 0) {
+        cout << failures << " failures (seed " << seed << ")\n";
+        return 1;
+    }
+    cout << "all passed (seed " << seed << ")\n";
+    return 0;
+}
@@ -0,0 +1,144 @@
+#ifndef SWITCH_TIERED_HPP
+#define SWITCH_TIERED_HPP
+
+// A rule switch that starts cheap and optimizes itself once it is hot.
+// Tier 0 is the bytecode interpreter (see switch_bytecode.hpp): one linear
+// pass over the rules to build, no machine code. Every evaluation is counted;
+// when the count reaches `hot_after`, native code (see switch_jit.hpp) is
+// built on a background thread and published with one atomic store. Calls
+// made in the meantime keep running on tier 0, and calls after the store run
+// the native code. Rules that are evaluated rarely never pay for compilation.
+// Tier 0 also counts the matches of every rule, and the native code tries
+// the most frequent rules first where they are disjoint from the rules they
+// move ahead of (see reorder_rules).
+// Usage:
+//   TieredSwitch<Order> sw(parse_rule_file("rules.txt"), schema, actions);
+//   sw.evaluate(order); // from any thread
+//   sw.tier();          // Tier::Interpreted, then Tier::Optimized
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "switch_bytecode.hpp"
+#include "switch_jit.hpp"
+
+struct TieringOptions {
+    std::uint64_t hot_after = 1000; // Evaluations before promotion; 0: promote on the first call.
+    bool background = true;         // false: the call that crosses the threshold compiles.
+    bool reorder = true;            // Order disjoint rules by the matches counted on tier 0.
+    JitOptions jit;
+};
+
+template <typename T>
+class TieredSwitch {
+public:
+    // Failed: native code was not available (or could not be built); the
+    // switch stays on tier 0.
+    enum class Tier { Interpreted, Compiling, Optimized, Failed };
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    TieredSwitch(const RuleSet& rules, const RuleSchema<T>& schema, const RuleActions<T>& actions,
+                 TieringOptions options = TieringOptions())
+        : rules_(rules), schema_(schema), actions_(actions), options_(std::move(options)),
+          reach_(check_reachability(rules)), interpreter_(compile_bytecode(rules, schema, reach_), schema, actions),
+          hits_(new std::atomic<std::uint64_t>[rules.rules.size()]()) {}
+
+    // Waits for a background compilation that is still running.
+    ~TieredSwitch() {
+        if (compiler_.joinable()) compiler_.join();
+    }
+
+    TieredSwitch(const TieredSwitch&) = delete;
+    TieredSwitch& operator=(const TieredSwitch&) = delete;
+
+    // Index (in rule-file order) of the first matching rule, or npos.
+    std::size_t find(const T& value) const {
+        if (const JitSwitch<T>* fast = optimized_.load(std::memory_order_acquire)) return fast->find(value);
+        std::size_t rule = interpreter_.find(value);
+        count(rule);
+        return rule;
+    }
+
+    // Runs the action of the first matching rule, or the default action.
+    // Returns true if a rule (not the default) matched.
+    bool evaluate(const T& value) const {
+        if (const JitSwitch<T>* fast = optimized_.load(std::memory_order_acquire)) return fast->evaluate(value);
+        std::size_t rule = interpreter_.find(value);
+        count(rule);
+        return interpreter_.run_action(rule, value);
+    }
+
+    // Starts promotion now, regardless of the count.
+    void promote() const {
+        Tier expected = Tier::Interpreted;
+        if (!tier_.compare_exchange_strong(expected, Tier::Compiling, std::memory_order_acq_rel)) return;
+        if (options_.background) {
+            compiler_ = std::thread([this] { compile(); });
+        } else {
+            compile();
+        }
+    }
+
+    // Blocks until a promotion that has been started has finished.
+    void wait() const {
+        while (tier_.load(std::memory_order_acquire) == Tier::Compiling) std::this_thread::yield();
+    }
+
+    Tier tier() const { return tier_.load(std::memory_order_acquire); }
+    // Evaluations counted on tier 0 (counting stops after promotion).
+    std::uint64_t evaluations() const { return evaluations_.load(std::memory_order_relaxed); }
+    // Matches of rule `rule` counted on tier 0.
+    std::uint64_t hits(std::size_t rule) const { return hits_[rule].load(std::memory_order_relaxed); }
+
+private:
+    void count(std::size_t rule) const {
+        if (rule != npos) hits_[rule].fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t n = evaluations_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (n >= options_.hot_after && tier_.load(std::memory_order_relaxed) == Tier::Interpreted) promote();
+    }
+
+    void compile() const {
+        try {
+            SwitchProgram program = interpreter_.program();
+            if (options_.reorder) {
+                std::vector<std::uint64_t> hits(rules_.rules.size());
+                for (std::size_t i = 0; i < hits.size(); ++i) hits[i] = hits_[i].load(std::memory_order_relaxed);
+                program = compile_bytecode(reorder_rules(rules_, hits, reach_), schema_, reach_);
+            }
+            auto fast = std::make_unique<JitSwitch<T>>(std::move(program), schema_, actions_, options_.jit);
+            if (!fast->jitted()) {
+                // No native code on this platform: tier 0 is as good as it gets.
+                tier_.store(Tier::Failed, std::memory_order_release);
+                return;
+            }
+            optimized_owner_ = std::move(fast);
+            optimized_.store(optimized_owner_.get(), std::memory_order_release);
+            tier_.store(Tier::Optimized, std::memory_order_release);
+        } catch (...) {
+            tier_.store(Tier::Failed, std::memory_order_release);
+        }
+    }
+
+    RuleSet rules_;
+    RuleSchema<T> schema_;
+    RuleActions<T> actions_;
+    TieringOptions options_;
+    RuleReachability reach_; // Also holds for the reordered rules.
+    BytecodeSwitch<T> interpreter_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> hits_; // Matches per rule on tier 0.
+    // Tiering state changes under const evaluate(); it is not part of the
+    // observable value of the switch.
+    mutable std::atomic<std::uint64_t> evaluations_{0};
+    mutable std::atomic<Tier> tier_{Tier::Interpreted};
+    mutable std::atomic<const JitSwitch<T>*> optimized_{nullptr};
+    mutable std::unique_ptr<JitSwitch<T>> optimized_owner_; // Written once, before optimized_ is published.
+    mutable std::thread compiler_;
+};
+
+#endif // SWITCH_TIERED_HPP
@@ -0,0 +1,378 @@
+#ifndef SWITCH_TIMING_HPP
+#define SWITCH_TIMING_HPP
+
+// Cycle-accurate per-case latency instrumentation for the custom switch.
+// Usage:
+//   static SwitchProfile profile(3); // number of cases in the switch
+//   profile.sample_every(64);        // optional: time 1 in 64 evaluations
+//   SWITCH_TIMED(value, profile) { CASE(...) ... BREAK ... } END_SWITCH
+//   profile.report(std::cout);
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SWITCH_HAS_RDTSC 1
+#else
+#define SWITCH_HAS_RDTSC 0
+#endif
+
+#include "custom_switch.hpp"
+
+// Reads the cycle counter at the start of a measured region.
+// lfence keeps earlier instructions from leaking into the measurement.
+inline std::uint64_t switch_cycles_begin() {
+#if SWITCH_HAS_RDTSC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Reads the cycle counter at the end of a measured region.
+// rdtscp waits for the measured instructions to retire; lfence keeps later
+// instructions from starting before the read.
+inline std::uint64_t switch_cycles_end() {
+#if SWITCH_HAS_RDTSC
+    unsigned int aux;
+    std::uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    return static_cast<std::uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Lock-free log-linear (HDR-style) histogram of cycle counts.
+// Values below 2^kSubBucketBits are stored exactly; above that each power of
+// two is split into 2^kSubBucketBits linear sub-buckets (~6% relative error).
+// record() is a single relaxed fetch_add, so any number of threads can record.
+class LogLinearHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr unsigned kSubBuckets = 1u << kSubBucketBits;
+    static constexpr unsigned kMaxBits = 40; // Larger values land in the top bucket.
+    static constexpr unsigned kBucketCount = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    LogLinearHistogram() { reset(); }
+    LogLinearHistogram(const LogLinearHistogram&) = delete;
+    LogLinearHistogram& operator=(const LogLinearHistogram&) = delete;
+
+    // Adds `weight` observations of `value`.
+    void record(std::uint64_t value, std::uint64_t weight = 1) noexcept {
+        buckets_[bucket_index(value)].fetch_add(weight, std::memory_order_relaxed);
+    }
+
+    // Total number of recorded observations.
+    std::uint64_t count() const noexcept {
+        std::uint64_t total = 0;
+        for (const auto& b : buckets_) total += b.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Returns the representative value of the bucket holding quantile `q` (0..1).
+    // Returns 0 for an empty histogram.
+    std::uint64_t percentile(double q) const noexcept {
+        std::uint64_t total = count();
+        if (total == 0) return 0;
+        std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (unsigned i = 0; i < kBucketCount; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return bucket_value(i);
+        }
+        return bucket_value(kBucketCount - 1);
+    }
+
+    void reset() noexcept {
+        for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+    }
+
+    // Maps a value to its bucket.
+    static unsigned bucket_index(std::uint64_t value) noexcept {
+        if (value < kSubBuckets) return static_cast<unsigned>(value);
+        unsigned msb = 63u - static_cast<unsigned>(__builtin_clzll(value));
+        if (msb >= kMaxBits) return kBucketCount - 1;
+        unsigned shift = msb - kSubBucketBits;
+        unsigned sub = static_cast<unsigned>(value >> shift) & (kSubBuckets - 1);
+        return (shift + 1) * kSubBuckets + sub;
+    }
+
+    // Midpoint of the value range covered by bucket `index`.
+    static std::uint64_t bucket_value(unsigned index) noexcept {
+        if (index < kSubBuckets) return index;
+        unsigned shift = index / kSubBuckets - 1;
+        std::uint64_t lower = static_cast<std::uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+        return lower + ((std::uint64_t{1} << shift) >> 1);
+    }
+
+private:
+    std::atomic<std::uint64_t> buckets_[kBucketCount];
+};
+
+// Predicate and action latency of one case.
+// Aligned to a cache line so that cases recorded from different threads do
+// not false-share.
+struct alignas(64) CaseLatency {
+    LogLinearHistogram predicate;
+    LogLinearHistogram action;
+};
+
+class SwitchProfile;
+
+// Per-thread sampling state of one SwitchProfile.
+// `countdown` is decremented on every evaluation; the evaluation that brings
+// it to zero is timed and stands for `weight` evaluations. The first
+// evaluation on a thread is timed and starts the countdown.
+struct SwitchSamplerSlot {
+    bool started = false;
+    std::uint64_t countdown = 1;
+    std::uint64_t weight = 1;
+    std::uint64_t last_cycles = 0;
+};
+
+namespace switch_timing_detail {
+
+struct SamplerCache {
+    SamplerCache();
+    ~SamplerCache();
+
+    std::uint64_t ids[16] = {};
+    SwitchSamplerSlot* slots[16] = {};
+    std::unordered_map<std::uint64_t, SwitchSamplerSlot> all; // Nodes do not move.
+};
+
+// This thread's cache while it exists. Trivially destructible, so a profile
+// destroyed after the cache (a static one, at exit) can still test it.
+inline thread_local SamplerCache* live_cache = nullptr;
+
+inline SamplerCache::SamplerCache() { live_cache = this; }
+inline SamplerCache::~SamplerCache() { live_cache = nullptr; }
+
+} // namespace switch_timing_detail
+
+// Returns this thread's sampler slot for the profile with id `id`.
+// Every profile used on the thread keeps its own slot in a map; a small
+// direct-mapped cache in front of it finds the slot of a hot profile with one
+// compare. Profiles that collide in the cache only cost a map lookup, never
+// a reset of their countdown.
+inline SwitchSamplerSlot& switch_sampler_slot(std::uint64_t id) {
+    static thread_local switch_timing_detail::SamplerCache cache;
+    std::size_t line = id & 15;
+    if (cache.ids[line] != id) {
+        cache.ids[line] = id;
+        cache.slots[line] = &cache.all[id];
+    }
+    return *cache.slots[line];
+}
+
+// Drops this thread's slot for the profile with id `id`; SwitchProfile calls
+// it when destroyed. Slots the profile has on other threads stay until those
+// threads exit, so threads that keep creating short-lived profiles should
+// destroy them on the thread that sampled them.
+inline void switch_sampler_release(std::uint64_t id) {
+    switch_timing_detail::SamplerCache* cache = switch_timing_detail::live_cache;
+    if (!cache) return;
+    std::size_t line = id & 15;
+    if (cache->ids[line] == id) {
+        cache->ids[line] = 0;
+        cache->slots[line] = nullptr;
+    }
+    cache->all.erase(id);
+}
+
+// Latency statistics for one SWITCH call site.
+// Holds a fixed number of per-case slots so that recording never allocates
+// or locks; cases beyond `case_count` are evaluated but not recorded.
+// By default every evaluation is timed; sample_every() and sample_interval()
+// reduce that, and histograms/counters are weighted so they still estimate
+// totals over all evaluations.
+class SwitchProfile {
+public:
+    explicit SwitchProfile(std::size_t case_count, std::string name = "switch")
+        : name_(std::move(name)), case_count_(case_count),
+          cases_(new CaseLatency[case_count]), id_(next_id()) {}
+
+    ~SwitchProfile() { switch_sampler_release(id_); }
+
+    std::size_t case_count() const { return case_count_; }
+    const std::string& name() const { return name_; }
+
+    // Returns the slot for case `index`, or nullptr if the profile is too small.
+    CaseLatency* case_latency(std::size_t index) noexcept {
+        return index < case_count_ ? &cases_[index] : nullptr;
+    }
+    const CaseLatency* case_latency(std::size_t index) const noexcept {
+        return index < case_count_ ? &cases_[index] : nullptr;
+    }
+
+    LogLinearHistogram& default_action() noexcept { return default_; }
+    const LogLinearHistogram& default_action() const noexcept { return default_; }
+
+    // Times one in every `n` evaluations per thread (n = 1 times all of them).
+    void sample_every(std::uint64_t n) {
+        sample_period_.store(n == 0 ? 1 : n, std::memory_order_relaxed);
+        sample_interval_.store(0, std::memory_order_relaxed);
+    }
+
+    // Times roughly one evaluation per `cycles` per thread. The countdown is
+    // re-derived from the evaluation rate observed between samples, so the
+    // fast path never reads the clock.
+    void sample_interval(std::uint64_t cycles) {
+        sample_interval_.store(cycles == 0 ? 1 : cycles, std::memory_order_relaxed);
+    }
+
+    // Fast path of sampling: one decrement and a well-predicted branch.
+    // Returns true if this evaluation should be timed and stores in `weight`
+    // the number of evaluations it stands for.
+    bool sample(std::uint64_t& weight) {
+        SwitchSamplerSlot& slot = switch_sampler_slot(id_);
+        if (--slot.countdown != 0) return false;
+        return take_sample(slot, weight);
+    }
+
+    // Estimated number of evaluations (sampled ones scaled by their weight).
+    std::uint64_t evaluations() const noexcept { return evaluations_.load(std::memory_order_relaxed); }
+    // Number of evaluations actually timed.
+    std::uint64_t samples() const noexcept { return samples_.load(std::memory_order_relaxed); }
+
+    // Writes p50/p99/p999 (in cycles) of every predicate and action.
+    // Counts are scaled estimates over all evaluations, not raw samples.
+    void report(std::ostream& out) const {
+        out << "Switch profile '" << name_ << "' (cycles), evaluations~" << evaluations()
+            << " from " << samples() << " samples\n";
+        for (std::size_t i = 0; i < case_count_; ++i) {
+            out << "  case " << i << ": predicate ";
+            write_percentiles(out, cases_[i].predicate);
+            out << " | action ";
+            write_percentiles(out, cases_[i].action);
+            out << '\n';
+        }
+        out << "  default: action ";
+        write_percentiles(out, default_);
+        out << '\n';
+    }
+
+    void reset() noexcept {
+        for (std::size_t i = 0; i < case_count_; ++i) {
+            cases_[i].predicate.reset();
+            cases_[i].action.reset();
+        }
+        default_.reset();
+        evaluations_.store(0, std::memory_order_relaxed);
+        samples_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr std::uint64_t kIntervalWarmup = 64;
+
+    // Slow path of sample(): reloads the countdown and records the counters.
+    bool take_sample(SwitchSamplerSlot& slot, std::uint64_t& weight) {
+        std::uint64_t interval = sample_interval_.load(std::memory_order_relaxed);
+        bool first = !slot.started;
+        if (first) {
+            // First evaluation of this profile on this thread.
+            slot.started = true;
+            slot.weight = 1;
+        }
+        weight = slot.weight;
+        std::uint64_t next = sample_period_.load(std::memory_order_relaxed);
+        if (interval) {
+            std::uint64_t now = switch_cycles_begin();
+            if (first) {
+                // No earlier sample to derive the rate from: measure it over
+                // the next kIntervalWarmup evaluations.
+                next = kIntervalWarmup;
+            } else {
+                std::uint64_t elapsed = now - slot.last_cycles;
+                next = elapsed ? (interval * slot.weight) / elapsed : slot.weight * 2;
+                if (next == 0) next = 1;
+                if (next > (std::uint64_t{1} << 24)) next = std::uint64_t{1} << 24;
+            }
+            slot.last_cycles = now;
+        }
+        slot.countdown = next;
+        slot.weight = next;
+        evaluations_.fetch_add(weight, std::memory_order_relaxed);
+        samples_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Ids key the per-thread sampler slots; they are never reused, so a new
+    // profile never inherits the slot of a destroyed one.
+    static std::uint64_t next_id() {
+        static std::atomic<std::uint64_t> last{0};
+        return last.fetch_add(1, std::memory_order_relaxed) + 1; // 0 marks an empty cache line.
+    }
+
+    static void write_percentiles(std::ostream& out, const LogLinearHistogram& h) {
+        out << "n=" << h.count()
+            << " p50=" << h.percentile(0.50)
+            << " p99=" << h.percentile(0.99)
+            << " p999=" << h.percentile(0.999);
+    }
+
+    std::string name_;
+    std::size_t case_count_;
+    std::unique_ptr<CaseLatency[]> cases_;
+    std::uint64_t id_;
+    std::atomic<std::uint64_t> sample_period_{1};
+    std::atomic<std::uint64_t> sample_interval_{0}; // 0 = count-based sampling.
+    alignas(64) std::atomic<std::uint64_t> evaluations_{0};
+    std::atomic<std::uint64_t> samples_{0};
+    alignas(64) LogLinearHistogram default_;
+};
+
+// Timing policy for Switch that records rdtsc/rdtscp cycle counts into a
+// SwitchProfile, following the profile's sampling settings.
+// Cheap to copy: it only holds a pointer to the profile and the sample weight.
+class CycleTiming {
+public:
+    static constexpr bool enabled = true;
+
+    explicit CycleTiming(SwitchProfile& profile) : profile_(&profile) {}
+
+    static std::uint64_t now_begin() { return switch_cycles_begin(); }
+    static std::uint64_t now_end() { return switch_cycles_end(); }
+
+    bool sample() { return profile_->sample(weight_); }
+
+    void record_predicate(std::size_t index, std::uint64_t cycles) {
+        if (CaseLatency* slot = profile_->case_latency(index)) slot->predicate.record(cycles, weight_);
+    }
+    void record_action(std::size_t index, std::uint64_t cycles) {
+        if (CaseLatency* slot = profile_->case_latency(index)) slot->action.record(cycles, weight_);
+    }
+    void record_default(std::uint64_t cycles) {
+        profile_->default_action().record(cycles, weight_);
+    }
+
+private:
+    SwitchProfile* profile_;
+    std::uint64_t weight_ = 1; // Evaluations represented by the current sample.
+};
+
+// Same as SWITCH(x), but records per-case latencies into `profile`
+// (an lvalue SwitchProfile that outlives the switch, usually a static).
+// Usage: SWITCH_TIMED(my_variable, my_profile) { ... } END_SWITCH
+#define SWITCH_TIMED(x, profile) \
+    { /* Open scope for the switch block */ \
+        using SWITCH_VAR(_sw_value_type_) = std::decay_t<decltype(x)>; /* Deduce and clean the type of x */ \
+        auto SWITCH_VAR(_sw_obj_) = Switch<SWITCH_VAR(_sw_value_type_), CycleTiming>(x, CycleTiming(profile)); \
+        auto& _sw_obj_ = SWITCH_VAR(_sw_obj_); /* Create a convenient alias for the Switch object */ \
+        using _sw_value_type_ = SWITCH_VAR(_sw_value_type_); /* Create a convenient alias for the value type */ \
+        ; /* Semicolon to terminate declarations */ \
+        /* User code block {...} follows here */
+
+#endif // SWITCH_TIMING_HPP